@@ -0,0 +1,295 @@
+/**
+ * \brief Collects plots as jobs and renders them headless in worker processes.
+ *        A job describes a canvas (size, pad grid, style) and, for every pad,
+ *        the objects to draw with their draw options, legend labels and text.
+ *        renderPlots() hashes the streamed objects of every job and skips the
+ *        ones whose inputs are unchanged since their last render, then forks
+ *        workers that render the rest in batch mode.
+ *
+ *        Anything a pad needs after drawing (axis labels of a TMultiGraph,
+ *        tick lengths of a THStack, ...) goes in its afterDraw callback.  The
+ *        callback is not part of the hash, change the job's tag when editing it.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#ifndef BATCH_RENDER
+#define BATCH_RENDER
+
+#include <TROOT.h>
+#include <TBufferFile.h>
+#include <TCanvas.h>
+#include <TLegend.h>
+#include <TStyle.h>
+#include <TSystem.h>
+#include <TText.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "instrumentation.h"
+
+struct PlotItem {
+    TObject *object;
+    std::string option;
+    std::string label;          // Legend entry, none if empty
+    std::string legendOption;
+};
+
+struct PlotText {
+    double x;
+    double y;
+    std::string text;
+};
+
+struct PlotPad {
+    std::vector<PlotItem> items;
+    std::vector<PlotItem> legendEntries;    // In the legend but not drawn, e.g. members of a TMultiGraph
+    std::vector<PlotText> texts;
+    bool logx = false;
+    bool logy = false;
+    bool logz = false;
+    bool legend = false;
+    double legendX1 = 0.65, legendY1 = 0.78, legendX2 = 0.75, legendY2 = 0.85;
+    double legendTextSize = 0.03;
+    std::function<void()> afterDraw;
+
+    void add(TObject *object, const char *option = "", const char *label = "", const char *legendOption = "l") {
+        PlotItem item;
+        item.object = object;
+        item.option = option;
+        item.label = label;
+        item.legendOption = legendOption;
+        items.push_back(item);
+    }
+
+    void addLegendEntry(TObject *object, const char *label, const char *legendOption = "l") {
+        PlotItem item;
+        item.object = object;
+        item.label = label;
+        item.legendOption = legendOption;
+        legendEntries.push_back(item);
+    }
+};
+
+struct PlotJob {
+    std::string name;
+    std::string outputFile;
+    std::string tag;            // Bump to force a rerender after changing an afterDraw callback
+    int32_t width = 1000;
+    int32_t height = 1000;
+    int32_t columns = 1;
+    int32_t rows = 1;
+    int32_t palette = kBird;
+    int32_t optStat = 0;
+    std::vector<PlotPad> pads;
+
+    PlotJob(const char *jobName, const char *output, int32_t padColumns = 1, int32_t padRows = 1)
+        : name(jobName), outputFile(output), columns(padColumns), rows(padRows), pads(padColumns * padRows) {}
+};
+
+// FNV-1a, enough to notice a changed input
+inline uint64_t hashBytes(const void *data, uint64_t length, uint64_t hash = 14695981039346656037ull) {
+    const unsigned char *bytes = (const unsigned char*)data;
+    for (uint64_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline uint64_t hashString(const std::string &text, uint64_t hash) {
+    return hashBytes(text.c_str(), text.size() + 1, hash);
+}
+
+// Hash of everything that ends up in the image: the streamed objects, options and layout
+inline uint64_t plotJobHash(const PlotJob &job) {
+    uint64_t hash = hashString(job.outputFile, hashString(job.tag, hashBytes(nullptr, 0)));
+    int32_t layout[6] = {job.width, job.height, job.columns, job.rows, job.palette, job.optStat};
+    hash = hashBytes(layout, sizeof(layout), hash);
+    for (uint32_t p = 0; p < job.pads.size(); p++) {
+        const PlotPad &pad = job.pads[p];
+        bool flags[4] = {pad.logx, pad.logy, pad.logz, pad.legend};
+        double legend[5] = {pad.legendX1, pad.legendY1, pad.legendX2, pad.legendY2, pad.legendTextSize};
+        hash = hashBytes(flags, sizeof(flags), hash);
+        hash = hashBytes(legend, sizeof(legend), hash);
+        for (uint32_t i = 0; i < pad.items.size() + pad.legendEntries.size(); i++) {
+            const PlotItem &item = i < pad.items.size() ? pad.items[i] : pad.legendEntries[i - pad.items.size()];
+            TBufferFile buffer(TBuffer::kWrite);
+            buffer.WriteObject(item.object);
+            hash = hashBytes(buffer.Buffer(), buffer.Length(), hash);
+            hash = hashString(item.option, hash);
+            hash = hashString(item.label, hash);
+            hash = hashString(item.legendOption, hash);
+        }
+        for (uint32_t i = 0; i < pad.texts.size(); i++) {
+            double position[2] = {pad.texts[i].x, pad.texts[i].y};
+            hash = hashBytes(position, sizeof(position), hash);
+            hash = hashString(pad.texts[i].text, hash);
+        }
+    }
+    return hash;
+}
+
+// The hash of the last render lives in a .render_cache directory next to the image
+inline std::string plotStampFile(const PlotJob &job) {
+    std::string output = job.outputFile;
+    size_t slash = output.find_last_of('/');
+    std::string directory = slash == std::string::npos ? "." : output.substr(0, slash);
+    std::string base = slash == std::string::npos ? output : output.substr(slash + 1);
+    return directory + "/.render_cache/" + base + ".hash";
+}
+
+inline bool plotUpToDate(const PlotJob &job, uint64_t hash) {
+    if (gSystem->AccessPathName(job.outputFile.c_str())) {    // True when the file is missing
+        return false;
+    }
+    FILE *stamp = fopen(plotStampFile(job).c_str(), "r");
+    if (stamp == nullptr) {
+        return false;
+    }
+    unsigned long long stored = 0;
+    bool match = fscanf(stamp, "%llx", &stored) == 1 && stored == hash;
+    fclose(stamp);
+    return match;
+}
+
+inline void writePlotStamp(const PlotJob &job, uint64_t hash) {
+    std::string stampFile = plotStampFile(job);
+    gSystem->mkdir(stampFile.substr(0, stampFile.find_last_of('/')).c_str(), true);
+    FILE *stamp = fopen(stampFile.c_str(), "w");
+    if (stamp != nullptr) {
+        fprintf(stamp, "%llx\n", (unsigned long long)hash);
+        fclose(stamp);
+    }
+}
+
+// Draws one job onto a fresh canvas and saves it, the canvas is returned for interactive use
+inline TCanvas *renderPlotJob(const PlotJob &job) {
+    gStyle->SetPalette(job.palette);
+    gStyle->SetOptStat(job.optStat);
+    TCanvas *canvas = new TCanvas(job.name.c_str(), job.name.c_str(), job.width, job.height);
+    if (job.pads.size() > 1) {
+        canvas->Divide(job.columns, job.rows);
+    }
+    for (uint32_t p = 0; p < job.pads.size(); p++) {
+        const PlotPad &pad = job.pads[p];
+        canvas->cd(job.pads.size() > 1 ? p + 1 : 0);
+        if (pad.logx) gPad->SetLogx();
+        if (pad.logy) gPad->SetLogy();
+        if (pad.logz) gPad->SetLogz();
+        for (uint32_t i = 0; i < pad.items.size(); i++) {
+            pad.items[i].object->Draw(pad.items[i].option.c_str());
+        }
+        if (pad.afterDraw) {
+            pad.afterDraw();
+        }
+        if (pad.legend) {
+            TLegend *legend = new TLegend(pad.legendX1, pad.legendY1, pad.legendX2, pad.legendY2);
+            legend->SetBorderSize(0);
+            legend->SetFillColor(0);
+            legend->SetTextSize(pad.legendTextSize);
+            for (uint32_t i = 0; i < pad.items.size() + pad.legendEntries.size(); i++) {
+                const PlotItem &item = i < pad.items.size() ? pad.items[i] : pad.legendEntries[i - pad.items.size()];
+                if (!item.label.empty()) {
+                    legend->AddEntry(item.object, item.label.c_str(), item.legendOption.c_str());
+                }
+            }
+            legend->Draw();
+        }
+        for (uint32_t i = 0; i < pad.texts.size(); i++) {
+            TText *text = new TText();
+            text->DrawText(pad.texts[i].x, pad.texts[i].y, pad.texts[i].text.c_str());
+        }
+    }
+    canvas->Draw();
+    canvas->SaveAs(job.outputFile.c_str());
+    return canvas;
+}
+
+// Renders every job whose inputs changed.  With nWorkers == 0 the jobs are drawn in this
+// process and the canvases stay open, otherwise nWorkers forked processes render headless.
+inline void renderPlots(const std::vector<PlotJob> &jobs, uint32_t nWorkers) {
+    ScopedTimer timer("render_plots", jobs.size());
+    std::vector<uint32_t> stale;
+    std::vector<uint64_t> hashes(jobs.size());
+    for (uint32_t j = 0; j < jobs.size(); j++) {
+        hashes[j] = plotJobHash(jobs[j]);
+        if (!plotUpToDate(jobs[j], hashes[j])) {
+            stale.push_back(j);
+        }
+    }
+    std::cout << "Rendering " << stale.size() << " of " << jobs.size() << " plots, "
+              << jobs.size() - stale.size() << " unchanged" << std::endl;
+    if (stale.empty()) {
+        return;
+    }
+
+    if (nWorkers == 0) {
+        for (uint32_t s = 0; s < stale.size(); s++) {
+            renderPlotJob(jobs[stale[s]]);
+            writePlotStamp(jobs[stale[s]], hashes[stale[s]]);
+        }
+        return;
+    }
+
+    if (nWorkers > stale.size()) {
+        nWorkers = stale.size();
+    }
+    std::vector<pid_t> workers(nWorkers, -1);
+    fflush(stdout);
+    fflush(stderr);
+    for (uint32_t w = 0; w < nWorkers; w++) {
+        workers[w] = fork();
+        if (workers[w] == 0) {
+            gROOT->SetBatch(kTRUE);
+            for (uint32_t s = w; s < stale.size(); s += nWorkers) {
+                delete renderPlotJob(jobs[stale[s]]);
+            }
+            fflush(stdout);
+            _exit(0);
+        }
+        if (workers[w] < 0) {
+            std::cerr << "Could not start render worker " << w << ", rendering its plots here" << std::endl;
+        }
+    }
+
+    // Only stamp the plots of workers that finished cleanly
+    bool batch = gROOT->IsBatch();
+    for (uint32_t w = 0; w < nWorkers; w++) {
+        int status = 0;
+        bool good;
+        if (workers[w] < 0) {
+            gROOT->SetBatch(kTRUE);
+            for (uint32_t s = w; s < stale.size(); s += nWorkers) {
+                delete renderPlotJob(jobs[stale[s]]);
+            }
+            gROOT->SetBatch(batch);
+            good = true;
+        }
+        else {
+            good = waitpid(workers[w], &status, 0) == workers[w] && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        }
+        if (!good) {
+            std::cerr << "Render worker " << w << " failed, its plots will be redrawn next time" << std::endl;
+            continue;
+        }
+        for (uint32_t s = w; s < stale.size(); s += nWorkers) {
+            writePlotStamp(jobs[stale[s]], hashes[stale[s]]);
+        }
+    }
+}
+
+#endif // BATCH_RENDER
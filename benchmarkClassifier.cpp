@@ -0,0 +1,129 @@
+/**
+ * \brief Measures the per event cost of assigning centrality with the cut tables
+ *        from quantiles.cpp and centralityClassifier.h, compared to the path this
+ *        project has used so far: predicting X_zeta' from the TMatrixD, filling
+ *        a histogram, TH1::GetQuantiles and a TMath::BinarySearch per event.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#include <TROOT.h>
+#include <TFile.h>
+#include <TH1D.h>
+#include <TMath.h>
+#include <TMatrixD.h>
+#include <TStopwatch.h>
+
+#include <iostream>
+#include <stdint.h>
+#include <vector>
+
+#include "centralityClassifier.h"
+#include "eventStore.h"
+
+void benchmarkClassifier(const char *inFileName = "data/detector_data.root", const char *method = "linear",
+                         uint32_t repeats = 10) {
+    TMatrixD *c = loadRingSums(inFileName);
+
+    TFile relations("data/epd_tpc_relations.root");
+    TMatrixD *weights = nullptr;
+    relations.GetDirectory("methods")->GetObject(Form("%s_weights", method), weights);
+    relations.Close();
+    if (c == nullptr || weights == nullptr) {
+        std::cerr << "Could not load ring sums or weights for " << method << std::endl;
+        return;
+    }
+
+    CentralityClassifier classifier;
+    if (!classifier.load(Form("data/cut_tables/%s.cut", method))) {
+        return;
+    }
+
+    uint32_t numEvents = c->GetNcols();
+    uint32_t numBoundaries = classifier.numberOfSlices() - 1;
+    std::cout << "Classifying " << numEvents << " events " << repeats << " times into "
+              << classifier.numberOfSlices() << " slices" << std::endl;
+
+    // Other analyses hold the rings of one event together, so the classifier reads event major data
+    std::vector<double> events(numEvents * 16);
+    for (uint32_t i = 0; i < numEvents; i++) {
+        for (uint32_t r = 0; r < 16; r++) {
+            events[i * 16 + r] = (*c)[r][i];
+        }
+    }
+
+    // GetQuantiles path, setup is timed on its own since it only happens once per dataset
+    TStopwatch timer;
+    timer.Start();
+    std::vector<double> predictions(numEvents);
+    for (uint32_t i = 0; i < numEvents; i++) {
+        predictions[i] = (*weights)[16][0];
+        for (uint32_t j = 0; j < 16; j++) {
+            predictions[i] += (*c)[j][i] * (*weights)[j][0];
+        }
+    }
+    TH1D *predictionHistogram = new TH1D("benchmark_predictions", "", 200, -100, 300);
+    for (uint32_t i = 0; i < numEvents; i++) {
+        predictionHistogram->Fill(predictions[i]);
+    }
+    std::vector<double> probabilities(numBoundaries);
+    std::vector<double> boundaries(numBoundaries);
+    for (uint32_t i = 0; i < numBoundaries; i++) {
+        probabilities[i] = double(i + 1) / classifier.numberOfSlices();
+    }
+    predictionHistogram->GetQuantiles(numBoundaries, boundaries.data(), probabilities.data());
+    timer.Stop();
+    double setupTime = timer.RealTime();
+
+    std::vector<uint32_t> quantileSlices(numEvents);
+    timer.Start();
+    for (uint32_t pass = 0; pass < repeats; pass++) {
+        for (uint32_t i = 0; i < numEvents; i++) {
+            double prediction = (*weights)[16][0];
+            for (uint32_t j = 0; j < 16; j++) {
+                prediction += (*c)[j][i] * (*weights)[j][0];
+            }
+            // BinarySearch returns the last boundary <= x, shift to the slice convention of the cut tables
+            Long64_t below = TMath::BinarySearch((Long64_t)numBoundaries, boundaries.data(), prediction);
+            if (below >= 0 && boundaries[below] == prediction) {
+                below--;
+            }
+            quantileSlices[i] = below + 1;
+        }
+    }
+    timer.Stop();
+    double quantileTime = timer.RealTime();
+
+    std::vector<uint32_t> classifierSlices(numEvents);
+    timer.Start();
+    for (uint32_t pass = 0; pass < repeats; pass++) {
+        for (uint32_t i = 0; i < numEvents; i++) {
+            classifierSlices[i] = classifier.classifyEvent(&events[i * 16]);
+        }
+    }
+    timer.Stop();
+    double classifierTime = timer.RealTime();
+
+    // Both sets of boundaries come from 200 bin histograms of X_zeta', so they should agree closely
+    uint64_t agree = 0;
+    for (uint32_t i = 0; i < numEvents; i++) {
+        agree += quantileSlices[i] == classifierSlices[i];
+    }
+
+    double calls = double(numEvents) * repeats;
+    std::cout << "GetQuantiles setup:      " << setupTime << " s" << std::endl;
+    std::cout << "GetQuantiles path:       " << 1e9 * quantileTime / calls << " ns/event, "
+              << calls / quantileTime << " events/s" << std::endl;
+    std::cout << "CentralityClassifier:    " << 1e9 * classifierTime / calls << " ns/event, "
+              << calls / classifierTime << " events/s" << std::endl;
+    std::cout << "Speedup:                 " << quantileTime / classifierTime << std::endl;
+    std::cout << "Slice agreement:         " << 100. * agree / numEvents << "%" << std::endl;
+
+    delete predictionHistogram;
+    delete weights;
+    delete c;
+}
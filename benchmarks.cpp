@@ -0,0 +1,574 @@
+/**
+ * \brief Benchmarks of the analysis kernels and of the stages end to end, on
+ *        synthetic events so no picoDsts are needed.  Every measurement is run
+ *        for 10^4, 10^5, ... events up to a limit and reports events/s, bytes/s
+ *        (of the data the kernel reads, not bytes on disk) and the heap
+ *        allocations of one run, counted by replacing operator new.
+ *
+ *            epdbench [--save] [--baseline file] [--max-events n]
+ *                     [--max-stage-events n] [--tolerance fraction] [--only name]
+ *
+ *        Results are compared with the baseline file; a kernel that got slower
+ *        by more than the tolerance (default 10%) or allocates more than it used
+ *        to is flagged and the exit code is 1.  --save writes the baseline
+ *        instead.  Baselines only mean something on the machine they were
+ *        recorded on.
+ *
+ *        The kernels hold 16 doubles per event, 10^8 events need about 14 GB,
+ *        which is why --max-events defaults to 10^7.  The stages run in a
+ *        scratch directory (EPD_BENCH_DIR, default /tmp) so they never touch
+ *        data/.  This is compiled only (the epdbench target), replacing
+ *        operator new does not work inside Cling.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#include <TROOT.h>
+#include <TFile.h>
+#include <TH1D.h>
+#include <TH2D.h>
+#include <TMatrixD.h>
+#include <TRandom3.h>
+#include <TStopwatch.h>
+#include <TSystem.h>
+#include <TVectorD.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "centralityClassifier.h"
+#include "centralityEstimator.h"
+#include "epdAnalysis.h"
+#include "epdHits.h"
+#include "eventStore.h"
+#include "gram.h"
+#include "hitStore.h"
+
+// Every heap allocation of the process goes through here
+std::atomic<uint64_t> allocationCount(0);
+
+void *operator new(size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    void *memory = malloc(size > 0 ? size : 1);
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void *memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept {
+    free(memory);
+}
+
+struct BenchmarkResult {
+    std::string kernel;
+    uint64_t events;
+    double seconds;         // Best of the repeats
+    double bytes;           // Read by one run
+    uint64_t allocations;   // Of one run, the fewest of the repeats
+
+    double eventRate() const { return events / seconds; }
+    double byteRate() const { return bytes / seconds; }
+};
+
+// Sends stdout and stderr to /dev/null while the stages print their progress
+class Quiet {
+public:
+    Quiet() {
+        fflush(stdout);
+        fflush(stderr);
+        savedOut = dup(1);
+        savedErr = dup(2);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, 1);
+        dup2(null, 2);
+        close(null);
+    }
+
+    ~Quiet() {
+        std::cout.flush();
+        fflush(stdout);
+        fflush(stderr);
+        dup2(savedOut, 1);
+        dup2(savedErr, 2);
+        close(savedOut);
+        close(savedErr);
+    }
+
+private:
+    int savedOut;
+    int savedErr;
+};
+
+// Stand in for StPicoEpdHit
+struct BenchmarkHit {
+    int16_t hitSide;
+    int16_t hitTile;
+    float hitNmip;
+
+    int16_t side() const { return hitSide; }
+    int16_t tile() const { return hitTile; }
+    float nMIP() const { return hitNmip; }
+};
+
+// Stand in for StPicoDst, the event's hits are consecutive in a pool
+struct BenchmarkPicoDst {
+    const BenchmarkHit *hits;
+    uint32_t numHits;
+
+    uint32_t numberOfEpdHits() const { return numHits; }
+    const BenchmarkHit *epdHit(uint32_t i) const { return hits + i; }
+};
+
+const uint32_t hitsPerEvent = 100;
+const uint32_t hitPoolSize = 1 << 20;   // Events cycle through this pool, 8 MB
+
+double minimumSeconds = 0.5;            // Repeat until this much time was measured...
+uint32_t minimumRepeats = 3;            // ...and at least this often
+uint32_t maximumRepeats = 50;
+
+template <typename Work>
+BenchmarkResult measure(const char *kernel, uint64_t events, double bytes, Work work) {
+    BenchmarkResult result = {kernel, events, -1, bytes, 0};
+    TStopwatch timer;
+    double total = 0;
+    for (uint32_t repeat = 0; repeat < maximumRepeats && (repeat < minimumRepeats || total < minimumSeconds); repeat++) {
+        uint64_t before;
+        {
+            Quiet quiet;
+            before = allocationCount.load();
+            timer.Start();
+            work();
+            timer.Stop();
+        }
+        uint64_t allocations = allocationCount.load() - before;
+        double seconds = timer.RealTime();
+        total += seconds;
+        if (result.seconds < 0 || seconds < result.seconds) {
+            result.seconds = seconds;
+        }
+        if (repeat == 0 || allocations < result.allocations) {
+            result.allocations = allocations;
+        }
+    }
+    if (result.seconds <= 0) {
+        result.seconds = 1e-9;
+    }
+    printf("%-24s %12llu %12.4g %12.4g %12.4g %12llu\n", kernel, (unsigned long long)events, result.seconds,
+           result.eventRate(), result.byteRate(), (unsigned long long)result.allocations);
+    fflush(stdout);
+    return result;
+}
+
+// RefMult from a falling distribution, each ring a noisy share of it.  Only the shapes matter here.
+void syntheticEvents(uint64_t numEvents, TMatrixD *&c, TVectorD *&g) {
+    c = new TMatrixD(16, numEvents);
+    g = new TVectorD(numEvents);
+    double *rings = c->GetMatrixArray();
+    double *tpc = g->GetMatrixArray();
+    TRandom3 random(numEvents);
+    for (uint64_t i = 0; i < numEvents; i++) {
+        double b = random.Rndm();
+        tpc[i] = floor(350 * (1 - b) * (1 - b) + random.Gaus(0, 5));
+        for (uint32_t r = 0; r < 16; r++) {
+            double share = tpc[i] * (16 - r) / 136.;
+            rings[r * numEvents + i] = share > 0 ? std::max(0., share + random.Gaus(0, sqrt(share))) : 0;
+        }
+    }
+}
+
+std::vector<BenchmarkResult> benchmarkKernels(uint64_t numEvents, const std::string &only) {
+    std::vector<BenchmarkResult> results;
+    TMatrixD *c;
+    TVectorD *g;
+    syntheticEvents(numEvents, c, g);
+    double ringBytes = numEvents * 16. * sizeof(double);
+
+    // The float path of linearWeights against the blocked double Gram, half the bytes each
+    std::vector<float> floatRings(c->GetMatrixArray(), c->GetMatrixArray() + 16 * numEvents);
+    std::vector<uint16_t> tpc(numEvents);
+    for (uint64_t i = 0; i < numEvents; i++) {
+        tpc[i] = (*g)[i];
+    }
+    std::vector<double> solution(gramDim);
+    floatGram(floatRings.data(), tpc.data(), numEvents).solve(solution.data());
+    TMatrixD *weights = gramWeightMatrix(solution.data());
+    if (only.empty() || only == "weightedGram") {
+        results.push_back(measure("weightedGram", numEvents, ringBytes + numEvents * sizeof(double), [&]() {
+            weightedGram(c, g);
+        }));
+    }
+    if (only.empty() || only == "floatGram") {
+        results.push_back(measure("floatGram", numEvents, numEvents * (16. * sizeof(float) + sizeof(uint16_t)), [&]() {
+            floatGram(floatRings.data(), tpc.data(), numEvents);
+        }));
+    }
+    if (only.empty() || only == "predictFloat") {
+        std::vector<double> predictions(numEvents);
+        results.push_back(measure("predictFloat", numEvents, numEvents * 16. * sizeof(float), [&]() {
+            predictFromFloats(solution.data(), floatRings.data(), numEvents, predictions.data());
+        }));
+    }
+
+    // The classifier reads event major floats, as an analysis holding one event would
+    if (only.empty() || only == "classifyEvent" || only == "estimateBatch" || only == "estimateEvent") {
+        double ringWeights[16];
+        for (uint32_t r = 0; r < 16; r++) {
+            ringWeights[r] = (*weights)[r][0];
+        }
+        std::vector<double> boundaries(199);
+        for (uint32_t i = 0; i < boundaries.size(); i++) {
+            boundaries[i] = 350. * (i + 1) / (boundaries.size() + 1);
+        }
+        CentralityClassifier classifier;
+        if (CentralityClassifier::write("data/benchmark.cut", ringWeights, 16, (*weights)[16][0],
+                                        boundaries.data(), boundaries.size(), 0.5) &&
+            classifier.load("data/benchmark.cut")) {
+            std::vector<float> events(numEvents * 16);
+            const double *rings = c->GetMatrixArray();
+            for (uint64_t i = 0; i < numEvents; i++) {
+                for (uint32_t r = 0; r < 16; r++) {
+                    events[i * 16 + r] = rings[r * numEvents + i];
+                }
+            }
+            volatile uint64_t sink = 0;
+            if (only.empty() || only == "classifyEvent") {
+                results.push_back(measure("classifyEvent", numEvents, numEvents * 16. * sizeof(float), [&]() {
+                    uint64_t slices = 0;
+                    for (uint64_t i = 0; i < numEvents; i++) {
+                        slices += classifier.classifyEvent(&events[i * 16]);
+                    }
+                    sink = sink + slices;
+                }));
+            }
+
+            // CentralityEstimator, against the latency budget in centralityEstimator.h
+            CentralityEstimator estimator;
+            estimator.load("data/benchmark.cut");
+            std::vector<double> xZeta(numEvents);
+            std::vector<uint32_t> slices(numEvents);
+            if (only.empty() || only == "estimateBatch") {
+                results.push_back(measure("estimateBatch", numEvents, numEvents * 16. * sizeof(float), [&]() {
+                    estimator.estimateBatch(events.data(), numEvents, xZeta.data(), slices.data());
+                }));
+            }
+            if (only.empty() || only == "estimateEvent") {
+                std::vector<BenchmarkHit> pool(hitPoolSize);
+                TRandom3 random(1);
+                for (uint32_t i = 0; i < hitPoolSize; i++) {
+                    pool[i].hitSide = random.Rndm() < 0.5 ? -1 : 1;
+                    pool[i].hitTile = 1 + random.Integer(31);
+                    pool[i].hitNmip = random.Landau(1, 0.15);
+                }
+                volatile double centralitySink = 0;
+                results.push_back(measure("estimateEvent", numEvents, numEvents * hitsPerEvent * double(sizeof(BenchmarkHit)), [&]() {
+                    double total = 0;
+                    for (uint64_t i = 0; i < numEvents; i++) {
+                        BenchmarkPicoDst dst = {&pool[(i * hitsPerEvent) % (hitPoolSize - hitsPerEvent)], hitsPerEvent};
+                        total += estimator.estimateEvent(dst).centrality;
+                    }
+                    centralitySink = centralitySink + total;
+                }));
+            }
+        }
+    }
+
+    // The ingest hit loop, events take hitsPerEvent consecutive hits from a pool that stays in cache
+    if (only.empty() || only == "addEpdHit") {
+        std::vector<BenchmarkHit> pool(hitPoolSize);
+        TRandom3 random(1);
+        for (uint32_t i = 0; i < hitPoolSize; i++) {
+            pool[i].hitSide = random.Rndm() < 0.5 ? -1 : 1;
+            pool[i].hitTile = 1 + random.Integer(31);
+            pool[i].hitNmip = random.Landau(1, 0.15);
+        }
+        volatile float sink = 0;
+        results.push_back(measure("addEpdHit", numEvents, numEvents * hitsPerEvent * double(sizeof(BenchmarkHit)), [&]() {
+            float total = 0;
+            for (uint64_t i = 0; i < numEvents; i++) {
+                float ringSums[2][16] = {};
+                uint64_t first = (i * hitsPerEvent) % (hitPoolSize - hitsPerEvent);
+                for (uint32_t h = 0; h < hitsPerEvent; h++) {
+                    addEpdHit(pool[first + h], ringSums);
+                }
+                total += ringSums[0][7] + ringSums[1][7];
+            }
+            sink = sink + total;
+        }));
+    }
+
+    // Ring sums from the hit store, at 4 bytes a hit the hits of more than 10^6 events get too big
+    if ((only.empty() || only == "rebuildRingSums") && numEvents <= 1000000) {
+        std::vector<uint64_t> offsets(numEvents + 1);
+        std::vector<uint32_t> hits(numEvents * hitsPerEvent);
+        TRandom3 random(1);
+        for (uint64_t i = 0; i < numEvents; i++) {
+            offsets[i] = i * hitsPerEvent;
+            uint32_t tile = random.Integer(7);
+            for (uint32_t h = 0; h < hitsPerEvent; h++) {
+                hits[i * hitsPerEvent + h] = packHit(tile, random.Landau(1, 0.15));
+                tile += 1 + random.Integer(6);      // Sorted and below epdTiles
+            }
+        }
+        offsets[numEvents] = numEvents * hitsPerEvent;
+        HitStore store(offsets.data(), hits.data(), numEvents);
+        results.push_back(measure("rebuildRingSums", numEvents, numEvents * hitsPerEvent * double(sizeof(uint32_t)), [&]() {
+            delete rebuildRingSums(store);
+        }));
+    }
+
+    delete weights;
+    delete c;
+    delete g;
+    return results;
+}
+
+// Write, load (with and without the ring cache), fit and quantiles, as epdcent runs them
+std::vector<BenchmarkResult> benchmarkStages(uint64_t numEvents, const std::string &only) {
+    std::vector<BenchmarkResult> results;
+    TMatrixD *c;
+    TVectorD *g;
+    syntheticEvents(numEvents, c, g);
+    // Files per size, the ring cache registry keeps mappings by name
+    std::string events = Form("data/events_%llu.root", (unsigned long long)numEvents);
+    std::string relations = Form("data/relations_%llu.root", (unsigned long long)numEvents);
+    double ringBytes = numEvents * 17. * sizeof(double);
+
+    const double *rings = c->GetMatrixArray();
+    BenchmarkResult write = measure("stage_store_write", numEvents, numEvents * (16. * sizeof(float) + 2), [&]() {
+        EventStoreWriter store(events.c_str());
+        float sums[16];
+        for (uint64_t i = 0; i < numEvents; i++) {
+            for (uint32_t r = 0; r < 16; r++) {
+                sums[r] = rings[r * numEvents + i];
+            }
+            store.fill(sums, (*g)[i]);
+        }
+        store.close();
+    });
+    if (only.empty() || only == "stage_store_write") {
+        results.push_back(write);
+    }
+    delete c;
+    delete g;
+
+    if (only.empty() || only == "stage_store_load") {
+        setenv("EPD_RING_CACHE", "0", 1);
+        results.push_back(measure("stage_store_load", numEvents, ringBytes, [&]() {
+            delete loadRingSums(events.c_str());
+            delete loadColumn(events.c_str(), "tpc_multiplicity");
+        }));
+        unsetenv("EPD_RING_CACHE");
+    }
+    // The first load writes the cache, the rest map it
+    {
+        Quiet quiet;
+        delete loadRingSums(events.c_str());
+    }
+    if (only.empty() || only == "stage_cache_load") {
+        results.push_back(measure("stage_cache_load", numEvents, ringBytes, [&]() {
+            delete loadRingSums(events.c_str());
+            delete loadColumn(events.c_str(), "tpc_multiplicity");
+        }));
+    }
+
+    if (only.empty() || only == "stage_fit_linear" || only == "stage_quantiles" || only == "getQuantileRange") {
+        BenchmarkResult fit = measure("stage_fit_linear", numEvents, ringBytes, [&]() {
+            linearWeights(events.c_str(), relations.c_str());
+        });
+        if (only.empty() || only == "stage_fit_linear") {
+            results.push_back(fit);
+        }
+    }
+    if (only.empty() || only == "stage_quantiles" || only == "getQuantileRange") {
+        BenchmarkResult quantileStage = measure("stage_quantiles", numEvents, 0, [&]() {
+            quantiles(relations.c_str());
+        });
+        if (only.empty() || only == "stage_quantiles") {
+            results.push_back(quantileStage);
+        }
+    }
+
+    // A range from the cumulative store, independent of the number of events, so "events" are calls
+    if (only.empty() || only == "getQuantileRange") {
+        TFile file(relations.c_str());
+        TH2D *cumulative = nullptr;
+        file.GetObject("quantiles/linear/tpc_cumulative", cumulative);
+        if (cumulative != nullptr) {
+            cumulative->SetDirectory(nullptr);
+            const uint64_t calls = 1000;
+            results.push_back(measure("getQuantileRange", calls,
+                                      calls * 2. * cumulative->GetNbinsY() * sizeof(double), [&]() {
+                for (uint64_t i = 0; i < calls; i++) {
+                    delete getQuantileRange(20 + 0.5 * (i % 100), 75, cumulative, "tpc");
+                }
+            }));
+            delete cumulative;
+        }
+        else {
+            std::cerr << "stage_quantiles left no quantiles/linear/tpc_cumulative in " << relations << std::endl;
+        }
+        file.Close();
+    }
+    return results;
+}
+
+std::map<std::string, BenchmarkResult> loadBaseline(const char *fileName) {
+    std::map<std::string, BenchmarkResult> baseline;
+    FILE *file = fopen(fileName, "r");
+    if (file == nullptr) {
+        return baseline;
+    }
+    char line[512];
+    char kernel[128];
+    unsigned long long events, allocations;
+    double seconds, bytes;
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        if (line[0] == '#' || sscanf(line, "%127s %llu %lf %lf %llu", kernel, &events, &seconds, &bytes, &allocations) != 5) {
+            continue;
+        }
+        BenchmarkResult result = {kernel, events, seconds, bytes, allocations};
+        baseline[Form("%s %llu", kernel, events)] = result;
+    }
+    fclose(file);
+    return baseline;
+}
+
+bool saveBaseline(const char *fileName, const std::vector<BenchmarkResult> &results) {
+    FILE *file = fopen(fileName, "w");
+    if (file == nullptr) {
+        std::cerr << "Could not write " << fileName << std::endl;
+        return false;
+    }
+    fprintf(file, "# kernel events seconds bytes allocations\n");
+    for (uint32_t i = 0; i < results.size(); i++) {
+        fprintf(file, "%s %llu %.6g %.6g %llu\n", results[i].kernel.c_str(), (unsigned long long)results[i].events,
+                results[i].seconds, results[i].bytes, (unsigned long long)results[i].allocations);
+    }
+    return fclose(file) == 0;
+}
+
+// Number of kernels that got slower by more than tolerance or allocate more than they did
+uint32_t compareBaseline(const std::map<std::string, BenchmarkResult> &baseline,
+                         const std::vector<BenchmarkResult> &results, double tolerance) {
+    uint32_t regressions = 0;
+    uint32_t compared = 0;
+    for (uint32_t i = 0; i < results.size(); i++) {
+        std::map<std::string, BenchmarkResult>::const_iterator before =
+            baseline.find(Form("%s %llu", results[i].kernel.c_str(), (unsigned long long)results[i].events));
+        if (before == baseline.end()) {
+            continue;
+        }
+        compared++;
+        double speed = results[i].eventRate() / before->second.eventRate();
+        // The stages allocate inside ROOT too, so a few allocations either way are noise
+        bool slower = speed < 1 - tolerance;
+        bool allocates = results[i].allocations > before->second.allocations * (1 + tolerance) + 16;
+        if (slower || allocates) {
+            regressions++;
+            printf("REGRESSION %-24s %12llu  %.2fx the speed, %llu allocations (was %llu)\n", results[i].kernel.c_str(),
+                   (unsigned long long)results[i].events, speed, (unsigned long long)results[i].allocations,
+                   (unsigned long long)before->second.allocations);
+        }
+    }
+    printf("Compared %u measurements with the baseline, %u regressions\n", compared, regressions);
+    return regressions;
+}
+
+int main(int argc, char **argv) {
+    const char *baselineFile = "data/benchmarks.baseline";
+    uint64_t maxEvents = 10000000;
+    uint64_t maxStageEvents = 1000000;
+    double tolerance = 0.1;
+    bool save = false;
+    std::string only;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--save") == 0) {
+            save = true;
+        }
+        else if (strcmp(argv[i], "--baseline") == 0 && hasValue) {
+            baselineFile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--max-events") == 0 && hasValue) {
+            maxEvents = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--max-stage-events") == 0 && hasValue) {
+            maxStageEvents = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--tolerance") == 0 && hasValue) {
+            tolerance = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--only") == 0 && hasValue) {
+            only = argv[++i];
+        }
+        else {
+            std::cerr << "usage: epdbench [--save] [--baseline file] [--max-events n] [--max-stage-events n]"
+                      << " [--tolerance fraction] [--only kernel]" << std::endl;
+            return 1;
+        }
+    }
+    gROOT->SetBatch(kTRUE);
+
+    // The baseline is relative to where we started, the stages run in the scratch directory
+    std::string baseline = baselineFile;
+    if (baseline[0] != '/') {
+        baseline = std::string(gSystem->WorkingDirectory()) + "/" + baseline;
+    }
+    const char *scratchRoot = getenv("EPD_BENCH_DIR");
+    std::string scratch = Form("%s/epdbench.%d", scratchRoot != nullptr ? scratchRoot : "/tmp", getpid());
+    gSystem->mkdir((scratch + "/data").c_str(), true);
+    gSystem->mkdir((scratch + "/histograms").c_str(), true);
+    if (!gSystem->ChangeDirectory(scratch.c_str())) {
+        std::cerr << "Could not use " << scratch << " as scratch directory" << std::endl;
+        return 1;
+    }
+
+    printf("%-24s %12s %12s %12s %12s %12s\n", "kernel", "events", "seconds", "events/s", "bytes/s", "allocations");
+    std::vector<BenchmarkResult> results;
+    bool stagesOnly = only.compare(0, 6, "stage_") == 0 || only == "getQuantileRange";
+    for (uint64_t numEvents = 10000; numEvents <= maxEvents && !stagesOnly; numEvents *= 10) {
+        std::vector<BenchmarkResult> kernels = benchmarkKernels(numEvents, only);
+        results.insert(results.end(), kernels.begin(), kernels.end());
+    }
+    for (uint64_t numEvents = 10000; numEvents <= maxStageEvents && (only.empty() || stagesOnly); numEvents *= 10) {
+        std::vector<BenchmarkResult> stages = benchmarkStages(numEvents, only);
+        results.insert(results.end(), stages.begin(), stages.end());
+    }
+    gSystem->Exec(Form("rm -rf %s", scratch.c_str()));
+
+    if (save) {
+        if (!saveBaseline(baseline.c_str(), results)) {
+            return 1;
+        }
+        std::cout << "Saved " << results.size() << " measurements to " << baseline << std::endl;
+        return 0;
+    }
+    std::map<std::string, BenchmarkResult> before = loadBaseline(baseline.c_str());
+    if (before.empty()) {
+        std::cout << "No baseline in " << baseline << ", record one with --save" << std::endl;
+        return 0;
+    }
+    return compareBaseline(before, results, tolerance) > 0 ? 1 : 0;
+}
@@ -0,0 +1,184 @@
+/**
+ * \brief Header only centrality classifier for use in other analyses' event loops.
+ *        Loads the cut table written by quantiles.cpp (ring weights, bias and the
+ *        sorted X_zeta' percentile boundaries) and assigns each event a percentile
+ *        slice with a branchless binary search.  Needs nothing beyond the standard
+ *        library, so it can be dropped into any event loop.
+ *
+ *        Slices follow quantiles.cpp: slice 0 is the lowest X_zeta', i.e. the most
+ *        peripheral events, and slice k holds boundary[k - 1] < X_zeta' <= boundary[k].
+ *
+ *        Usage:
+ *            CentralityClassifier classifier;
+ *            classifier.load("data/cut_tables/linear.cut");
+ *            uint32_t slice = classifier.classifyEvent(ringSums);   // 16 summed rings
+ *            double centrality = classifier.centrality(slice);      // 0% = most central
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#ifndef CENTRALITY_CLASSIFIER
+#define CENTRALITY_CLASSIFIER
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <limits>
+#include <vector>
+
+// On disk layout, followed by nRings weights, the bias and nBoundaries boundaries (all doubles)
+struct CutTableHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nRings;
+    uint32_t nBoundaries;
+    uint32_t reserved;
+    double percentileStep;  // Width of one slice in percent
+};
+
+const char cutTableMagic[8] = "EPDCUT";
+const uint32_t cutTableVersion = 1;
+const uint32_t cutTableMaxRings = 16;
+const uint32_t classifyBlockSize = 16;      // Values classifyBlock() searches together
+
+class CentralityClassifier {
+public:
+    CentralityClassifier() : nRings(0), nBoundaries(0), paddedBoundaries(1), percentileStep(0), bias(0) {
+        memset(weights, 0, sizeof(weights));
+    }
+
+    // Reads a cut table, returns false if the file is missing or not a cut table
+    bool load(const char *fileName) {
+        FILE *file = fopen(fileName, "rb");
+        if (file == nullptr) {
+            fprintf(stderr, "Could not open cut table %s\n", fileName);
+            return false;
+        }
+        CutTableHeader header;
+        bool good = fread(&header, sizeof(header), 1, file) == 1
+                    && memcmp(header.magic, cutTableMagic, sizeof(cutTableMagic)) == 0
+                    && header.version == cutTableVersion
+                    && header.nRings <= cutTableMaxRings;
+        std::vector<double> sortedBoundaries(good ? header.nBoundaries : 0);
+        if (good) {
+            good = fread(weights, sizeof(double), header.nRings, file) == header.nRings
+                   && fread(&bias, sizeof(double), 1, file) == 1
+                   && fread(sortedBoundaries.data(), sizeof(double), header.nBoundaries, file) == header.nBoundaries;
+        }
+        fclose(file);
+        if (!good) {
+            fprintf(stderr, "%s is not a valid cut table\n", fileName);
+            return false;
+        }
+        nRings = header.nRings;
+        nBoundaries = header.nBoundaries;
+        percentileStep = header.percentileStep;
+
+        // Pad to a power of two with +inf so the search loop has a fixed trip count
+        paddedBoundaries = 1;
+        while (paddedBoundaries < nBoundaries) {
+            paddedBoundaries *= 2;
+        }
+        boundaries.assign(paddedBoundaries, std::numeric_limits<double>::infinity());
+        for (uint32_t i = 0; i < nBoundaries; i++) {
+            boundaries[i] = sortedBoundaries[i];
+        }
+        return true;
+    }
+
+    // Writes a cut table in the format load() expects
+    static bool write(const char *fileName, const double *ringWeights, uint32_t numRings, double ringBias,
+                      const double *sortedBoundaries, uint32_t numBoundaries, double step) {
+        if (numRings > cutTableMaxRings) {
+            return false;
+        }
+        FILE *file = fopen(fileName, "wb");
+        if (file == nullptr) {
+            return false;
+        }
+        CutTableHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, cutTableMagic, sizeof(cutTableMagic));
+        header.version = cutTableVersion;
+        header.nRings = numRings;
+        header.nBoundaries = numBoundaries;
+        header.percentileStep = step;
+        bool good = fwrite(&header, sizeof(header), 1, file) == 1
+                    && fwrite(ringWeights, sizeof(double), numRings, file) == numRings
+                    && fwrite(&ringBias, sizeof(double), 1, file) == 1
+                    && fwrite(sortedBoundaries, sizeof(double), numBoundaries, file) == numBoundaries;
+        return fclose(file) == 0 && good;
+    }
+
+    // X_zeta' = sum_r W_r * C_r + bias
+    template <typename T>
+    double estimate(const T *ringSums) const {
+        double prediction = bias;
+        for (uint32_t r = 0; r < nRings; r++) {
+            prediction += weights[r] * ringSums[r];
+        }
+        return prediction;
+    }
+
+    // Number of boundaries below x, the compare feeds a conditional move rather than a branch
+    uint32_t classify(double x) const {
+        const double *base = boundaries.data();
+        uint32_t n = paddedBoundaries;
+        while (n > 1) {
+            uint32_t half = n / 2;
+            base += (base[half] < x) ? half : 0;
+            n -= half;
+        }
+        return (base - boundaries.data()) + (base[0] < x);
+    }
+
+    // classify() for up to classifyBlockSize values at once.  The searches advance level by
+    // level together, so their loads overlap instead of each waiting on the one before.
+    void classifyBlock(const double *x, uint32_t length, uint32_t *slices) const {
+        const double *base[classifyBlockSize];
+        for (uint32_t i = 0; i < length; i++) {
+            base[i] = boundaries.data();
+        }
+        uint32_t n = paddedBoundaries;
+        while (n > 1) {
+            uint32_t half = n / 2;
+            for (uint32_t i = 0; i < length; i++) {
+                base[i] += (base[i][half] < x[i]) ? half : 0;
+            }
+            n -= half;
+        }
+        for (uint32_t i = 0; i < length; i++) {
+            slices[i] = (base[i] - boundaries.data()) + (base[i][0] < x[i]);
+        }
+    }
+
+    template <typename T>
+    uint32_t classifyEvent(const T *ringSums) const {
+        return classify(estimate(ringSums));
+    }
+
+    // Centrality in percent of the slice's most central edge, 0% being the most central
+    double centrality(uint32_t slice) const {
+        return 100. - (slice + 1) * percentileStep;
+    }
+
+    uint32_t numberOfSlices() const { return nBoundaries + 1; }
+    uint32_t numberOfRings() const { return nRings; }
+    double sliceWidth() const { return percentileStep; }
+
+private:
+    uint32_t nRings;
+    uint32_t nBoundaries;
+    uint32_t paddedBoundaries;
+    double percentileStep;
+    double weights[cutTableMaxRings];
+    double bias;
+    std::vector<double> boundaries;
+};
+
+#endif // CENTRALITY_CLASSIFIER
@@ -0,0 +1,160 @@
+/**
+ * \brief Scans the nMIP clamp of the ring sums.  The ingest sets hits below 0.2 to
+ *        0 and caps them at 3, this evaluates a grid of (low, high) clamps instead,
+ *        from the hit store (hitStore.h) in a single multithreaded pass.  Every hit
+ *        is clamped against all pairs at once, a loop over the pairs the compiler
+ *        vectorizes, into ring sums per pair for a block of events.  Each pair's
+ *        block then goes into its own Gram matrix (gram.h), which holds the ring
+ *        sum moments as well.
+ *
+ *        Every pair is then fitted with linear weights, and its resolution is the
+ *        RMS of X_zeta' - RefMult1 over the events, from the Gram matrix without
+ *        another pass.  The RMS over the grid goes to clamp_scan/resolution and
+ *        the clamps with their weights (low, high, rings 0-15, bias) to
+ *        clamp_scan/weights, one row per pair.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+// Root headers
+#include "TH2D.h"
+#include "TMatrixD.h"
+#include "TROOT.h"
+#include "TVectorD.h"
+
+#include "eventStore.h"
+#include "gram.h"
+#include "hitStore.h"
+#include "instrumentation.h"
+#include "parallel.h"
+#include "resultSink.h"
+
+const uint32_t clampScanBlock = 64;     // Events per block, the ring sums of every pair stay in L2
+
+// Grid value i of points between low and high
+inline double clampGridValue(uint32_t i, uint32_t points, double low, double high) {
+    return points > 1 ? low + (high - low) * i / (points - 1) : low;
+}
+
+void clampScan(const char *inFileName = "data/detector_data.root", const char *outFileName = "data/clamp_scan.root",
+               uint32_t lowPoints = 5, double lowMin = 0.1, double lowMax = 0.5,
+               uint32_t highPoints = 6, double highMin = 2, double highMax = 7) {
+    StageMetrics metrics("clampScan");
+    if (lowPoints == 0 || highPoints == 0) {
+        std::cerr << "The clamp grid needs at least one point per axis" << std::endl;
+        return;
+    }
+    HitStore *hits = HitStore::open(inFileName);
+    TVectorD *g = loadColumn(inFileName, "tpc_multiplicity");
+    if (hits == nullptr || g == nullptr) {
+        return;
+    }
+    uint64_t numEvents = hits->numberOfEvents();
+    if (numEvents != (uint64_t)g->GetNrows()) {
+        std::cerr << "Hits and tpc_multiplicity of " << inFileName << " disagree on the number of events" << std::endl;
+        return;
+    }
+    metrics.addEvents(numEvents, hits->numberOfHits() * sizeof(uint32_t) + numEvents * sizeof(double));
+
+    // Pair p is low p / highPoints and high p % highPoints
+    uint32_t numPairs = lowPoints * highPoints;
+    std::vector<float> lows(numPairs);
+    std::vector<float> highs(numPairs);
+    for (uint32_t p = 0; p < numPairs; p++) {
+        lows[p] = clampGridValue(p / highPoints, lowPoints, lowMin, lowMax);
+        highs[p] = clampGridValue(p % highPoints, highPoints, highMin, highMax);
+    }
+    std::vector<uint16_t> ringOf = ringTileGroups();
+
+    const uint64_t *offsets = hits->offsets();
+    const uint32_t *packed = hits->hits();
+    const double *target = g->GetMatrixArray();
+    uint32_t nThreads = defaultThreads();
+    std::vector<std::vector<WeightedGram>> partial(nThreads, std::vector<WeightedGram>(numPairs));
+    {
+        ScopedTimer timer("clamp_scan", numEvents, hits->numberOfHits() * sizeof(uint32_t));
+        parallelFor(numEvents, nThreads, [&](uint64_t begin, uint64_t end, uint32_t thread) {
+            // Ring sums of a block for every pair, the pair index innermost
+            std::vector<float> sums(16 * clampScanBlock * numPairs);
+            double rings[16 * clampScanBlock];
+            for (uint64_t first = begin; first < end; first += clampScanBlock) {
+                uint32_t length = end - first < clampScanBlock ? end - first : clampScanBlock;
+                std::fill(sums.begin(), sums.end(), 0);
+                for (uint32_t i = 0; i < length; i++) {
+                    for (uint64_t h = offsets[first + i]; h < offsets[first + i + 1]; h++) {
+                        float x = hitNmip(packed[h]);
+                        float *pairSums = &sums[(ringOf[hitTile(packed[h])] * clampScanBlock + i) * numPairs];
+                        for (uint32_t p = 0; p < numPairs; p++) {
+                            float clamped = x < highs[p] ? x : highs[p];
+                            pairSums[p] += x < lows[p] ? 0 : clamped;
+                        }
+                    }
+                }
+                for (uint32_t p = 0; p < numPairs; p++) {
+                    for (uint32_t r = 0; r < 16; r++) {
+                        for (uint32_t i = 0; i < length; i++) {
+                            rings[r * clampScanBlock + i] = sums[(r * clampScanBlock + i) * numPairs + p];
+                        }
+                    }
+                    partial[thread][p].accumulate(rings, clampScanBlock, target + first, 0, length);
+                }
+            }
+        });
+    }
+    std::vector<WeightedGram> grams(numPairs);
+    for (uint32_t t = 0; t < nThreads; t++) {
+        for (uint32_t p = 0; p < numPairs; p++) {
+            grams[p].add(partial[t][p]);
+        }
+    }
+
+    double lowStep = lowPoints > 1 ? (lowMax - lowMin) / (lowPoints - 1) : 1;
+    double highStep = highPoints > 1 ? (highMax - highMin) / (highPoints - 1) : 1;
+    TH2D *resolution = new TH2D("resolution", "RMS of X_{#zeta'} - RefMult1;low clamp (nMIP);high clamp (nMIP)",
+                                lowPoints, lowMin - lowStep / 2, lowMax + lowStep / 2,
+                                highPoints, highMin - highStep / 2, highMax + highStep / 2);
+    TMatrixD *weights = new TMatrixD(numPairs, gramDim + 2);
+    uint32_t best = numPairs;
+    double bestRms = 0;
+    std::cout << "   low    high   RMS" << std::endl;
+    for (uint32_t p = 0; p < numPairs; p++) {
+        grams[p].symmetrize();
+        double solution[gramDim];
+        (*weights)[p][0] = lows[p];
+        (*weights)[p][1] = highs[p];
+        if (!grams[p].solve(solution)) {
+            printf("%6.2f  %6.2f   singular\n", lows[p], highs[p]);
+            continue;
+        }
+        double rms = sqrt(fmax(grams[p].weightedRss(solution), 0) / numEvents);
+        resolution->SetBinContent(p / highPoints + 1, p % highPoints + 1, rms);
+        for (uint32_t q = 0; q < gramDim; q++) {
+            (*weights)[p][q + 2] = solution[q];
+        }
+        printf("%6.2f  %6.2f   %.4f\n", lows[p], highs[p], rms);
+        if (best == numPairs || rms < bestRms) {
+            best = p;
+            bestRms = rms;
+        }
+    }
+    if (best < numPairs) {
+        std::cout << "Best clamp [" << lows[best] << ", " << highs[best] << "], RMS " << bestRms << std::endl;
+    }
+
+    ResultSink sink(outFileName, "clamp_scan");
+    sink.add("clamp_scan", "resolution", resolution);
+    sink.add("clamp_scan", "weights", weights);
+    sink.commit();
+    delete hits;
+}
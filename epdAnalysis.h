@@ -0,0 +1,61 @@
+/**
+ * \brief Entry points of the analysis stages, as built into libepdanalysis by
+ *        CMakeLists.txt.  Every stage is still a self contained ROOT macro that
+ *        runs through Cling as before, this header only lets compiled code
+ *        (epdcent.cpp) call them.  Defaults live with the definitions, so
+ *        callers pass every argument.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#ifndef EPD_ANALYSIS
+#define EPD_ANALYSIS
+
+#include <TMatrixD.h>
+#include <TVectorD.h>
+
+#include <stdint.h>
+
+class TH1D;
+class TH2D;
+
+// Ingest
+int PicoDstAnalyzer(const char *inFile, float tolerance, uint32_t checkpointClusters);      // Only with StPicoEvent, see EPD_HAVE_PICO
+void simulationDataPreprocessor(const char *inFileName);
+void generateEvents(const char *modelFileName, const char *outFileName, uint64_t numEvents, uint64_t seed,
+                    uint32_t nThreads, int32_t compression);
+
+// Stage 1, fits writing methods/ of data/epd_tpc_relations.root
+void linearWeights(const char *inFileName, const char *outFileName);
+void outerRingsLinearWeights(const char *inFileName, uint32_t innerRing, const char *outFileName);
+void ridgeRegression(const char *inFileName, float alpha);
+void lassoRegression(const char *inFileName, float alpha);
+void robustRegression(const char *inFileName, const char *loss, uint32_t maxIterations, double tolerance,
+                      const char *outFileName);
+void perRunWeights(const char *inFileName, const char *outFileName, uint32_t minEvents);
+void vertexBinnedWeights(const char *inFileName, uint32_t vzBins, const char *outFileName, uint32_t minEvents);
+void tileWeights(const char *inFileName, const char *outFileName);
+void rebuildStore(const char *inFileName, const char *outFileName, float low, float high);
+void clampScan(const char *inFileName, const char *outFileName, uint32_t lowPoints, double lowMin, double lowMax,
+               uint32_t highPoints, double highMin, double highMax);
+
+// Stage 2
+void quantiles(const char *inHistName);
+void exactQuantiles(const char *inFileName, const char *method, uint32_t nSlices);
+void quantileSummary(const char *infile, uint32_t renderWorkers);
+
+// Plots and checks
+void plotNmipsDistributions(uint32_t renderWorkers);
+void plotWeights(uint32_t renderWorkers);
+void tpcVsTofSelection(const char *inFileName);
+void tpcVsTofScan(const char *inFileName, const char *outFileName, uint32_t gridPoints, double excessTolerance);
+void benchmarkClassifier(const char *inFileName, const char *method, uint32_t repeats);
+
+// Kernels timed by benchmarks.cpp
+TH1D *getQuantileRange(double min, double max, TH2D *cumulative, const char *mode);     // quantileSummary.cpp
+
+#endif // EPD_ANALYSIS
@@ -0,0 +1,41 @@
+/**
+ * \brief The per hit step of the ingest, turning EPD hits into ring sums.  It is
+ *        templated on the hit type so PicoDstAnalyzer can hand it StPicoEpdHits
+ *        while benchmarks.cpp (and anything else without StPicoEvent) feeds it
+ *        plain structs with side(), tile() and nMIP().
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#ifndef EPD_HITS
+#define EPD_HITS
+
+#include <stdint.h>
+
+const float nMipThreshold = 0.2;    // Below this a hit is noise
+const float nMipCeiling = 3;        // Landau tail, capped so single tiles don't dominate a ring
+const uint32_t epdTiles = 744;      // 2 sides x 12 positions x 31 tiles
+
+inline float clampNmip(float nMip, float low = nMipThreshold, float high = nMipCeiling) {
+    return nMip < low ? 0 : (nMip > high ? high : nMip);
+}
+
+// Adds the clamped nMIP of hit to ringSums[east/west][tile / 2], returns the clamped nMIP
+template <typename Hit>
+inline float addEpdHit(const Hit &hit, float ringSums[2][16]) {
+    float nMip = clampNmip(hit.nMIP());
+    ringSums[hit.side() < 0 ? 0 : 1][(int)hit.tile() / 2] += nMip;
+    return nMip;
+}
+
+// Tile index in [0, epdTiles), east before west, then position 1-12 and tile 1-31
+template <typename Hit>
+inline uint16_t epdTileIndex(const Hit &hit) {
+    return (hit.side() < 0 ? 0 : 372) + (hit.position() - 1) * 31 + (hit.tile() - 1);
+}
+
+#endif // EPD_HITS
@@ -0,0 +1,362 @@
+/**
+ * \brief Command line driver for the compiled analysis library, so batch runs
+ *        get the optimized stages without starting Cling.  The defaults match
+ *        those of the macros.
+ *
+ *            epdcent ingest pico [file list] [tolerance] [clusters]
+ *            epdcent ingest sim [ntuple]
+ *            epdcent generate [model] [output] [events] [seed]
+ *            epdcent fit <linear|outer|ridge|lasso|robust|runs|vz|tiles> [input] [method option]
+ *            epdcent quantiles [relations]
+ *            epdcent quantiles exact [method] [slices] [input]
+ *            epdcent summary [relations] [render workers]
+ *            epdcent rebuild [input] [output] [low] [high]
+ *            epdcent rebuild scan [input] [output]
+ *            epdcent run [-j jobs] [--force] [name=value ...]
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#include <TROOT.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+
+#include "epdAnalysis.h"
+#include "hitStore.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "resultSink.h"
+
+#ifndef EPD_SOURCE_DIR
+#define EPD_SOURCE_DIR "."
+#endif
+
+const char *detectorData = "data/detector_data.root";
+const char *simulatedData = "data/simulated_data.root";
+const char *relationsFile = "data/epd_tpc_relations.root";
+const char *simulatedRelationsFile = "data/epd_tpc_relations_simulated.root";
+
+void usage() {
+    std::cerr << "usage: epdcent <command> [arguments]\n"
+              << "  ingest pico [file list] [tolerance]           PicoDsts to " << detectorData << ", a checkpoint\n"
+              << "              [clusters]                        every [clusters] x 65536 stored events\n"
+              << "  ingest sim [ntuple]                           simulation to " << simulatedData << "\n"
+              << "  generate [model] [output] [events] [seed]    synthetic events modelled on an event store\n"
+              << "  fit <linear|outer|ridge|lasso|robust|runs|vz|tiles> [input] [alpha, inner ring, huber|tukey,\n"
+              << "                                                   minimum events per run or vz bins]\n"
+              << "  quantiles [relations]                         cumulative quantiles and cut tables\n"
+              << "  quantiles exact [method] [slices] [input]     unbinned boundaries of one method\n"
+              << "  summary [relations] [render workers]          comparison plots\n"
+              << "  pileup [input]                                TPC vs TOF with the three pile up cuts\n"
+              << "  pileup scan [input] [output] [grid points]    efficiency and rejection of the TPC vs TOF cuts\n"
+              << "              [excess]                          rejection of events with 2 RefMult > TOF (1 + excess)\n"
+              << "  rebuild [input] [output] [low] [high]         event store with ring sums from the hits, nMIP\n"
+              << "                                                clamped to [low, high]\n"
+              << "  rebuild scan [input] [output]                 linear fit resolution over a grid of nMIP clamps\n"
+              << "  run [-j jobs] [--force] [name=value ...]      every stage that is out of date, parameters\n"
+              << "                                                pico, ntuple, tolerance, innerRing, ridgeAlpha,\n"
+              << "                                                lassoAlpha, robustLoss" << std::endl;
+}
+
+// argv[index] if it was given, otherwise fallback
+const char *argument(int argc, char **argv, int index, const char *fallback) {
+    return index < argc ? argv[index] : fallback;
+}
+
+int ingest(int argc, char **argv) {
+    const char *source = argument(argc, argv, 2, "");
+    if (strcmp(source, "pico") == 0) {
+#ifdef EPD_HAVE_PICO
+        return PicoDstAnalyzer(argument(argc, argv, 3, "data/files.list"), atof(argument(argc, argv, 4, "0.8")),
+                               atoi(argument(argc, argv, 5, "32")));
+#else
+        std::cerr << "epdcent was built without StPicoEvent, rerun cmake with STAR_PICO_ROOT set" << std::endl;
+        return 1;
+#endif
+    }
+    if (strcmp(source, "sim") == 0) {
+        simulationDataPreprocessor(argument(argc, argv, 3, "data/CentralityNtupleout06212020_7.7.root"));
+        return 0;
+    }
+    usage();
+    return 1;
+}
+
+int generate(int argc, char **argv) {
+    generateEvents(argument(argc, argv, 2, detectorData), argument(argc, argv, 3, "data/synthetic_data.root"),
+                   strtoull(argument(argc, argv, 4, "100000000"), nullptr, 10),
+                   strtoull(argument(argc, argv, 5, "1"), nullptr, 10), 0, 404);
+    return 0;
+}
+
+int fit(int argc, char **argv) {
+    const char *method = argument(argc, argv, 2, "");
+    const char *input = argument(argc, argv, 3, detectorData);
+    if (strcmp(method, "linear") == 0) {
+        linearWeights(input, relationsFile);
+    }
+    else if (strcmp(method, "outer") == 0) {
+        outerRingsLinearWeights(input, atoi(argument(argc, argv, 4, "7")), relationsFile);
+    }
+    else if (strcmp(method, "ridge") == 0) {
+        ridgeRegression(input, atof(argument(argc, argv, 4, "-1e5")));
+    }
+    else if (strcmp(method, "lasso") == 0) {
+        lassoRegression(input, atof(argument(argc, argv, 4, "1e7")));
+    }
+    else if (strcmp(method, "robust") == 0) {
+        robustRegression(input, argument(argc, argv, 4, "huber"), 10, 1e-4, relationsFile);
+    }
+    else if (strcmp(method, "runs") == 0) {
+        perRunWeights(input, relationsFile, atoi(argument(argc, argv, 4, "10000")));
+    }
+    else if (strcmp(method, "vz") == 0) {
+        vertexBinnedWeights(input, atoi(argument(argc, argv, 4, "14")), relationsFile, 10000);
+    }
+    else if (strcmp(method, "tiles") == 0) {
+        tileWeights(input, relationsFile);
+    }
+    else {
+        usage();
+        return 1;
+    }
+    return 0;
+}
+
+int runQuantiles(int argc, char **argv) {
+    if (argc > 2 && strcmp(argv[2], "exact") == 0) {
+        exactQuantiles(argument(argc, argv, 5, detectorData), argument(argc, argv, 3, "linear"),
+                       atoi(argument(argc, argv, 4, "20")));
+        return 0;
+    }
+    quantiles(argument(argc, argv, 2, relationsFile));
+    return 0;
+}
+
+int summary(int argc, char **argv) {
+    quantileSummary(argument(argc, argv, 2, relationsFile), atoi(argument(argc, argv, 3, "4")));
+    return 0;
+}
+
+int pileup(int argc, char **argv) {
+    if (argc > 2 && strcmp(argv[2], "scan") == 0) {
+        tpcVsTofScan(argument(argc, argv, 3, detectorData), argument(argc, argv, 4, "data/tpc_tof_scan.root"),
+                     atoi(argument(argc, argv, 5, "20")), atof(argument(argc, argv, 6, "1")));
+        return 0;
+    }
+    tpcVsTofSelection(argument(argc, argv, 2, detectorData));
+    return 0;
+}
+
+int rebuild(int argc, char **argv) {
+    if (argc > 2 && strcmp(argv[2], "scan") == 0) {
+        clampScan(argument(argc, argv, 3, detectorData), argument(argc, argv, 4, "data/clamp_scan.root"),
+                  5, 0.1, 0.5, 6, 2, 7);
+        return 0;
+    }
+    rebuildStore(argument(argc, argv, 2, detectorData), argument(argc, argv, 3, "data/detector_data_rebuilt.root"),
+                 atof(argument(argc, argv, 4, "0.2")), atof(argument(argc, argv, 5, "3")));
+    return 0;
+}
+
+// A fit stage reads an event store and leaves its shard next to target, see resultSink.h.  When
+// the shard is current it is merged again in case target was replaced since.
+PipelineStage fitStage(const char *name, const char *input, const char *target, const char *producer,
+                       const char *source, std::function<void()> run) {
+    PipelineStage stage(name);
+    std::string shard = ResultSink(target, producer).shardFile();
+    std::string targetFile = target;
+    stage.inputs.push_back(input);
+    stage.outputs.push_back(shard);
+    // The pipeline also follows the headers these include
+    stage.sources = {source, "eventStore.h", "ringSumCache.h", "resultSink.h", "histogramEngine.h", "instrumentation.h",
+                     "gram.h"};
+    stage.run = run;
+    stage.restore = [shard, targetFile]() {
+        ResultSink::mergeShard(shard.c_str(), targetFile.c_str());
+    };
+    return stage;
+}
+
+// The flow.md pipeline: ingest, the fits of each branch, then quantiles and plots of the detector branch
+int runPipeline(int argc, char **argv) {
+    uint32_t jobs = defaultThreads();
+    bool force = false;
+    std::map<std::string, std::string> parameters = {
+        {"pico", "data/files.list"}, {"ntuple", "data/CentralityNtupleout06212020_7.7.root"},
+        {"tolerance", "0.8"}, {"innerRing", "7"}, {"ridgeAlpha", "-1e5"}, {"lassoAlpha", "1e7"},
+        {"robustLoss", "huber"}};
+    for (int i = 2; i < argc; i++) {
+        const char *equals = strchr(argv[i], '=');
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--force") == 0) {
+            force = true;
+        }
+        else if (equals != nullptr && parameters.count(std::string(argv[i], equals - argv[i]))) {
+            parameters[std::string(argv[i], equals - argv[i])] = equals + 1;
+        }
+        else {
+            usage();
+            return 1;
+        }
+    }
+    // Copies, the stages run after this function has set them up
+    std::string pico = parameters["pico"];
+    std::string ntuple = parameters["ntuple"];
+    float tolerance = atof(parameters["tolerance"].c_str());
+    uint32_t innerRing = atoi(parameters["innerRing"].c_str());
+    float ridgeAlpha = atof(parameters["ridgeAlpha"].c_str());
+    float lassoAlpha = atof(parameters["lassoAlpha"].c_str());
+    std::string ridgeProducer = Form("ridge_%.0e", ridgeAlpha);
+    std::string lassoProducer = Form("lasso_%.0e", lassoAlpha);
+    std::string robustLoss = parameters["robustLoss"];
+    std::string robustProducer = "robust_" + robustLoss;
+
+    Pipeline pipeline("data/.pipeline", EPD_SOURCE_DIR);
+#ifdef EPD_HAVE_PICO
+    PipelineStage detectorIngest("ingest_detector");
+    detectorIngest.inputs.push_back(pico);
+    detectorIngest.outputs.push_back(detectorData);
+    detectorIngest.outputs.push_back(hitStoreFile(detectorData));
+    detectorIngest.sources = {"PicoDstAnalyzer.C", "eventStore.h", "hitStore.h", "epdHits.h", "ingestCheckpoint.h"};
+    detectorIngest.parameter("tolerance", parameters["tolerance"]);
+    detectorIngest.run = [pico, tolerance]() {
+        if (PicoDstAnalyzer(pico.c_str(), tolerance, 32) != 0) {
+            // Its outputs are recent but unfinished, the stage has to fail
+            fflush(stdout);
+            fflush(stderr);
+            _exit(1);
+        }
+    };
+    detectorIngest.resumable = true;      // Picks up its checkpoint, see ingestCheckpoint.h
+    pipeline.add(detectorIngest);
+#endif
+    PipelineStage simulationIngest("ingest_simulation");
+    simulationIngest.inputs.push_back(ntuple);
+    simulationIngest.outputs.push_back(simulatedData);
+    simulationIngest.sources = {"simulationDataPreprocessor.cpp", "eventStore.h"};
+    simulationIngest.run = [ntuple]() { simulationDataPreprocessor(ntuple.c_str()); };
+    pipeline.add(simulationIngest);
+
+    // Detector branch
+    pipeline.add(fitStage("fit_linear", detectorData, relationsFile, "linear", "linearWeights.cpp",
+                          []() { linearWeights(detectorData, relationsFile); }));
+    pipeline.add(fitStage("fit_outer", detectorData, relationsFile, "linear_outer", "outerRingsLinearWeights.cpp",
+                          [innerRing]() { outerRingsLinearWeights(detectorData, innerRing, relationsFile); })
+                     .parameter("innerRing", parameters["innerRing"]));
+    pipeline.add(fitStage("fit_ridge", detectorData, relationsFile, ridgeProducer.c_str(), "ridgeRegression.cpp",
+                          [ridgeAlpha]() { ridgeRegression(detectorData, ridgeAlpha); })
+                     .parameter("alpha", parameters["ridgeAlpha"]));
+    pipeline.add(fitStage("fit_lasso", detectorData, relationsFile, lassoProducer.c_str(), "lassoRegression.cpp",
+                          [lassoAlpha]() { lassoRegression(detectorData, lassoAlpha); })
+                     .parameter("alpha", parameters["lassoAlpha"]));
+    PipelineStage robustStage = fitStage("fit_robust", detectorData, relationsFile, robustProducer.c_str(),
+                                         "robustRegression.cpp", [robustLoss]() {
+                                             robustRegression(detectorData, robustLoss.c_str(), 10, 1e-4, relationsFile);
+                                         });
+    pipeline.add(robustStage.parameter("loss", robustLoss));
+
+    // Simulation branch
+    pipeline.add(fitStage("fit_linear_simulated", simulatedData, simulatedRelationsFile, "linear", "linearWeights.cpp",
+                          []() { linearWeights(simulatedData, simulatedRelationsFile); }));
+    pipeline.add(fitStage("fit_outer_simulated", simulatedData, simulatedRelationsFile, "linear_outer",
+                          "outerRingsLinearWeights.cpp",
+                          [innerRing]() { outerRingsLinearWeights(simulatedData, innerRing, simulatedRelationsFile); })
+                     .parameter("innerRing", parameters["innerRing"]));
+
+    // Stage 2 reads every detector fit and leaves one cut table per method
+    PipelineStage quantileStage("quantiles");
+    const char *methods[5] = {"linear", "linear_outer", ridgeProducer.c_str(), lassoProducer.c_str(),
+                              robustProducer.c_str()};
+    for (uint32_t m = 0; m < 5; m++) {
+        quantileStage.inputs.push_back(ResultSink(relationsFile, methods[m]).shardFile());
+        quantileStage.outputs.push_back(Form("data/cut_tables/%s.cut", methods[m]));
+    }
+    // quantiles/ goes into the relations file through this shard, later readers of the file wait on it
+    std::string quantileShard = ResultSink(relationsFile, "quantiles").shardFile();
+    quantileStage.outputs.push_back(quantileShard);
+    quantileStage.sources = {"quantiles.cpp", "quantiles.h", "centralityClassifier.h", "resultSink.h"};
+    quantileStage.run = []() { quantiles(relationsFile); };
+    quantileStage.restore = [quantileShard]() {
+        ResultSink::mergeShard(quantileShard.c_str(), relationsFile);
+    };
+    pipeline.add(quantileStage);
+
+    PipelineStage summaryStage("summary");
+    summaryStage.inputs = quantileStage.outputs;
+    summaryStage.outputs.push_back("histograms/variances.png");
+    summaryStage.sources = {"quantileSummary.cpp", "batchRender.h"};
+    summaryStage.run = []() { quantileSummary(relationsFile, 0); };
+    pipeline.add(summaryStage);
+
+    PipelineStage weightsStage("plot_weights");
+    weightsStage.inputs = {ResultSink(relationsFile, "linear").shardFile(),
+                           ResultSink(relationsFile, "linear_outer").shardFile(),
+                           ResultSink(simulatedRelationsFile, "linear").shardFile(),
+                           ResultSink(simulatedRelationsFile, "linear_outer").shardFile(),
+                           quantileShard};
+    weightsStage.outputs.push_back("histograms/weights.png");
+    weightsStage.sources = {"plotWeights.cpp", "batchRender.h"};
+    weightsStage.run = []() { plotWeights(0); };
+    pipeline.add(weightsStage);
+
+    PipelineStage nmipsStage("plot_nmips");
+    nmipsStage.inputs = {detectorData, simulatedData};
+    nmipsStage.outputs.push_back("histograms/det_sim_comparison.png");
+    nmipsStage.sources = {"plotNmipsDistributions.cpp", "batchRender.h", "eventStore.h"};
+    nmipsStage.run = []() { plotNmipsDistributions(0); };
+    pipeline.add(nmipsStage);
+
+    return pipeline.run(jobs > 0 ? jobs : 1, force) ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+    // Nothing is shown on screen, plots only go to files
+    gROOT->SetBatch(kTRUE);
+
+    const char *command = argv[1];
+    if (strcmp(command, "ingest") == 0) {
+        return ingest(argc, argv);
+    }
+    if (strcmp(command, "generate") == 0) {
+        return generate(argc, argv);
+    }
+    if (strcmp(command, "fit") == 0) {
+        return fit(argc, argv);
+    }
+    if (strcmp(command, "quantiles") == 0) {
+        return runQuantiles(argc, argv);
+    }
+    if (strcmp(command, "summary") == 0) {
+        return summary(argc, argv);
+    }
+    if (strcmp(command, "pileup") == 0) {
+        return pileup(argc, argv);
+    }
+    if (strcmp(command, "rebuild") == 0) {
+        return rebuild(argc, argv);
+    }
+    if (strcmp(command, "run") == 0) {
+        return runPipeline(argc, argv);
+    }
+    usage();
+    return strcmp(command, "help") == 0 ? 0 : 1;
+}
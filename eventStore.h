@@ -0,0 +1,639 @@
+/**
+ * \brief Columnar event store for the preprocessed data files.  Every event is
+ *        one entry of the "events" tree, with one float column per ring
+ *        (ring_00 to ring_15), tpc_multiplicity as a 16 bit unsigned column
+ *        and whatever extra columns the producer declares (tof_multiplicity,
+ *        impact_parameter, run_id, vz, ...).  Columns are written ZSTD compressed in
+ *        clusters of eventStoreCluster entries, so a reader pays only for the
+ *        columns and the entry range it asks for.
+ *
+ *        Detector stores can also keep the raw EPD hits of every event
+ *        (enableHits), in the hit store next to the file, see hitStore.h.
+ *
+ *        checkpoint() saves the tree (and syncs the hits) so a producer that dies
+ *        can construct the writer again with the number of entries it had
+ *        checkpointed and keep filling the same store.  Checkpoint right after a
+ *        cluster is flushed and the resumed store has the same clusters as one
+ *        written in a single go.
+ *
+ *        loadFloatRingSums is the float path, the ring sums and RefMult in the
+ *        store's own types at half the memory of the TMatrixD ones.  Only
+ *        linearWeights runs on it so far.
+ *
+ *        The loaders return the same TMatrixD / TVectorD layout the macros
+ *        have always used (ring_sums is 16 x events), and fall back to the
+ *        old whole-object keys for files written before the store existed.
+ *        They widen from the float ring cache into their own matrix and drop
+ *        the cache pages afterwards, so a TMatrixD stage holds its 8 byte copy
+ *        only.  Old style files hold doubles and are never cached, they are
+ *        read as they are.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#ifndef EVENT_STORE
+#define EVENT_STORE
+
+#include <TROOT.h>
+#include <TBranch.h>
+#include <TFile.h>
+#include <TMatrixD.h>
+#include <TTree.h>
+#include <TVectorD.h>
+#include <Compression.h>
+
+#include "hitStore.h"
+#include "instrumentation.h"
+#include "ringSumCache.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <deque>
+#include <iostream>
+#include <string>
+#include <vector>
+
+const char *const eventTreeName = "events";
+const uint32_t eventStoreRings = 16;
+const Long64_t eventStoreCluster = 65536;        // Entries per cluster, also the unit of partial reads
+const int32_t eventStoreBasket = 256 * 1024;     // Bytes, holds one cluster of a float column
+// ZSTD level 5, use ROOT::CompressionSettings(ROOT::kLZ4, 4) where read speed matters more than size
+const int32_t eventStoreCompression = 505;
+
+class EventStoreWriter {
+public:
+    // resumeEntries >= 0 reopens a store that checkpoint() saved with that many entries, the
+    // columns and enableHits() have to be declared as they were the first time
+    EventStoreWriter(const char *fileName, int32_t compression = eventStoreCompression, Long64_t resumeFrom = -1)
+        : name(fileName), resumeEntries(resumeFrom) {
+        if (resumeEntries >= 0) {
+            resume();
+            return;
+        }
+        file = TFile::Open(fileName, "RECREATE");
+        if (file == nullptr || file->IsZombie()) {
+            std::cerr << "Could not create event store " << fileName << std::endl;
+            file = nullptr;
+            return;
+        }
+        file->SetCompressionSettings(compression);
+        tree = new TTree(eventTreeName, "Preprocessed events");
+        tree->SetAutoFlush(eventStoreCluster);
+        // Only checkpoint() saves the tree, so a file left by a crash holds the last checkpoint
+        tree->SetAutoSave(0);
+        for (uint32_t r = 0; r < eventStoreRings; r++) {
+            tree->Branch(Form("ring_%02d", r), &rings[r], Form("ring_%02d/F", r), eventStoreBasket);
+        }
+        tpcColumn = addColumn("tpc_multiplicity", 's');
+    }
+
+    ~EventStoreWriter() {
+        close();
+    }
+
+    bool good() const {
+        return file != nullptr && (hits == nullptr || hits->good());
+    }
+
+    // Declares an extra column before the first fill, type 'F' for float, 's' for a 16 bit
+    // or 'i' for a 32 bit unsigned integer.  Returns the index to pass to setColumn.
+    uint32_t addColumn(const char *name, char type) {
+        if (tree == nullptr) {
+            return 0;
+        }
+        Column column;
+        column.type = type;
+        columns.push_back(column);
+        Column &added = columns.back();
+        if (resumeEntries >= 0) {
+            // The branch is in the tree already
+            void *address = type == 's' ? (void*)&added.integer : type == 'i' ? (void*)&added.integer32 : (void*)&added.real;
+            if (tree->SetBranchAddress(name, address) < 0) {
+                std::cerr << "Event store " << this->name << " has no column " << name << " to resume" << std::endl;
+            }
+        }
+        else if (type == 's') {
+            tree->Branch(name, &added.integer, Form("%s/s", name), eventStoreBasket / 2);
+        }
+        else if (type == 'i') {
+            tree->Branch(name, &added.integer32, Form("%s/i", name), eventStoreBasket);
+        }
+        else {
+            tree->Branch(name, &added.real, Form("%s/F", name), eventStoreBasket);
+        }
+        return columns.size() - 1;
+    }
+
+    // Also writes the hits of every event to the hit store next to the file, call before the
+    // first fill
+    void enableHits() {
+        if (tree == nullptr || hits != nullptr) {
+            return;
+        }
+        hits = new HitStoreWriter(hitStoreFile(name.c_str()).c_str(), resumeEntries);
+    }
+
+    // Adds a hit with its raw nMIP to the event being filled
+    void addHit(uint16_t tile, float nMip) {
+        if (hits != nullptr) {
+            hits->addHit(tile, nMip);
+        }
+    }
+
+    void setColumn(uint32_t index, double value) {
+        if (index >= columns.size()) {
+            return;
+        }
+        Column &column = columns[index];
+        if (column.type == 's') {
+            // Multiplicities are never negative and stay well below 2^16
+            column.integer = value <= 0 ? 0 : value >= 65535 ? 65535 : UShort_t(value + 0.5);
+        }
+        else if (column.type == 'i') {
+            // Identifiers like run numbers, exact in a double
+            column.integer32 = value <= 0 ? 0 : value >= 4294967295. ? 4294967295u : UInt_t(value + 0.5);
+        }
+        else {
+            column.real = value;
+        }
+    }
+
+    // Stores one event, ringSums holds the 16 ring sums
+    template <typename Real>
+    void fill(const Real *ringSums, double tpcMultiplicity) {
+        if (tree == nullptr) {
+            return;
+        }
+        for (uint32_t r = 0; r < eventStoreRings; r++) {
+            rings[r] = ringSums[r];
+        }
+        setColumn(tpcColumn, tpcMultiplicity);
+        tree->Fill();
+        if (hits != nullptr) {
+            hits->endEvent();
+        }
+    }
+
+    Long64_t entries() const {
+        return tree == nullptr ? 0 : tree->GetEntries();
+    }
+
+    // Saves every entry filled so far, a writer constructed with entries() as resumeEntries
+    // continues from here
+    bool checkpoint() {
+        if (tree == nullptr || (hits != nullptr && !hits->checkpoint())) {
+            return false;
+        }
+        file->cd();
+        return tree->AutoSave("SaveSelf FlushBaskets") > 0;
+    }
+
+    void close() {
+        if (file == nullptr) {
+            return;
+        }
+        if (hits != nullptr) {
+            hits->close();
+            delete hits;
+            hits = nullptr;
+        }
+        file->cd();
+        tree->Write("", TObject::kOverwrite);
+        file->Close();
+        delete file;    // Owns the tree
+        file = nullptr;
+        tree = nullptr;
+    }
+
+    // Closes the file without saving the tree, for a producer that stops early: the store keeps
+    // the entries of its last checkpoint (none without one) and can be resumed from there
+    void abandon() {
+        if (file == nullptr) {
+            return;
+        }
+        if (hits != nullptr) {
+            hits->abandon();
+            delete hits;
+            hits = nullptr;
+        }
+        file->Close();
+        delete file;
+        file = nullptr;
+        tree = nullptr;
+    }
+
+private:
+    // Reopens the tree as the last checkpoint left it.  Anything written after that is beyond
+    // the end the file header records, so the next baskets overwrite it.
+    void resume() {
+        file = TFile::Open(name.c_str(), "UPDATE");
+        if (file == nullptr || file->IsZombie()) {
+            std::cerr << "Could not reopen event store " << name << std::endl;
+            delete file;
+            file = nullptr;
+            return;
+        }
+        file->GetObject(eventTreeName, tree);
+        if (tree == nullptr || tree->GetEntries() != resumeEntries) {
+            std::cerr << "Event store " << name << " does not hold the " << resumeEntries
+                      << " checkpointed entries" << std::endl;
+            file->Close();
+            delete file;
+            file = nullptr;
+            tree = nullptr;
+            return;
+        }
+        tree->SetAutoSave(0);
+        for (uint32_t r = 0; r < eventStoreRings; r++) {
+            tree->SetBranchAddress(Form("ring_%02d", r), &rings[r]);
+        }
+        tpcColumn = addColumn("tpc_multiplicity", 's');
+    }
+
+    struct Column {
+        char type;
+        Float_t real = 0;
+        UShort_t integer = 0;
+        UInt_t integer32 = 0;
+    };
+
+    TFile *file = nullptr;
+    TTree *tree = nullptr;
+    Float_t rings[eventStoreRings];
+    std::deque<Column> columns;     // Branches hold addresses into this, a deque never moves them
+    uint32_t tpcColumn = 0;
+    std::string name;
+    Long64_t resumeEntries;
+    HitStoreWriter *hits = nullptr;
+};
+
+// Reads entries [first, first + count) of one column into output, converting from the stored type
+template <typename Out>
+inline bool readStoreColumn(TTree *tree, const char *name, Long64_t first, Long64_t count, Out *output) {
+    TBranch *branch = tree->GetBranch(name);
+    if (branch == nullptr) {
+        std::cerr << "Event store has no column " << name << std::endl;
+        return false;
+    }
+    const char *title = branch->GetTitle();
+    char type = title[strlen(title) - 1];
+    Float_t real = 0;
+    UShort_t integer = 0;
+    UInt_t integer32 = 0;
+    if (type == 's') {
+        branch->SetAddress(&integer);
+        for (Long64_t i = 0; i < count; i++) {
+            branch->GetEntry(first + i);
+            output[i] = integer;
+        }
+    }
+    else if (type == 'i') {
+        branch->SetAddress(&integer32);
+        for (Long64_t i = 0; i < count; i++) {
+            branch->GetEntry(first + i);
+            output[i] = integer32;
+        }
+    }
+    else {
+        branch->SetAddress(&real);
+        for (Long64_t i = 0; i < count; i++) {
+            branch->GetEntry(first + i);
+            output[i] = real;
+        }
+    }
+    branch->SetAddress(nullptr);
+    return true;
+}
+
+// Clamps [first, first + count) to entries, count < 0 means to the end
+inline void clampEntryRange(Long64_t entries, Long64_t &first, Long64_t &count) {
+    first = first < 0 ? 0 : first > entries ? entries : first;
+    count = count < 0 || first + count > entries ? entries - first : count;
+}
+
+// Opens the events tree and clamps [first, first + count) to it
+inline TTree *openEventStore(TFile *file, Long64_t &first, Long64_t &count) {
+    TTree *tree = nullptr;
+    file->GetObject(eventTreeName, tree);
+    if (tree == nullptr) {
+        return nullptr;
+    }
+    clampEntryRange(tree->GetEntries(), first, count);
+    // Only the requested columns and clusters go through the cache
+    tree->SetCacheSize(64 * 1024 * 1024);
+    tree->SetCacheEntryRange(first, first + count);
+    return tree;
+}
+
+// Whether the file holds an events tree, rather than the whole matrices of the old files
+inline bool isEventStore(const char *fileName) {
+    TFile *file = TFile::Open(fileName);
+    bool found = false;
+    if (file != nullptr && !file->IsZombie()) {
+        found = file->GetKey(eventTreeName) != nullptr;
+        file->Close();
+    }
+    delete file;
+    return found;
+}
+
+// Reads rings firstRing to lastRing of entries [first, first + count) from the ROOT file
+inline TMatrixD *readRings(const char *fileName, uint32_t firstRing = 0, uint32_t lastRing = eventStoreRings - 1,
+                           Long64_t first = 0, Long64_t count = -1) {
+    ScopedTimer timer("read_rings");
+    TFile *file = TFile::Open(fileName);
+    if (file == nullptr || file->IsZombie()) {
+        std::cerr << "Could not open " << fileName << std::endl;
+        delete file;
+        return nullptr;
+    }
+    TMatrixD *rings = nullptr;
+    TTree *tree = openEventStore(file, first, count);
+    if (tree != nullptr) {
+        for (uint32_t r = firstRing; r <= lastRing; r++) {
+            tree->AddBranchToCache(Form("ring_%02d", r));
+        }
+        tree->StopCacheLearningPhase();
+        rings = new TMatrixD(lastRing - firstRing + 1, count);
+        for (uint32_t r = firstRing; r <= lastRing; r++) {
+            double *row = rings->GetMatrixArray() + (r - firstRing) * count;
+            if (!readStoreColumn(tree, Form("ring_%02d", r), first, count, row)) {
+                delete rings;
+                rings = nullptr;
+                break;
+            }
+        }
+    }
+    else {
+        // Files from before the event store hold the whole matrix
+        TMatrixD *all = nullptr;
+        file->GetObject("ring_sums", all);
+        if (all != nullptr) {
+            Long64_t entries = all->GetNcols();
+            clampEntryRange(entries, first, count);
+            if (first == 0 && count == entries && firstRing == 0 && lastRing == eventStoreRings - 1) {
+                rings = all;
+            }
+            else {
+                rings = new TMatrixD(lastRing - firstRing + 1, count);
+                for (uint32_t r = firstRing; r <= lastRing; r++) {
+                    memcpy(rings->GetMatrixArray() + (r - firstRing) * count,
+                           all->GetMatrixArray() + r * entries + first, count * sizeof(double));
+                }
+                delete all;
+            }
+        }
+        else {
+            std::cerr << fileName << " holds neither an event store nor ring_sums" << std::endl;
+        }
+    }
+    file->Close();
+    delete file;
+    if (rings != nullptr) {
+        timer.add(rings->GetNcols(), rings->GetNoElements() * sizeof(Float_t));
+    }
+    return rings;
+}
+
+// Reads one per event column (tpc_multiplicity, tof_multiplicity, ...) from the ROOT file
+inline TVectorD *readColumn(const char *fileName, const char *column, Long64_t first = 0, Long64_t count = -1) {
+    ScopedTimer timer("read_column");
+    TFile *file = TFile::Open(fileName);
+    if (file == nullptr || file->IsZombie()) {
+        std::cerr << "Could not open " << fileName << std::endl;
+        delete file;
+        return nullptr;
+    }
+    TVectorD *values = nullptr;
+    TTree *tree = openEventStore(file, first, count);
+    if (tree != nullptr) {
+        tree->AddBranchToCache(column);
+        tree->StopCacheLearningPhase();
+        values = new TVectorD(count);
+        if (!readStoreColumn(tree, column, first, count, values->GetMatrixArray())) {
+            delete values;
+            values = nullptr;
+        }
+    }
+    else {
+        TVectorD *all = nullptr;
+        file->GetObject(column, all);
+        if (all != nullptr) {
+            Long64_t entries = all->GetNrows();
+            clampEntryRange(entries, first, count);
+            if (first == 0 && count == entries) {
+                values = all;
+            }
+            else {
+                values = new TVectorD(count);
+                memcpy(values->GetMatrixArray(), all->GetMatrixArray() + first, count * sizeof(double));
+                delete all;
+            }
+        }
+        else {
+            std::cerr << fileName << " has no column " << column << std::endl;
+        }
+    }
+    file->Close();
+    delete file;
+    if (values != nullptr) {
+        timer.add(values->GetNrows(), values->GetNrows() * sizeof(Float_t));
+    }
+    return values;
+}
+
+// Rings firstRing to lastRing of entries [first, first + count), one row per ring.  A current
+// ring cache serves them, widened from its floats, otherwise they are read from the store and a
+// full read of an event store rebuilds the cache for the next run.
+inline TMatrixD *loadRings(const char *fileName, uint32_t firstRing = 0, uint32_t lastRing = eventStoreRings - 1,
+                           Long64_t first = 0, Long64_t count = -1) {
+    if (!ringCacheEnabled()) {
+        return readRings(fileName, firstRing, lastRing, first, count);
+    }
+    RingSumCache *cache = RingSumCache::open(fileName);
+    if (cache != nullptr && lastRing < cache->numberOfRings()) {
+        clampEntryRange(cache->numberOfEvents(), first, count);
+        ScopedTimer timer("ring_cache", count, (lastRing - firstRing + 1) * count * sizeof(float));
+        TMatrixD *rings = new TMatrixD(lastRing - firstRing + 1, count);
+        for (uint32_t r = firstRing; r <= lastRing; r++) {
+            double *row = rings->GetMatrixArray() + (r - firstRing) * count;
+            const float *cached = cache->ring(r) + first;
+            for (Long64_t j = 0; j < count; j++) {
+                row[j] = cached[j];
+            }
+        }
+        cache->release();
+        return rings;
+    }
+
+    TMatrixD *rings = readRings(fileName, firstRing, lastRing, first, count);
+    if (rings != nullptr && firstRing == 0 && lastRing == eventStoreRings - 1 && first <= 0 && count < 0 &&
+        isEventStore(fileName)) {
+        TVectorD *tpc = readColumn(fileName, "tpc_multiplicity");
+        if (tpc != nullptr && RingSumCache::build(fileName, rings, tpc)) {
+            std::cout << "Wrote ring cache " << ringCacheFile(fileName) << std::endl;
+        }
+        delete tpc;
+    }
+    return rings;
+}
+
+// All 16 rings, the ring_sums matrix of the old files
+inline TMatrixD *loadRingSums(const char *fileName, Long64_t first = 0, Long64_t count = -1) {
+    return loadRings(fileName, 0, eventStoreRings - 1, first, count);
+}
+
+// One per event column (tpc_multiplicity, tof_multiplicity, impact_parameter, ...), RefMult
+// comes from the ring cache when there is a current one
+inline TVectorD *loadColumn(const char *fileName, const char *column, Long64_t first = 0, Long64_t count = -1) {
+    RingSumCache *cache = nullptr;
+    if (ringCacheEnabled() && strcmp(column, "tpc_multiplicity") == 0) {
+        cache = RingSumCache::open(fileName);
+    }
+    if (cache == nullptr) {
+        return readColumn(fileName, column, first, count);
+    }
+    clampEntryRange(cache->numberOfEvents(), first, count);
+    TVectorD *values = new TVectorD(count);
+    const uint16_t *cached = cache->tpcMultiplicity() + first;
+    for (Long64_t j = 0; j < count; j++) {
+        (*values)[j] = cached[j];
+    }
+    cache->release();
+    return values;
+}
+
+// The 16 ring sums as floats and RefMult as 16 bit integers, the types of the store, for the
+// float kernels (gram.h).  With a current ring cache they point into its mapping, otherwise
+// they are read into the vectors here.
+struct FloatRingSums {
+    const float *rings = nullptr;       // Ring r of event j at rings[r * numEvents + j]
+    const uint16_t *tpc = nullptr;
+    uint64_t numEvents = 0;
+    std::vector<float> ownRings;
+    std::vector<uint16_t> ownTpc;
+};
+
+// Fills data from the ring cache, which a first load builds, or from the store when the cache
+// is off.  Old style files are read whole and narrowed.  Returns false if the file can not be read.
+inline bool loadFloatRingSums(const char *fileName, FloatRingSums &data) {
+    if (ringCacheEnabled()) {
+        RingSumCache *cache = RingSumCache::open(fileName);
+        if (cache == nullptr && isEventStore(fileName)) {
+            delete loadRingSums(fileName);
+            cache = RingSumCache::open(fileName);
+        }
+        if (cache != nullptr && cache->numberOfRings() == eventStoreRings) {
+            data.numEvents = cache->numberOfEvents();
+            data.rings = cache->ring(0);
+            data.tpc = cache->tpcMultiplicity();
+            return true;
+        }
+    }
+
+    ScopedTimer timer("read_rings_float");
+    TFile *file = TFile::Open(fileName);
+    if (file == nullptr || file->IsZombie()) {
+        std::cerr << "Could not open " << fileName << std::endl;
+        delete file;
+        return false;
+    }
+    Long64_t first = 0;
+    Long64_t count = -1;
+    TTree *tree = openEventStore(file, first, count);
+    bool good = tree != nullptr;
+    if (good) {
+        for (uint32_t r = 0; r < eventStoreRings; r++) {
+            tree->AddBranchToCache(Form("ring_%02d", r));
+        }
+        tree->AddBranchToCache("tpc_multiplicity");
+        tree->StopCacheLearningPhase();
+        data.ownRings.resize(eventStoreRings * count);
+        data.ownTpc.resize(count);
+        for (uint32_t r = 0; r < eventStoreRings && good; r++) {
+            good = readStoreColumn(tree, Form("ring_%02d", r), 0, count, data.ownRings.data() + r * count);
+        }
+        good = good && readStoreColumn(tree, "tpc_multiplicity", 0, count, data.ownTpc.data());
+    }
+    file->Close();
+    delete file;
+    if (tree == nullptr) {
+        // Files from before the event store hold double matrices, narrowed to the store's types
+        TMatrixD *rings = readRings(fileName);
+        TVectorD *tpc = rings != nullptr ? readColumn(fileName, "tpc_multiplicity") : nullptr;
+        good = tpc != nullptr && rings->GetNrows() == eventStoreRings && tpc->GetNrows() == rings->GetNcols();
+        if (good) {
+            count = rings->GetNcols();
+            data.ownRings.assign(rings->GetMatrixArray(), rings->GetMatrixArray() + rings->GetNoElements());
+            data.ownTpc.resize(count);
+            for (Long64_t j = 0; j < count; j++) {
+                double value = (*tpc)[j];
+                data.ownTpc[j] = value <= 0 ? 0 : value >= 65535 ? 65535 : uint16_t(value + 0.5);
+            }
+        }
+        delete rings;
+        delete tpc;
+    }
+    if (!good) {
+        return false;
+    }
+    data.numEvents = count;
+    data.rings = data.ownRings.data();
+    data.tpc = data.ownTpc.data();
+    timer.add(count, count * (eventStoreRings * sizeof(float) + sizeof(uint16_t)));
+    return true;
+}
+
+// Number of events in the store, -1 if the file can not be read
+inline Long64_t eventStoreEntries(const char *fileName) {
+    TFile *file = TFile::Open(fileName);
+    if (file == nullptr || file->IsZombie()) {
+        delete file;
+        return -1;
+    }
+    Long64_t entries = -1;
+    TTree *tree = nullptr;
+    file->GetObject(eventTreeName, tree);
+    if (tree != nullptr) {
+        entries = tree->GetEntries();
+    }
+    else {
+        TVectorD *tpc = nullptr;
+        file->GetObject("tpc_multiplicity", tpc);
+        if (tpc != nullptr) {
+            entries = tpc->GetNrows();
+            delete tpc;
+        }
+    }
+    file->Close();
+    delete file;
+    return entries;
+}
+
+// Whether the store (or an old style file) has the per event column
+inline bool eventStoreHasColumn(const char *fileName, const char *column) {
+    TFile *file = TFile::Open(fileName);
+    if (file == nullptr || file->IsZombie()) {
+        delete file;
+        return false;
+    }
+    bool found = false;
+    TTree *tree = nullptr;
+    file->GetObject(eventTreeName, tree);
+    if (tree != nullptr) {
+        found = tree->GetBranch(column) != nullptr;
+    }
+    else {
+        found = file->GetKey(column) != nullptr;
+    }
+    file->Close();
+    delete file;
+    return found;
+}
+
+#endif // EVENT_STORE
@@ -0,0 +1,243 @@
+/**
+ * \brief Exact, unbinned centrality boundaries.  quantiles.cpp works from the
+ *        fixed range method histograms, so events outside -100 < X_zeta' < 300
+ *        never make it into the quantiles.  This recomputes X_zeta' for every
+ *        event from the stored weights and finds the boundaries of both RefMult
+ *        and X_zeta' by selection on the raw columns, then assigns every event its
+ *        slice.  The results are the reference for checking the binned quantiles.
+ *
+ *        The slice assignment is kept under quantiles/<method>/ as the tree
+ *        exact_slices, entry j being event j of the store, with the 16 bit columns
+ *        tpc_slice and epd_slice.  The index set of a slice is the entries with
+ *        that slice, in event order.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#include <TROOT.h>
+#include <TFile.h>
+#include <TH1D.h>
+#include <TH2D.h>
+#include <TMatrixD.h>
+#include <TVectorD.h>
+#include <TStopwatch.h>
+#include <TTree.h>
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <iostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "eventStore.h"
+#include "instrumentation.h"
+#include "parallel.h"
+#include "resultSink.h"
+
+// Event j is in slice[j], slice k holds boundaries[k - 1] < x <= boundaries[k] as in quantiles.cpp.
+// offsets[k + 1] - offsets[k] events are in slice k, offsets[k] of them in the slices below.
+struct QuantileSlices {
+    std::vector<double> boundaries;
+    std::vector<uint64_t> offsets;
+    std::vector<uint16_t> slice;
+};
+
+// Places the sorted value of every rank in [ranksBegin, ranksEnd) at its position, splitting
+// the work in two at the middle rank and handing one half to another thread while depth lasts
+void multiSelect(double *begin, double *end, const uint64_t *ranksBegin, const uint64_t *ranksEnd,
+                 uint64_t offset, uint32_t depth) {
+    if (ranksBegin == ranksEnd) {
+        return;
+    }
+    const uint64_t *middle = ranksBegin + (ranksEnd - ranksBegin) / 2;
+    double *pivot = begin + (*middle - offset);
+    std::nth_element(begin, pivot, end);
+
+    if (depth == 0) {
+        multiSelect(begin, pivot, ranksBegin, middle, offset, 0);
+        multiSelect(pivot + 1, end, middle + 1, ranksEnd, *middle + 1, 0);
+        return;
+    }
+    std::future<void> lower = std::async(std::launch::async, multiSelect, begin, pivot, ranksBegin, middle,
+                                         offset, depth - 1);
+    multiSelect(pivot + 1, end, middle + 1, ranksEnd, *middle + 1, depth - 1);
+    lower.get();
+}
+
+// Boundary k is the smallest value with at least a fraction k / nSlices of the events at or below it.
+// Needs at least one event per slice, so the ranks are distinct and increasing as multiSelect
+// expects; otherwise the result is empty.
+QuantileSlices exactQuantileSlices(const double *values, uint64_t numEvents, uint32_t nSlices, uint32_t nThreads) {
+    QuantileSlices slices;
+    if (nSlices == 0 || numEvents < nSlices) {
+        std::cerr << numEvents << " events are too few for " << nSlices << " slices" << std::endl;
+        return slices;
+    }
+    std::vector<uint64_t> ranks;
+    for (uint32_t k = 1; k < nSlices; k++) {
+        uint64_t rank = (uint64_t)ceil(double(k) * numEvents / nSlices);
+        ranks.push_back(rank - 1);
+    }
+
+    std::vector<double> work(values, values + numEvents);
+    uint32_t depth = 0;
+    while ((1u << depth) < nThreads) {
+        depth++;
+    }
+    multiSelect(work.data(), work.data() + numEvents, ranks.data(), ranks.data() + ranks.size(), 0, depth);
+    for (uint32_t k = 0; k < ranks.size(); k++) {
+        slices.boundaries.push_back(work[ranks[k]]);
+    }
+    std::vector<double>().swap(work);
+
+    // Slice of every event, counted per thread in the same pass
+    const double *first = slices.boundaries.data();
+    const double *last = first + slices.boundaries.size();
+    std::vector<uint64_t> counts(nThreads * nSlices, 0);
+    slices.slice.resize(numEvents);
+    parallelFor(numEvents, nThreads, [&](uint64_t begin, uint64_t end, uint32_t thread) {
+        for (uint64_t i = begin; i < end; i++) {
+            uint16_t k = std::lower_bound(first, last, values[i]) - first;
+            slices.slice[i] = k;
+            counts[thread * nSlices + k]++;
+        }
+    });
+
+    slices.offsets.assign(nSlices + 1, 0);
+    for (uint32_t k = 0; k < nSlices; k++) {
+        slices.offsets[k + 1] = slices.offsets[k];
+        for (uint32_t t = 0; t < nThreads; t++) {
+            slices.offsets[k + 1] += counts[t * nSlices + k];
+        }
+    }
+    return slices;
+}
+
+// Binned boundaries at the same fractions, as quantiles.cpp would find them
+std::vector<double> binnedBoundaries(TH1D *projection, uint32_t nSlices) {
+    std::vector<double> probabilities(nSlices - 1);
+    std::vector<double> boundaries(nSlices - 1);
+    for (uint32_t k = 0; k < nSlices - 1; k++) {
+        probabilities[k] = double(k + 1) / nSlices;
+    }
+    projection->GetQuantiles(nSlices - 1, boundaries.data(), probabilities.data());
+    return boundaries;
+}
+
+void compareBoundaries(const char *label, const QuantileSlices &exact, const std::vector<double> &binned,
+                       uint32_t nSlices) {
+    std::cout << label << " boundaries, exact vs binned:" << std::endl;
+    for (uint32_t k = 0; k < nSlices - 1; k++) {
+        std::cout << "  " << 100. * (k + 1) / nSlices << "%\t" << exact.boundaries[k] << "\t" << binned[k]
+                  << "\t(" << exact.offsets[k + 1] - exact.offsets[k] << " events in slice)" << std::endl;
+    }
+}
+
+TVectorD *toVector(const std::vector<double> &values) {
+    TVectorD *vector = new TVectorD(values.size());
+    for (uint32_t i = 0; i < values.size(); i++) {
+        (*vector)[i] = values[i];
+    }
+    return vector;
+}
+
+void exactQuantiles(const char *inFileName = "data/detector_data.root", const char *method = "linear",
+                    uint32_t nSlices = 20) {
+    StageMetrics metrics("exactQuantiles");
+    if (nSlices < 2 || nSlices > 65536) {
+        std::cerr << "The number of slices has to be between 2 and 65536, the slice column is 16 bit" << std::endl;
+        return;
+    }
+    TMatrixD *c = loadRingSums(inFileName);
+    TVectorD *g = loadColumn(inFileName, "tpc_multiplicity");
+
+    TFile relations("data/epd_tpc_relations.root");
+    TMatrixD *weights = nullptr;
+    TH2D *methodHistogram = nullptr;
+    relations.GetDirectory("methods")->GetObject(Form("%s_weights", method), weights);
+    relations.GetDirectory("methods")->GetObject(method, methodHistogram);
+    if (c == nullptr || g == nullptr || weights == nullptr || methodHistogram == nullptr) {
+        std::cerr << "Could not load the data, weights or histogram for " << method << std::endl;
+        return;
+    }
+
+    uint32_t nThreads = defaultThreads();
+    uint64_t numEvents = c->GetNcols();
+    if (numEvents < nSlices) {
+        std::cerr << inFileName << " holds " << numEvents << " events, too few for " << nSlices << " slices" << std::endl;
+        return;
+    }
+    metrics.addEvents(numEvents, numEvents * 17. * sizeof(double));
+    std::cout << "Finding exact boundaries of " << numEvents << " events with " << nThreads << " threads" << std::endl;
+
+    TStopwatch timer;
+    timer.Start();
+    // X_t = sum_r W_r * C_{r, t} + W_17, as in predictTPCMultiplicity
+    std::vector<double> predictions(numEvents);
+    const double *rings = c->GetMatrixArray();
+    parallelFor(numEvents, nThreads, [&](uint64_t begin, uint64_t end, uint32_t thread) {
+        for (uint64_t i = begin; i < end; i++) {
+            predictions[i] = (*weights)[16][0];
+        }
+        for (uint32_t r = 0; r < 16; r++) {
+            double weight = (*weights)[r][0];
+            const double *ring = rings + r * numEvents;
+            for (uint64_t i = begin; i < end; i++) {
+                predictions[i] += weight * ring[i];
+            }
+        }
+    });
+
+    QuantileSlices epdSlices = exactQuantileSlices(predictions.data(), numEvents, nSlices, nThreads);
+    QuantileSlices tpcSlices = exactQuantileSlices(g->GetMatrixArray(), numEvents, nSlices, nThreads);
+    timer.Stop();
+    std::cout << "Exact quantiles took " << timer.RealTime() << " s" << std::endl;
+
+    // The binned quantiles only see the events inside the histogram range
+    double outside = numEvents - methodHistogram->Integral();
+    std::cout << outside << " events (" << 100. * outside / numEvents
+              << "%) fall outside the " << method << " histogram" << std::endl;
+    TH1D *tpcProjection = methodHistogram->ProjectionX("exact_px");
+    TH1D *epdProjection = methodHistogram->ProjectionY("exact_py");
+    compareBoundaries("RefMult", tpcSlices, binnedBoundaries(tpcProjection, nSlices), nSlices);
+    compareBoundaries("X_zeta'", epdSlices, binnedBoundaries(epdProjection, nSlices), nSlices);
+
+    // Slice sizes can differ from numEvents / nSlices where many events share a boundary value
+    std::vector<double> tpcCounts(nSlices);
+    std::vector<double> epdCounts(nSlices);
+    for (uint32_t k = 0; k < nSlices; k++) {
+        tpcCounts[k] = tpcSlices.offsets[k + 1] - tpcSlices.offsets[k];
+        epdCounts[k] = epdSlices.offsets[k + 1] - epdSlices.offsets[k];
+    }
+
+    relations.Close();
+
+    // Made in the shard, so its baskets go to disk while it fills
+    ResultSink sink("data/epd_tpc_relations.root", Form("exact_%s", method));
+    std::string output = Form("quantiles/%s", method);
+    TTree *assignment = sink.createTree(output.c_str(), "exact_slices", "Exact quantile slice of every event");
+    if (assignment == nullptr) {
+        return;
+    }
+    UShort_t tpcSlice = 0;
+    UShort_t epdSlice = 0;
+    assignment->Branch("tpc_slice", &tpcSlice, "tpc_slice/s");
+    assignment->Branch("epd_slice", &epdSlice, "epd_slice/s");
+    for (uint64_t i = 0; i < numEvents; i++) {
+        tpcSlice = tpcSlices.slice[i];
+        epdSlice = epdSlices.slice[i];
+        assignment->Fill();
+    }
+
+    sink.add(output.c_str(), "exact_tpc_boundaries", toVector(tpcSlices.boundaries));
+    sink.add(output.c_str(), "exact_epd_boundaries", toVector(epdSlices.boundaries));
+    sink.add(output.c_str(), "exact_tpc_counts", toVector(tpcCounts));
+    sink.add(output.c_str(), "exact_epd_counts", toVector(epdCounts));
+    sink.commit();
+}
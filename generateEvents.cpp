@@ -0,0 +1,378 @@
+/**
+ * \brief Synthetic events for testing the stages at scales our samples don't
+ *        reach.  The model is taken from an existing event store: RefMult is
+ *        drawn from its measured distribution, and the 16 ring sums from a
+ *        multivariate Gaussian (mean and Cholesky factor of the covariance) of
+ *        the RefMult class the event falls in.  Classes hold roughly equal
+ *        numbers of events.  TOF multiplicity (detector stores) and impact
+ *        parameter (simulated stores) are modelled per class when the source
+ *        has them, so the output has the layout of its source and every macro
+ *        reads it like detector_data.root or simulated_data.root.
+ *
+ *        Events are generated in chunks of one store cluster, chunk k with its
+ *        own generator seeded from (seed, k), so the output depends only on
+ *        the seed and not on the number of threads.  Threads generate the next
+ *        batch of chunks while the current one is written.
+ *
+ *            root -l -b -q 'generateEvents.cpp("data/detector_data.root", "data/synthetic_data.root", 1000000000)'
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#include <TROOT.h>
+#include <TMatrixD.h>
+#include <TRandom3.h>
+#include <TStopwatch.h>
+#include <TVectorD.h>
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "eventStore.h"
+#include "instrumentation.h"
+#include "parallel.h"
+
+namespace synthetic {
+
+const uint32_t rings = 16;
+const uint32_t maxClasses = 64;
+const uint64_t minClassEvents = 200;    // Enough to estimate a 16 x 16 covariance
+
+struct EventModel {
+    std::vector<double> refMultCdf;     // P(RefMult <= m)
+    std::vector<uint32_t> classOf;      // RefMult -> class
+    uint32_t nClasses = 0;
+    std::vector<double> mean;           // [class][ring]
+    std::vector<double> cholesky;       // [class][ring][ring], lower triangular
+    bool tof = false;
+    double tofPerRefMult = 0;           // TOF = tofPerRefMult * RefMult + Gaus(tofMean, tofSigma)
+    std::vector<double> tofMean, tofSigma;
+    bool impact = false;
+    std::vector<double> impactMean, impactSigma;
+};
+
+struct Chunk {
+    uint64_t numEvents = 0;
+    std::vector<float> ringSums;        // Event major, 16 per event
+    std::vector<double> refMult, tof, impact;
+};
+
+// In place Cholesky factor of the n x n matrix a, lower triangle.  Returns false if a is not
+// positive definite.
+bool choleskyFactor(double *a, uint32_t n) {
+    for (uint32_t j = 0; j < n; j++) {
+        double diagonal = a[j * n + j];
+        for (uint32_t k = 0; k < j; k++) {
+            diagonal -= a[j * n + k] * a[j * n + k];
+        }
+        if (diagonal <= 0) {
+            return false;
+        }
+        a[j * n + j] = sqrt(diagonal);
+        for (uint32_t i = j + 1; i < n; i++) {
+            double value = a[i * n + j];
+            for (uint32_t k = 0; k < j; k++) {
+                value -= a[i * n + k] * a[j * n + k];
+            }
+            a[i * n + j] = value / a[j * n + j];
+        }
+        for (uint32_t k = j + 1; k < n; k++) {
+            a[j * n + k] = 0;
+        }
+    }
+    return true;
+}
+
+// Mean and spread of values per class, classes without entries get 0
+void classMoments(const std::vector<double> &sum, const std::vector<double> &sumSquares,
+                  const std::vector<uint64_t> &counts, std::vector<double> &mean, std::vector<double> &sigma) {
+    mean.assign(counts.size(), 0);
+    sigma.assign(counts.size(), 0);
+    for (uint32_t k = 0; k < counts.size(); k++) {
+        if (counts[k] == 0) {
+            continue;
+        }
+        mean[k] = sum[k] / counts[k];
+        sigma[k] = sqrt(std::max(0., sumSquares[k] / counts[k] - mean[k] * mean[k]));
+    }
+}
+
+// Measures the model from the events in fileName
+bool buildModel(const char *fileName, EventModel &model) {
+    ScopedTimer timer("synthetic_model");
+    TMatrixD *c = loadRingSums(fileName);
+    TVectorD *g = loadColumn(fileName, "tpc_multiplicity");
+    if (c == nullptr || g == nullptr || c->GetNcols() == 0) {
+        std::cerr << "Could not load events to model from " << fileName << std::endl;
+        return false;
+    }
+    uint64_t numEvents = c->GetNcols();
+    const double *ringSums = c->GetMatrixArray();
+    const double *refMult = g->GetMatrixArray();
+    TVectorD *tof = eventStoreHasColumn(fileName, "tof_multiplicity") ? loadColumn(fileName, "tof_multiplicity") : nullptr;
+    TVectorD *impact = eventStoreHasColumn(fileName, "impact_parameter") ? loadColumn(fileName, "impact_parameter") : nullptr;
+    model.tof = tof != nullptr;
+    model.impact = impact != nullptr;
+
+    // RefMult distribution, then classes of consecutive RefMult values with about equal counts
+    uint32_t maxRefMult = 0;
+    for (uint64_t i = 0; i < numEvents; i++) {
+        maxRefMult = std::max(maxRefMult, (uint32_t)std::max(0., refMult[i]));
+    }
+    std::vector<uint64_t> refMultCounts(maxRefMult + 1, 0);
+    for (uint64_t i = 0; i < numEvents; i++) {
+        refMultCounts[(uint32_t)std::max(0., refMult[i])]++;
+    }
+    model.refMultCdf.resize(maxRefMult + 1);
+    model.classOf.resize(maxRefMult + 1);
+    uint64_t target = std::max(minClassEvents, numEvents / maxClasses);
+    uint64_t below = 0;
+    uint64_t inClass = 0;
+    uint32_t k = 0;
+    for (uint32_t m = 0; m <= maxRefMult; m++) {
+        below += refMultCounts[m];
+        model.refMultCdf[m] = double(below) / numEvents;
+        model.classOf[m] = k;
+        inClass += refMultCounts[m];
+        if (inClass >= target) {
+            k++;
+            inClass = 0;
+        }
+    }
+    // A short last class joins the one before it
+    if (inClass > 0 && inClass < target / 2 && k > 0) {
+        for (uint32_t m = 0; m <= maxRefMult; m++) {
+            model.classOf[m] = std::min(model.classOf[m], k - 1);
+        }
+        k--;
+    }
+    model.nClasses = inClass > 0 ? k + 1 : k;
+
+    // Per class ring means first, then the covariances around them
+    uint32_t nClasses = model.nClasses;
+    std::vector<uint64_t> counts(nClasses, 0);
+    model.mean.assign(nClasses * rings, 0);
+    model.cholesky.assign(nClasses * rings * rings, 0);
+    for (uint64_t i = 0; i < numEvents; i++) {
+        uint32_t eventClass = model.classOf[(uint32_t)std::max(0., refMult[i])];
+        counts[eventClass]++;
+        for (uint32_t r = 0; r < rings; r++) {
+            model.mean[eventClass * rings + r] += ringSums[r * numEvents + i];
+        }
+    }
+    for (uint32_t j = 0; j < nClasses; j++) {
+        for (uint32_t r = 0; r < rings; r++) {
+            model.mean[j * rings + r] /= std::max(counts[j], uint64_t(1));
+        }
+    }
+    double deviation[rings];
+    for (uint64_t i = 0; i < numEvents; i++) {
+        uint32_t eventClass = model.classOf[(uint32_t)std::max(0., refMult[i])];
+        double *covariance = &model.cholesky[eventClass * rings * rings];
+        for (uint32_t r = 0; r < rings; r++) {
+            deviation[r] = ringSums[r * numEvents + i] - model.mean[eventClass * rings + r];
+        }
+        for (uint32_t r = 0; r < rings; r++) {
+            for (uint32_t s = 0; s <= r; s++) {
+                covariance[r * rings + s] += deviation[r] * deviation[s];
+            }
+        }
+    }
+    for (uint32_t j = 0; j < nClasses; j++) {
+        double *covariance = &model.cholesky[j * rings * rings];
+        double scale = 1. / (counts[j] > 1 ? counts[j] - 1 : 1);
+        double trace = 0;
+        for (uint32_t r = 0; r < rings; r++) {
+            for (uint32_t s = 0; s <= r; s++) {
+                covariance[r * rings + s] *= scale;
+                covariance[s * rings + r] = covariance[r * rings + s];
+            }
+            trace += covariance[r * rings + r];
+        }
+        // Rings that never fire in a class leave the covariance singular, a little jitter fixes that
+        std::vector<double> original(covariance, covariance + rings * rings);
+        double jitter = 1e-9 * std::max(trace / rings, 1e-12);
+        while (!choleskyFactor(covariance, rings)) {
+            std::copy(original.begin(), original.end(), covariance);
+            for (uint32_t r = 0; r < rings; r++) {
+                covariance[r * rings + r] += jitter;
+            }
+            jitter *= 10;
+        }
+    }
+
+    // TOF relative to its average ratio to RefMult, impact parameter as is
+    std::vector<double> sum(nClasses, 0), sumSquares(nClasses, 0);
+    if (model.tof) {
+        double tofTotal = 0, refMultTotal = 0;
+        for (uint64_t i = 0; i < numEvents; i++) {
+            tofTotal += (*tof)[i];
+            refMultTotal += refMult[i];
+        }
+        model.tofPerRefMult = refMultTotal > 0 ? tofTotal / refMultTotal : 0;
+        for (uint64_t i = 0; i < numEvents; i++) {
+            uint32_t eventClass = model.classOf[(uint32_t)std::max(0., refMult[i])];
+            double offset = (*tof)[i] - model.tofPerRefMult * refMult[i];
+            sum[eventClass] += offset;
+            sumSquares[eventClass] += offset * offset;
+        }
+        classMoments(sum, sumSquares, counts, model.tofMean, model.tofSigma);
+    }
+    if (model.impact) {
+        sum.assign(nClasses, 0);
+        sumSquares.assign(nClasses, 0);
+        for (uint64_t i = 0; i < numEvents; i++) {
+            uint32_t eventClass = model.classOf[(uint32_t)std::max(0., refMult[i])];
+            sum[eventClass] += (*impact)[i];
+            sumSquares[eventClass] += (*impact)[i] * (*impact)[i];
+        }
+        classMoments(sum, sumSquares, counts, model.impactMean, model.impactSigma);
+    }
+
+    std::cout << "Modelled " << numEvents << " events of " << fileName << " in " << nClasses
+              << " RefMult classes" << (model.tof ? ", with TOF" : "") << (model.impact ? ", with impact parameter" : "")
+              << std::endl;
+    delete c;
+    delete g;
+    delete tof;
+    delete impact;
+    return true;
+}
+
+// 32 bit seed of chunk, never 0 since that makes TRandom3 pick a random seed
+uint32_t chunkSeed(uint64_t seed, uint64_t chunk) {
+    uint64_t x = seed * 0x9E3779B97F4A7C15ull + chunk + 1;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return uint32_t(x) | 1;
+}
+
+void generateChunk(const EventModel &model, uint64_t seed, uint64_t chunk, uint64_t numEvents, Chunk &output) {
+    TRandom3 random(chunkSeed(seed, chunk));
+    output.numEvents = numEvents;
+    output.ringSums.resize(numEvents * rings);
+    output.refMult.resize(numEvents);
+    output.tof.resize(model.tof ? numEvents : 0);
+    output.impact.resize(model.impact ? numEvents : 0);
+    double z[rings];
+    for (uint64_t i = 0; i < numEvents; i++) {
+        uint32_t m = std::lower_bound(model.refMultCdf.begin(), model.refMultCdf.end(), random.Rndm()) -
+                     model.refMultCdf.begin();
+        m = std::min(m, (uint32_t)model.refMultCdf.size() - 1);
+        uint32_t k = model.classOf[m];
+        const double *mean = &model.mean[k * rings];
+        const double *factor = &model.cholesky[k * rings * rings];
+        for (uint32_t r = 0; r < rings; r++) {
+            z[r] = random.Gaus();
+        }
+        float *event = &output.ringSums[i * rings];
+        for (uint32_t r = 0; r < rings; r++) {
+            double value = mean[r];
+            for (uint32_t s = 0; s <= r; s++) {
+                value += factor[r * rings + s] * z[s];
+            }
+            event[r] = value > 0 ? value : 0;   // nMIP sums are never negative
+        }
+        output.refMult[i] = m;
+        if (model.tof) {
+            output.tof[i] = std::max(0., model.tofPerRefMult * m + random.Gaus(model.tofMean[k], model.tofSigma[k]));
+        }
+        if (model.impact) {
+            output.impact[i] = std::max(0., random.Gaus(model.impactMean[k], model.impactSigma[k]));
+        }
+    }
+}
+
+} // namespace synthetic
+
+// compression 404 (LZ4) keeps the writer close to disk speed, 505 matches the ingest
+void generateEvents(const char *modelFileName = "data/detector_data.root",
+                    const char *outFileName = "data/synthetic_data.root",
+                    uint64_t numEvents = 100000000, uint64_t seed = 1, uint32_t nThreads = 0,
+                    int32_t compression = 404) {
+    StageMetrics metrics("generateEvents");
+    synthetic::EventModel model;
+    if (!synthetic::buildModel(modelFileName, model)) {
+        return;
+    }
+    if (nThreads == 0) {
+        nThreads = defaultThreads();
+    }
+
+    EventStoreWriter store(outFileName, compression);
+    uint32_t tofColumn = model.tof ? store.addColumn("tof_multiplicity", 's') : 0;
+    uint32_t impactColumn = model.impact ? store.addColumn("impact_parameter", 'F') : 0;
+    if (!store.good()) {
+        return;
+    }
+
+    // Batches of one chunk per thread, the next batch is generated while this one is written
+    const uint64_t chunkEvents = eventStoreCluster;
+    uint64_t numChunks = (numEvents + chunkEvents - 1) / chunkEvents;
+    std::vector<synthetic::Chunk> current(nThreads), next(nThreads);
+    auto generateBatch = [&](uint64_t firstChunk, std::vector<synthetic::Chunk> &batch) {
+        uint64_t batchChunks = std::min<uint64_t>(nThreads, numChunks - firstChunk);
+        parallelFor(batchChunks, nThreads, [&](uint64_t begin, uint64_t end, uint32_t) {
+            for (uint64_t c = begin; c < end; c++) {
+                uint64_t chunk = firstChunk + c;
+                uint64_t events = std::min(chunkEvents, numEvents - chunk * chunkEvents);
+                synthetic::generateChunk(model, seed, chunk, events, batch[c]);
+            }
+        });
+        for (uint64_t c = batchChunks; c < batch.size(); c++) {
+            batch[c].numEvents = 0;
+        }
+    };
+
+    std::cout << "Generating " << numEvents << " events with " << nThreads << " threads" << std::endl;
+    TStopwatch timer;
+    timer.Start();
+    uint64_t reported = 0;
+    if (numChunks > 0) {
+        generateBatch(0, current);
+    }
+    for (uint64_t firstChunk = 0; firstChunk < numChunks; firstChunk += nThreads) {
+        std::thread generator;
+        if (firstChunk + nThreads < numChunks) {
+            generator = std::thread(generateBatch, firstChunk + nThreads, std::ref(next));
+        }
+        for (uint32_t c = 0; c < current.size(); c++) {
+            const synthetic::Chunk &chunk = current[c];
+            for (uint64_t i = 0; i < chunk.numEvents; i++) {
+                if (model.tof) {
+                    store.setColumn(tofColumn, chunk.tof[i]);
+                }
+                if (model.impact) {
+                    store.setColumn(impactColumn, chunk.impact[i]);
+                }
+                store.fill(&chunk.ringSums[i * synthetic::rings], chunk.refMult[i]);
+            }
+        }
+        if (generator.joinable()) {
+            generator.join();
+        }
+        std::swap(current, next);
+
+        uint64_t written = std::min(numEvents, (firstChunk + nThreads) * chunkEvents);
+        if (written * 10 / numEvents > reported) {
+            reported = written * 10 / numEvents;
+            std::cout << "Wrote " << written << "/" << numEvents << " events" << std::endl;
+        }
+    }
+    metrics.addEvents(store.entries(), store.entries() * (synthetic::rings + 2.) * sizeof(Float_t));
+    store.close();
+    timer.Stop();
+    std::cout << "Generated " << numEvents << " events into " << outFileName << " at "
+              << numEvents / std::max(timer.RealTime(), 1e-9) << " events/s" << std::endl;
+}
@@ -0,0 +1,412 @@
+/**
+ * \brief Weighted normal equations of the linear ring sum model, X = sum_r W_r C_r + W_16.
+ *        For event weights w_j it accumulates
+ *
+ *            A = sum_j w_j x_j x_j^T,    B = sum_j w_j g_j x_j,    x_j = (C_{0, j} ... C_{15, j}, 1)
+ *
+ *        over the 16 x N ring sum matrix.  Events are taken a block at a time so the
+ *        block stays in cache while the 153 distinct products of A are summed, each
+ *        as a loop over contiguous ring rows the compiler vectorizes.  Threads keep
+ *        their own WeightedGram and add them in thread order, so results repeat for
+ *        a given thread count.  Solutions use the linear weights layout, rings 0-15
+ *        and the bias in 16.
+ *
+ *        groupedGram() keeps one WeightedGram per group key (a run, a vertex bin,
+ *        ...) in the same single pass, for fits that are done per group.
+ *        binnedGram() does the same for a few dense bins that change from event to
+ *        event, like vertex z, by staging each bin's events into full blocks first.
+ *
+ *        floatGram() reads the ring sums as floats and RefMult as 16 bit integers,
+ *        the types the ring cache keeps, at half the memory traffic.  Each block is
+ *        widened to double in cache and its sums are added into the total with
+ *        Neumaier compensation (CompensatedGram), so the Gram matches the double
+ *        path to its last digits however many events there are.
+ *
+ *        predictFromRings() applies a solution to ring rows of floats or doubles,
+ *        the prediction loop the linear fits share.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#ifndef GRAM
+#define GRAM
+
+#include <TROOT.h>
+#include <TMatrixD.h>
+#include <TVectorD.h>
+
+#include <math.h>
+#include <stdint.h>
+
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include "parallel.h"
+
+const uint32_t gramDim = 17;        // 16 rings and the bias
+const uint32_t gramBlock = 256;     // Events per block, 16 rings of them fit in L1
+
+struct WeightedGram {
+    double a[gramDim][gramDim] = {};
+    double b[gramDim] = {};
+    double sumWG2 = 0;      // sum_j w_j g_j^2, so the weighted RSS of a solution follows from A and B
+    uint64_t events = 0;
+
+    void add(const WeightedGram &other) {
+        for (uint32_t q = 0; q < gramDim; q++) {
+            for (uint32_t t = 0; t < gramDim; t++) {
+                a[q][t] += other.a[q][t];
+            }
+            b[q] += other.b[q];
+        }
+        sumWG2 += other.sumWG2;
+        events += other.events;
+    }
+
+    // Adds events first to first + length.  rings points at ring 0 of event 0, rows are numEvents
+    // apart.  blockWeights holds the weights of just these events, without it they are all 1.
+    void accumulate(const double *rings, uint64_t numEvents, const double *g, uint64_t first, uint32_t length,
+                    const double *blockWeights = nullptr) {
+        double weighted[gramBlock];
+        const double *row[gramDim - 1];
+        for (uint32_t r = 0; r < gramDim - 1; r++) {
+            row[r] = rings + r * numEvents + first;
+        }
+        const double *blockG = g + first;
+        for (uint32_t i = 0; i < length; i++) {
+            weighted[i] = blockWeights != nullptr ? blockWeights[i] : 1;
+        }
+
+        double sumW = 0;
+        double sumWG = 0;
+        double sumWG2Block = 0;
+        for (uint32_t i = 0; i < length; i++) {
+            sumW += weighted[i];
+            sumWG += weighted[i] * blockG[i];
+            sumWG2Block += weighted[i] * blockG[i] * blockG[i];
+        }
+        a[gramDim - 1][gramDim - 1] += sumW;
+        b[gramDim - 1] += sumWG;
+        sumWG2 += sumWG2Block;
+
+        for (uint32_t q = 0; q < gramDim - 1; q++) {
+            const double *x = row[q];
+            double sumWX = 0;
+            double sumWXG = 0;
+            for (uint32_t i = 0; i < length; i++) {
+                sumWX += weighted[i] * x[i];
+                sumWXG += weighted[i] * x[i] * blockG[i];
+            }
+            a[q][gramDim - 1] += sumWX;
+            b[q] += sumWXG;
+            for (uint32_t t = q; t < gramDim - 1; t++) {
+                const double *y = row[t];
+                double sumWXY = 0;
+                for (uint32_t i = 0; i < length; i++) {
+                    sumWXY += weighted[i] * x[i] * y[i];
+                }
+                a[q][t] += sumWXY;
+            }
+        }
+        events += length;
+    }
+
+    // Fills in the lower triangle, accumulate() only sums q <= t and solve() only reads those
+    void symmetrize() {
+        for (uint32_t q = 0; q < gramDim; q++) {
+            for (uint32_t t = q + 1; t < gramDim; t++) {
+                a[t][q] = a[q][t];
+            }
+        }
+    }
+
+    // Solves (A + ridge * I_rings) x = B by Cholesky, the bias is not regularized.  Returns false
+    // if the matrix is not positive definite, e.g. a ring that is zero in every event.
+    bool solve(double *solution, double ridge = 0) const {
+        double l[gramDim][gramDim] = {};
+        for (uint32_t q = 0; q < gramDim; q++) {
+            for (uint32_t t = 0; t <= q; t++) {
+                double sum = a[t][q] + (q == t && q < gramDim - 1 ? ridge : 0);     // Upper triangle
+                for (uint32_t k = 0; k < t; k++) {
+                    sum -= l[q][k] * l[t][k];
+                }
+                if (q == t) {
+                    if (!(sum > 0)) {
+                        return false;
+                    }
+                    l[q][q] = sqrt(sum);
+                }
+                else {
+                    l[q][t] = sum / l[t][t];
+                }
+            }
+        }
+        double y[gramDim];
+        for (uint32_t q = 0; q < gramDim; q++) {
+            double sum = b[q];
+            for (uint32_t k = 0; k < q; k++) {
+                sum -= l[q][k] * y[k];
+            }
+            y[q] = sum / l[q][q];
+        }
+        for (int32_t q = gramDim - 1; q >= 0; q--) {
+            double sum = y[q];
+            for (uint32_t k = q + 1; k < gramDim; k++) {
+                sum -= l[k][q] * solution[k];
+            }
+            solution[q] = sum / l[q][q];
+        }
+        return true;
+    }
+
+    // sum_j w_j (g_j - x_j . solution)^2
+    double weightedRss(const double *solution) const {
+        double rss = sumWG2;
+        for (uint32_t q = 0; q < gramDim; q++) {
+            rss -= 2 * solution[q] * b[q];
+            for (uint32_t t = 0; t < gramDim; t++) {
+                double aqt = q <= t ? a[q][t] : a[t][q];
+                rss += solution[q] * aqt * solution[t];
+            }
+        }
+        return rss;
+    }
+};
+
+// A and B over all events in one multithreaded pass, eventWeights may be nullptr for weight 1
+inline WeightedGram weightedGram(const TMatrixD *c, const TVectorD *g, const double *eventWeights = nullptr,
+                                 uint32_t nThreads = 0) {
+    uint64_t numEvents = c->GetNcols();
+    const double *rings = c->GetMatrixArray();
+    const double *target = g->GetMatrixArray();
+    nThreads = nThreads > 0 ? nThreads : defaultThreads();
+    std::vector<WeightedGram> partial(nThreads);
+    parallelFor(numEvents, nThreads, [&](uint64_t begin, uint64_t end, uint32_t thread) {
+        for (uint64_t first = begin; first < end; first += gramBlock) {
+            uint32_t length = end - first < gramBlock ? end - first : gramBlock;
+            partial[thread].accumulate(rings, numEvents, target, first, length,
+                                       eventWeights != nullptr ? eventWeights + first : nullptr);
+        }
+    });
+    WeightedGram total;
+    for (uint32_t t = 0; t < nThreads; t++) {
+        total.add(partial[t]);
+    }
+    total.symmetrize();
+    return total;
+}
+
+// One WeightedGram per distinct keys[j] over all events, in one multithreaded pass.  Each thread
+// hashes keys into its own table, and runs of events with the same key go to accumulate() as one
+// block, so a store ordered by key (runs are) costs about what the ungrouped pass does.  The
+// thread tables are added in thread order into a map ordered by key.
+inline std::map<uint32_t, WeightedGram> groupedGram(const TMatrixD *c, const TVectorD *g, const uint32_t *keys,
+                                                    const double *eventWeights = nullptr, uint32_t nThreads = 0) {
+    uint64_t numEvents = c->GetNcols();
+    const double *rings = c->GetMatrixArray();
+    const double *target = g->GetMatrixArray();
+    nThreads = nThreads > 0 ? nThreads : defaultThreads();
+    std::vector<std::unordered_map<uint32_t, WeightedGram>> partial(nThreads);
+    parallelFor(numEvents, nThreads, [&](uint64_t begin, uint64_t end, uint32_t thread) {
+        std::unordered_map<uint32_t, WeightedGram> &groups = partial[thread];
+        uint64_t first = begin;
+        while (first < end) {
+            uint32_t key = keys[first];
+            uint64_t last = first + 1;
+            while (last < end && last - first < gramBlock && keys[last] == key) {
+                last++;
+            }
+            groups[key].accumulate(rings, numEvents, target, first, last - first,
+                                   eventWeights != nullptr ? eventWeights + first : nullptr);
+            first = last;
+        }
+    });
+    std::map<uint32_t, WeightedGram> total;
+    for (uint32_t t = 0; t < nThreads; t++) {
+        for (std::unordered_map<uint32_t, WeightedGram>::iterator group = partial[t].begin();
+             group != partial[t].end(); group++) {
+            total[group->first].add(group->second);
+        }
+    }
+    for (std::map<uint32_t, WeightedGram>::iterator group = total.begin(); group != total.end(); group++) {
+        group->second.symmetrize();
+    }
+    return total;
+}
+
+// One WeightedGram per bin over all events, in one multithreaded pass.  bins[j] is in [0, nBins),
+// events with other values are skipped.  Bins are unordered in the store, so each thread copies
+// its events into a staging block per bin (ring rows, g and weight) and accumulates a bin's block
+// whenever it is full.  Thread results are added in thread order.
+inline std::vector<WeightedGram> binnedGram(const TMatrixD *c, const TVectorD *g, const uint32_t *bins,
+                                            uint32_t nBins, const double *eventWeights = nullptr,
+                                            uint32_t nThreads = 0) {
+    uint64_t numEvents = c->GetNcols();
+    const double *rings = c->GetMatrixArray();
+    const double *target = g->GetMatrixArray();
+    nThreads = nThreads > 0 ? nThreads : defaultThreads();
+    const uint32_t stagedRows = gramDim + 1;      // 16 rings, g, weight
+    std::vector<std::vector<WeightedGram>> partial(nThreads, std::vector<WeightedGram>(nBins));
+    parallelFor(numEvents, nThreads, [&](uint64_t begin, uint64_t end, uint32_t thread) {
+        std::vector<WeightedGram> &grams = partial[thread];
+        std::vector<double> staged(nBins * stagedRows * gramBlock);
+        std::vector<uint32_t> fill(nBins, 0);
+        for (uint64_t j = begin; j < end; j++) {
+            uint32_t bin = bins[j];
+            if (bin >= nBins) {
+                continue;
+            }
+            double *block = &staged[bin * stagedRows * gramBlock];
+            uint32_t i = fill[bin];
+            for (uint32_t r = 0; r < gramDim - 1; r++) {
+                block[r * gramBlock + i] = rings[r * numEvents + j];
+            }
+            block[(gramDim - 1) * gramBlock + i] = target[j];
+            block[gramDim * gramBlock + i] = eventWeights != nullptr ? eventWeights[j] : 1;
+            if (++fill[bin] == gramBlock) {
+                grams[bin].accumulate(block, gramBlock, block + (gramDim - 1) * gramBlock, 0, gramBlock,
+                                      block + gramDim * gramBlock);
+                fill[bin] = 0;
+            }
+        }
+        for (uint32_t bin = 0; bin < nBins; bin++) {
+            double *block = &staged[bin * stagedRows * gramBlock];
+            if (fill[bin] > 0) {
+                grams[bin].accumulate(block, gramBlock, block + (gramDim - 1) * gramBlock, 0, fill[bin],
+                                      block + gramDim * gramBlock);
+            }
+        }
+    });
+    std::vector<WeightedGram> total(nBins);
+    for (uint32_t t = 0; t < nThreads; t++) {
+        for (uint32_t bin = 0; bin < nBins; bin++) {
+            total[bin].add(partial[t][bin]);
+        }
+    }
+    for (uint32_t bin = 0; bin < nBins; bin++) {
+        total[bin].symmetrize();
+    }
+    return total;
+}
+
+// Running sum of block Grams, every entry carries the rounding error of its additions so
+// adding millions of blocks loses no more than adding two (Neumaier's variant of Kahan)
+struct CompensatedGram {
+    WeightedGram sum;
+    WeightedGram carry;
+
+    static void addTo(double &total, double &error, double value) {
+        double next = total + value;
+        error += fabs(total) >= fabs(value) ? (total - next) + value : (value - next) + total;
+        total = next;
+    }
+
+    void add(const WeightedGram &block) {
+        for (uint32_t q = 0; q < gramDim; q++) {
+            for (uint32_t t = q; t < gramDim; t++) {
+                addTo(sum.a[q][t], carry.a[q][t], block.a[q][t]);
+            }
+            addTo(sum.b[q], carry.b[q], block.b[q]);
+        }
+        addTo(sum.sumWG2, carry.sumWG2, block.sumWG2);
+        sum.events += block.events;
+    }
+
+    void add(const CompensatedGram &other) {
+        add(other.sum);
+        add(other.carry);       // Its events stay 0
+    }
+
+    // The compensated sums, upper triangle only
+    WeightedGram total() const {
+        WeightedGram result = sum;
+        for (uint32_t q = 0; q < gramDim; q++) {
+            for (uint32_t t = q; t < gramDim; t++) {
+                result.a[q][t] += carry.a[q][t];
+            }
+            result.b[q] += carry.b[q];
+        }
+        result.sumWG2 += carry.sumWG2;
+        return result;
+    }
+};
+
+// Unweighted Gram of numEvents events, ring r of event j at rings[r * numEvents + j]
+inline WeightedGram floatGram(const float *rings, const uint16_t *g, uint64_t numEvents, uint32_t nThreads = 0) {
+    nThreads = nThreads > 0 ? nThreads : defaultThreads();
+    std::vector<CompensatedGram> partial(nThreads);
+    parallelFor(numEvents, nThreads, [&](uint64_t begin, uint64_t end, uint32_t thread) {
+        double block[gramDim * gramBlock];      // 16 rings, then g
+        WeightedGram blockGram;
+        for (uint64_t first = begin; first < end; first += gramBlock) {
+            uint32_t length = end - first < gramBlock ? end - first : gramBlock;
+            for (uint32_t r = 0; r < gramDim - 1; r++) {
+                const float *row = rings + r * numEvents + first;
+                for (uint32_t i = 0; i < length; i++) {
+                    block[r * gramBlock + i] = row[i];
+                }
+            }
+            for (uint32_t i = 0; i < length; i++) {
+                block[(gramDim - 1) * gramBlock + i] = g[first + i];
+            }
+            blockGram = WeightedGram();
+            blockGram.accumulate(block, gramBlock, block + (gramDim - 1) * gramBlock, 0, length);
+            partial[thread].add(blockGram);
+        }
+    });
+    CompensatedGram total;
+    for (uint32_t t = 0; t < nThreads; t++) {
+        total.add(partial[t]);
+    }
+    WeightedGram gram = total.total();
+    gram.symmetrize();
+    return gram;
+}
+
+// X_j = sum_r W_r C_{r, j} + W_16 into output, summed in double, for rings of floats or doubles.
+// Ring r of event j at rings[r * numEvents + j], a ring row at a time over each thread's events.
+template <typename Real>
+inline void predictFromRings(const double *solution, const Real *rings, uint64_t numEvents, double *output,
+                             uint32_t nThreads = 0) {
+    parallelFor(numEvents, nThreads > 0 ? nThreads : defaultThreads(),
+                [&](uint64_t begin, uint64_t end, uint32_t thread) {
+        for (uint64_t j = begin; j < end; j++) {
+            output[j] = solution[gramDim - 1];
+        }
+        for (uint32_t r = 0; r < gramDim - 1; r++) {
+            const Real *row = rings + r * numEvents;
+            double w = solution[r];
+            for (uint64_t j = begin; j < end; j++) {
+                output[j] += w * row[j];
+            }
+        }
+    });
+}
+
+inline void predictFromFloats(const double *solution, const float *rings, uint64_t numEvents, double *output,
+                              uint32_t nThreads = 0) {
+    predictFromRings(solution, rings, numEvents, output, nThreads);
+}
+
+// The prediction of a solution in the linear weights layout for the 16 x N ring sums c
+inline TVectorD *predictFromRings(const double *solution, const TMatrixD *c, uint32_t nThreads = 0) {
+    TVectorD *predictions = new TVectorD(c->GetNcols());
+    predictFromRings(solution, c->GetMatrixArray(), c->GetNcols(), predictions->GetMatrixArray(), nThreads);
+    return predictions;
+}
+
+// A solution as the 17 x 1 matrix the linear methods store as <method>_weights
+inline TMatrixD *gramWeightMatrix(const double *solution) {
+    TMatrixD *weights = new TMatrixD(gramDim, 1);
+    for (uint32_t q = 0; q < gramDim; q++) {
+        (*weights)[q][0] = solution[q];
+    }
+    return weights;
+}
+
+#endif // GRAM
@@ -0,0 +1,371 @@
+/**
+ * \brief Compressed sparse row store of the EPD hits, so ring sums can be rebuilt
+ *        with another nMIP clamp or tile grouping without reading the picoDsts
+ *        again.  The ingest writes data/foo.hits next to data/foo.root (see
+ *        EventStoreWriter::enableHits), laid out as
+ *
+ *            HitStoreHeader                       (padded to 4096 bytes)
+ *            packed hits of every event           (uint32, page aligned)
+ *            offsets                              (uint64, nEvents + 1, page aligned)
+ *
+ *        The hits of event j are hits[offsets[j]] to hits[offsets[j + 1] - 1],
+ *        sorted by tile.  A packed hit holds the epdTileIndex in its low 16 bits and
+ *        the raw, unclamped nMIP in units of 1 / hitNmipScale in its high 16 bits,
+ *        so 4 bytes a hit and nMIPs up to 64 to within 0.0005.
+ *
+ *        A long ingest can checkpoint the writer: checkpoint() syncs the hits and
+ *        appends the new offsets to data/foo.hits.offsets, and a writer constructed
+ *        with the number of events to resume from cuts both files back to that
+ *        event and carries on.  close() removes the offsets journal.
+ *
+ *        rebuildGroups() is the kernel that sums the clamped nMIPs per tile group,
+ *        ringTileGroups() gives the 16 rings of the ingest.  Sums are floats added
+ *        in tile order, so they match the ingest's to float rounding.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#ifndef HIT_STORE
+#define HIT_STORE
+
+#include <TROOT.h>
+#include <TMatrixD.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "epdHits.h"
+#include "parallel.h"
+#include "ringSumCache.h"
+
+const char hitStoreMagic[8] = "EPDHITS";
+const uint32_t hitStoreVersion = 1;
+const float hitNmipScale = 1024;
+
+struct HitStoreHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t nEvents;
+    uint64_t nHits;
+    uint64_t hitOffset;         // Bytes from the start of the file, page aligned
+    uint64_t offsetsOffset;
+};
+
+// data/detector_data.root -> data/detector_data.hits
+inline std::string hitStoreFile(const char *source) {
+    std::string file = source;
+    size_t dot = file.find_last_of('.');
+    if (dot != std::string::npos && file.find('/', dot) == std::string::npos) {
+        file = file.substr(0, dot);
+    }
+    return file + ".hits";
+}
+
+inline uint32_t packHit(uint16_t tile, float nMip) {
+    float scaled = nMip * hitNmipScale + 0.5f;
+    uint32_t units = scaled <= 0 ? 0 : scaled >= 65535 ? 65535 : uint32_t(scaled);
+    return tile | units << 16;
+}
+
+inline uint16_t hitTile(uint32_t hit) {
+    return hit & 0xffff;
+}
+
+inline float hitNmip(uint32_t hit) {
+    return (hit >> 16) * (1 / hitNmipScale);
+}
+
+// Writes the hits one event at a time, hits are only kept for the event being filled
+class HitStoreWriter {
+public:
+    // resumeEvents >= 0 continues a checkpointed store after its first resumeEvents events
+    HitStoreWriter(const char *fileName, int64_t resumeEvents = -1) : name(fileName), journalName(name + ".offsets") {
+        if (resumeEvents >= 0) {
+            resume(resumeEvents);
+            return;
+        }
+        file = fopen(fileName, "wb");
+        if (file == nullptr) {
+            std::cerr << "Could not create hit store " << fileName << std::endl;
+            return;
+        }
+        // The header is written at close, the hits start on the first page after it
+        fseek(file, alignCacheOffset(sizeof(HitStoreHeader)), SEEK_SET);
+        offsets.push_back(0);
+        remove(journalName.c_str());
+    }
+
+    ~HitStoreWriter() {
+        close();
+    }
+
+    bool good() const {
+        return file != nullptr;
+    }
+
+    // Adds a hit to the current event, a tile seen twice gets the sum
+    void addHit(uint16_t tile, float nMip) {
+        if (tile >= epdTiles) {
+            return;
+        }
+        uint32_t i = numHits;
+        while (i > 0 && tiles[i - 1] > tile) {
+            i--;
+        }
+        if (i > 0 && tiles[i - 1] == tile) {
+            nMips[i - 1] += nMip;
+            return;
+        }
+        memmove(tiles + i + 1, tiles + i, (numHits - i) * sizeof(uint16_t));
+        memmove(nMips + i + 1, nMips + i, (numHits - i) * sizeof(float));
+        tiles[i] = tile;
+        nMips[i] = nMip;
+        numHits++;
+    }
+
+    // Closes the current event, which may have no hits
+    void endEvent() {
+        if (file == nullptr) {
+            return;
+        }
+        uint32_t packed[epdTiles];
+        for (uint32_t i = 0; i < numHits; i++) {
+            packed[i] = packHit(tiles[i], nMips[i]);
+        }
+        if (fwrite(packed, sizeof(uint32_t), numHits, file) != numHits) {
+            failed = true;
+        }
+        offsets.push_back(offsets.back() + numHits);
+        numHits = 0;
+    }
+
+    // Makes the hits of every ended event durable, so a writer can resume after them
+    bool checkpoint() {
+        if (file == nullptr || failed) {
+            return false;
+        }
+        FILE *journal = fopen(journalName.c_str(), journaled == 0 ? "wb" : "ab");
+        if (journal == nullptr) {
+            std::cerr << "Could not write " << journalName << std::endl;
+            return false;
+        }
+        uint64_t added = offsets.size() - journaled;
+        bool good = fflush(file) == 0 && fsync(fileno(file)) == 0 &&
+                    fwrite(offsets.data() + journaled, sizeof(uint64_t), added, journal) == added &&
+                    fflush(journal) == 0 && fsync(fileno(journal)) == 0;
+        good = fclose(journal) == 0 && good;
+        if (good) {
+            journaled = offsets.size();
+        }
+        return good;
+    }
+
+    bool close() {
+        if (file == nullptr) {
+            return false;
+        }
+        HitStoreHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, hitStoreMagic, sizeof(header.magic));
+        header.version = hitStoreVersion;
+        header.nEvents = offsets.size() - 1;
+        header.nHits = offsets.back();
+        header.hitOffset = alignCacheOffset(sizeof(header));
+        header.offsetsOffset = alignCacheOffset(header.hitOffset + header.nHits * sizeof(uint32_t));
+        bool good = !failed && fseek(file, header.offsetsOffset, SEEK_SET) == 0 &&
+                    fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), file) == offsets.size() &&
+                    fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+        good = fclose(file) == 0 && good;
+        file = nullptr;
+        if (!good) {
+            std::cerr << "Could not write hit store " << name << std::endl;
+        }
+        else {
+            remove(journalName.c_str());
+        }
+        return good;
+    }
+
+    // Stops without finishing the store, which stays as the last checkpoint left it (hits and
+    // journal) for a writer to resume
+    void abandon() {
+        if (file != nullptr) {
+            fclose(file);
+            file = nullptr;
+        }
+    }
+
+private:
+    // Reads the offsets of the first events from the journal and cuts off anything a checkpoint
+    // did not cover
+    void resume(uint64_t events) {
+        FILE *journal = fopen(journalName.c_str(), "rb");
+        offsets.resize(events + 1);
+        bool good = journal != nullptr && fread(offsets.data(), sizeof(uint64_t), events + 1, journal) == events + 1;
+        if (journal != nullptr) {
+            fclose(journal);
+        }
+        uint64_t hitEnd = alignCacheOffset(sizeof(HitStoreHeader)) + offsets.back() * sizeof(uint32_t);
+        good = good && truncate(journalName.c_str(), offsets.size() * sizeof(uint64_t)) == 0 &&
+               truncate(name.c_str(), hitEnd) == 0;
+        file = good ? fopen(name.c_str(), "r+b") : nullptr;
+        if (file == nullptr || fseek(file, hitEnd, SEEK_SET) != 0) {
+            std::cerr << "Could not resume hit store " << name << " after " << events << " events" << std::endl;
+            if (file != nullptr) {
+                fclose(file);
+            }
+            file = nullptr;
+            offsets.clear();
+            return;
+        }
+        journaled = offsets.size();
+    }
+
+    std::string name;
+    std::string journalName;        // Offsets as of the last checkpoint
+    uint64_t journaled = 0;         // Offsets already in the journal
+    FILE *file = nullptr;
+    bool failed = false;
+    std::vector<uint64_t> offsets;
+    uint32_t numHits = 0;
+    uint16_t tiles[epdTiles];       // Of the current event, sorted
+    float nMips[epdTiles];
+};
+
+class HitStore {
+public:
+    // Maps the hit store of source (data/foo.root -> data/foo.hits), nullptr if it is missing
+    // or damaged
+    static HitStore *open(const char *source) {
+        std::string storeFile = hitStoreFile(source);
+        int descriptor = ::open(storeFile.c_str(), O_RDONLY);
+        if (descriptor < 0) {
+            std::cerr << "Could not open hit store " << storeFile << std::endl;
+            return nullptr;
+        }
+        struct stat status;
+        HitStoreHeader header;
+        if (fstat(descriptor, &status) != 0 || pread(descriptor, &header, sizeof(header), 0) != sizeof(header) ||
+            memcmp(header.magic, hitStoreMagic, sizeof(header.magic)) != 0 || header.version != hitStoreVersion ||
+            (uint64_t)status.st_size < header.offsetsOffset + (header.nEvents + 1) * sizeof(uint64_t)) {
+            std::cerr << storeFile << " is not a valid hit store" << std::endl;
+            close(descriptor);
+            return nullptr;
+        }
+        void *mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        close(descriptor);
+        if (mapping == MAP_FAILED) {
+            std::cerr << "Could not map " << storeFile << std::endl;
+            return nullptr;
+        }
+        madvise(mapping, status.st_size, MADV_SEQUENTIAL);
+        HitStore *store = new HitStore();
+        store->mapping = (char*)mapping;
+        store->length = status.st_size;
+        store->numEvents = header.nEvents;
+        store->eventOffsets = (const uint64_t*)(store->mapping + header.offsetsOffset);
+        store->packedHits = (const uint32_t*)(store->mapping + header.hitOffset);
+        return store;
+    }
+
+    // A store over hits in memory, for tests and benchmarks.  Both arrays must outlive it.
+    HitStore(const uint64_t *offsets, const uint32_t *hits, uint64_t events)
+        : numEvents(events), eventOffsets(offsets), packedHits(hits) {}
+
+    ~HitStore() {
+        if (mapping != nullptr) {
+            munmap(mapping, length);
+        }
+    }
+
+    uint64_t numberOfEvents() const {
+        return numEvents;
+    }
+
+    uint64_t numberOfHits() const {
+        return eventOffsets[numEvents];
+    }
+
+    const uint64_t *offsets() const {
+        return eventOffsets;
+    }
+
+    const uint32_t *hits() const {
+        return packedHits;
+    }
+
+private:
+    HitStore() {}
+
+    char *mapping = nullptr;
+    uint64_t length = 0;
+    uint64_t numEvents = 0;
+    const uint64_t *eventOffsets = nullptr;
+    const uint32_t *packedHits = nullptr;
+};
+
+// Group of every tile for the 16 rings of the ingest, both sides summed (tile() / 2)
+inline std::vector<uint16_t> ringTileGroups() {
+    std::vector<uint16_t> groups(epdTiles);
+    for (uint32_t index = 0; index < epdTiles; index++) {
+        groups[index] = (index % 31 + 1) / 2;
+    }
+    return groups;
+}
+
+// nGroups x events matrix in the layout of ring_sums: row g of event j sums the nMIPs of the
+// event's hits whose tile has tileGroups[tile] == g, clamped to [low, high] like the ingest.
+// Tiles with a group >= nGroups are left out.  Each thread sums its events in a small stack
+// array and writes them out, so the pass is bound by reading the hits.
+inline TMatrixD *rebuildGroups(const HitStore &store, const uint16_t *tileGroups, uint32_t nGroups,
+                               float low = nMipThreshold, float high = nMipCeiling, uint32_t nThreads = 0) {
+    uint64_t numEvents = store.numberOfEvents();
+    const uint64_t *offsets = store.offsets();
+    const uint32_t *hits = store.hits();
+    TMatrixD *sums = new TMatrixD(nGroups, numEvents);
+    double *output = sums->GetMatrixArray();
+    // One spare slot takes the left out tiles so the inner loop has no branch
+    std::vector<uint16_t> slot(epdTiles);
+    for (uint32_t tile = 0; tile < epdTiles; tile++) {
+        slot[tile] = tileGroups[tile] < nGroups ? tileGroups[tile] : nGroups;
+    }
+    parallelFor(numEvents, nThreads > 0 ? nThreads : defaultThreads(),
+                [&](uint64_t begin, uint64_t end, uint32_t thread) {
+        std::vector<float> eventSums(nGroups + 1);
+        for (uint64_t j = begin; j < end; j++) {
+            for (uint32_t g = 0; g <= nGroups; g++) {
+                eventSums[g] = 0;
+            }
+            for (uint64_t i = offsets[j]; i < offsets[j + 1]; i++) {
+                eventSums[slot[hitTile(hits[i])]] += clampNmip(hitNmip(hits[i]), low, high);
+            }
+            for (uint32_t g = 0; g < nGroups; g++) {
+                output[g * numEvents + j] = eventSums[g];
+            }
+        }
+    });
+    return sums;
+}
+
+// The 16 ring sums with the clamp [low, high]
+inline TMatrixD *rebuildRingSums(const HitStore &store, float low = nMipThreshold, float high = nMipCeiling,
+                                 uint32_t nThreads = 0) {
+    std::vector<uint16_t> groups = ringTileGroups();
+    return rebuildGroups(store, groups.data(), 16, low, high, nThreads);
+}
+
+#endif // HIT_STORE
@@ -0,0 +1,213 @@
+/**
+ * \brief Checkpoint of a long ingest, so a job that is killed at event 80M picks up
+ *        where it stopped instead of starting over.  A checkpoint file holds the
+ *        job's histograms and its position: the next event of the input chain and
+ *        the number of entries the event store had (EventStoreWriter::checkpoint
+ *        saves the store itself).  Files are named by that number of entries,
+ *        data/foo.checkpoint.<entries>.root, and written to a temporary file and
+ *        renamed into place.
+ *
+ *        A checkpoint takes three steps: save() the position, checkpoint the
+ *        store, then commit(), which removes the previous file.  A job killed
+ *        anywhere in between leaves a store whose entries match one of the two
+ *        files, and load() picks that one by the entries of the store.
+ *
+ *        A checkpoint only resumes the job it came from, same input list, same
+ *        number of events and same selection.  Restoring adds the saved histograms
+ *        into the fresh empty ones, which is exact, so the resumed job's outputs
+ *        hold the same contents as an uninterrupted run.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#ifndef INGEST_CHECKPOINT
+#define INGEST_CHECKPOINT
+
+#include <TROOT.h>
+#include <TFile.h>
+#include <TH1.h>
+#include <TNamed.h>
+#include <TTree.h>
+#include <TVectorD.h>
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "eventStore.h"     // eventTreeName
+
+class IngestCheckpoint {
+public:
+    // input, totalEvents and selection identify the job, selection being whatever cut value
+    // changes which events are kept
+    IngestCheckpoint(const char *baseName, const char *input, Long64_t totalEvents, double selection)
+        : base(baseName), input(input), totalEvents(totalEvents), selection(selection) {}
+
+    // Histograms to save and restore, by name, so names have to be unique
+    void add(TH1 *histogram) {
+        histograms.push_back(histogram);
+    }
+
+    // The checkpoint saved with entries store entries
+    std::string fileName(Long64_t entries) const {
+        return base + Form(".%lld.root", (long long)entries);
+    }
+
+    // Reads the position of the checkpoint of this job that matches what the store (an event
+    // store file) holds, false if there is none
+    bool load(const char *store) {
+        if (access(store, F_OK) != 0) {
+            return false;
+        }
+        Long64_t entries = -1;
+        TFile *storeFile = TFile::Open(store);
+        if (storeFile != nullptr && !storeFile->IsZombie()) {
+            TTree *tree = nullptr;
+            storeFile->GetObject(eventTreeName, tree);
+            entries = tree != nullptr ? tree->GetEntries() : -1;
+        }
+        delete storeFile;
+        std::string name = fileName(entries);
+        if (entries < 0 || access(name.c_str(), F_OK) != 0) {
+            return false;
+        }
+        TFile *file = TFile::Open(name.c_str());
+        TVectorD *state = nullptr;
+        TNamed *source = nullptr;
+        if (file != nullptr && !file->IsZombie()) {
+            file->GetObject("state", state);
+            file->GetObject("input", source);
+        }
+        bool good = state != nullptr && source != nullptr && state->GetNrows() == 4;
+        if (!good) {
+            std::cerr << name << " is not an ingest checkpoint, starting over" << std::endl;
+        }
+        else if (input != source->GetTitle() || (*state)[2] != totalEvents || (*state)[3] != selection) {
+            std::cerr << name << " belongs to another job (" << source->GetTitle() << "), starting over" << std::endl;
+            good = false;
+        }
+        else if ((*state)[1] != entries) {
+            std::cerr << name << " does not match the " << entries << " entries of " << store << ", starting over" << std::endl;
+            good = false;
+        }
+        else {
+            nextEvent = (*state)[0];
+            storeEntries = entries;
+            pendingNext = nextEvent;
+            pendingEntries = entries;
+        }
+        delete state;
+        delete source;
+        delete file;
+        return good;
+    }
+
+    // Adds the saved histograms into the added ones, call once on empty histograms
+    bool restore() {
+        std::string name = fileName(storeEntries);
+        TFile *file = TFile::Open(name.c_str());
+        if (file == nullptr || file->IsZombie()) {
+            std::cerr << "Could not open " << name << std::endl;
+            delete file;
+            return false;
+        }
+        bool good = true;
+        for (TH1 *histogram : histograms) {
+            TH1 *saved = nullptr;
+            file->GetObject(histogram->GetName(), saved);
+            if (saved == nullptr) {
+                std::cerr << name << " has no histogram " << histogram->GetName() << std::endl;
+                good = false;
+                break;
+            }
+            histogram->Add(saved);
+            delete saved;
+        }
+        file->Close();
+        delete file;
+        return good;
+    }
+
+    // Saves the histograms as they are and the position, before the store's checkpoint.  Until
+    // commit() the previous checkpoint stays.
+    bool save(Long64_t next, Long64_t entries) {
+        std::string name = fileName(entries);
+        std::string temporary = name + ".tmp";
+        TDirectory *current = gDirectory;
+        TFile *file = TFile::Open(temporary.c_str(), "RECREATE");
+        if (file == nullptr || file->IsZombie()) {
+            std::cerr << "Could not create " << temporary << std::endl;
+            delete file;
+            current->cd();
+            return false;
+        }
+        TVectorD state(4);
+        state[0] = next;
+        state[1] = entries;
+        state[2] = totalEvents;
+        state[3] = selection;
+        TNamed source("input", input.c_str());
+        bool good = file->WriteTObject(&state, "state") > 0 && file->WriteTObject(&source, "input") > 0;
+        for (TH1 *histogram : histograms) {
+            good = good && file->WriteTObject(histogram, histogram->GetName()) > 0;
+        }
+        file->Close();
+        delete file;
+        current->cd();
+        if (!good || rename(temporary.c_str(), name.c_str()) != 0) {
+            std::cerr << "Could not write checkpoint " << name << std::endl;
+            unlink(temporary.c_str());
+            return false;
+        }
+        if (pendingEntries != storeEntries && pendingEntries != entries) {
+            stale.push_back(pendingEntries);       // Saved but its store checkpoint failed
+        }
+        pendingNext = next;
+        pendingEntries = entries;
+        return true;
+    }
+
+    // Once the store holds the entries of the last save(), its checkpoint replaces the previous one
+    void commit() {
+        if (pendingEntries != storeEntries) {
+            unlink(fileName(storeEntries).c_str());
+        }
+        for (uint32_t i = 0; i < stale.size(); i++) {
+            unlink(fileName(stale[i]).c_str());
+        }
+        stale.clear();
+        nextEvent = pendingNext;
+        storeEntries = pendingEntries;
+    }
+
+    // Once the job has finished
+    void remove() {
+        unlink(fileName(storeEntries).c_str());
+        unlink(fileName(pendingEntries).c_str());
+        for (uint32_t i = 0; i < stale.size(); i++) {
+            unlink(fileName(stale[i]).c_str());
+        }
+    }
+
+    Long64_t nextEvent = 0;         // Of the input chain, as of the last commit()
+    Long64_t storeEntries = 0;
+
+private:
+    std::string base;
+    Long64_t pendingNext = 0;       // Saved, the store is not checkpointed yet
+    Long64_t pendingEntries = 0;
+    std::vector<Long64_t> stale;
+    std::string input;
+    Long64_t totalEvents;
+    double selection;
+    std::vector<TH1*> histograms;
+};
+
+#endif // INGEST_CHECKPOINT
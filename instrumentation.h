@@ -0,0 +1,198 @@
+/**
+ * \brief Timers, counters and peak memory of the stages.  A stage opens a
+ *        StageMetrics at its top; ScopedTimers inside it (and in helpers like
+ *        the event store loaders) add their wall time, events and bytes under
+ *        a name.  When the StageMetrics goes out of scope it prints a one line
+ *        summary and appends one JSON record to data/metrics.jsonl:
+ *
+ *            {"stage": "linearWeights", "pid": 1234, "start": 1760000000.0,
+ *             "wall_seconds": 12.3, "cpu_seconds": 11.9, "peak_rss_kb": 2150400,
+ *             "events": 10000000, "bytes": 1.36e+09, "events_per_second": 8.1e+05,
+ *             "timers": {"load_rings": {"calls": 1, "seconds": 2.1, "events": ..., "bytes": ...}, ...}}
+ *
+ *        EPD_METRICS names another file, EPD_METRICS=0 turns the records off.
+ *        Timers cost two clock reads and a locked map update when they close,
+ *        so they go around phases, never around single events.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#ifndef INSTRUMENTATION
+#define INSTRUMENTATION
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+
+struct TimerTotals {
+    uint64_t calls = 0;
+    double seconds = 0;
+    uint64_t events = 0;
+    double bytes = 0;
+};
+
+// Totals of every timer in the process, stages report the difference over their lifetime
+class Instrumentation {
+public:
+    static void record(const std::string &name, double seconds, uint64_t events, double bytes) {
+        std::lock_guard<std::mutex> guard(lock());
+        TimerTotals &totals = timers()[name];
+        totals.calls++;
+        totals.seconds += seconds;
+        totals.events += events;
+        totals.bytes += bytes;
+    }
+
+    static std::map<std::string, TimerTotals> snapshot() {
+        std::lock_guard<std::mutex> guard(lock());
+        return timers();
+    }
+
+    static double now() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Peak resident set of the process so far
+    static uint64_t peakRssKb() {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;     // kB on Linux
+    }
+
+    static double cpuSeconds() {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + 1e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+    }
+
+private:
+    static std::map<std::string, TimerTotals> &timers() {
+        static std::map<std::string, TimerTotals> totals;
+        return totals;
+    }
+
+    static std::mutex &lock() {
+        static std::mutex timerLock;
+        return timerLock;
+    }
+};
+
+// Adds the wall time between construction and destruction to the timer name
+class ScopedTimer {
+public:
+    ScopedTimer(const char *timerName, uint64_t numEvents = 0, double numBytes = 0)
+        : name(timerName), events(numEvents), bytes(numBytes), start(Instrumentation::now()) {}
+
+    ~ScopedTimer() {
+        Instrumentation::record(name, Instrumentation::now() - start, events, bytes);
+    }
+
+    // For counts only known once the work is done
+    void add(uint64_t numEvents, double numBytes = 0) {
+        events += numEvents;
+        bytes += numBytes;
+    }
+
+private:
+    std::string name;
+    uint64_t events;
+    double bytes;
+    double start;
+};
+
+class StageMetrics {
+public:
+    StageMetrics(const char *stageName)
+        : name(stageName), start(Instrumentation::now()), cpuStart(Instrumentation::cpuSeconds()),
+          timersAtStart(Instrumentation::snapshot()) {
+        wallClockStart = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    ~StageMetrics() {
+        double wall = Instrumentation::now() - start;
+        double cpu = Instrumentation::cpuSeconds() - cpuStart;
+        uint64_t peak = Instrumentation::peakRssKb();
+        printf("[%s] %.3g s wall, %.3g s cpu, peak RSS %.1f MB", name.c_str(), wall, cpu, peak / 1024.);
+        if (events > 0) {
+            printf(", %llu events at %.3g events/s", (unsigned long long)events, events / std::max(wall, 1e-9));
+        }
+        printf("\n");
+        fflush(stdout);
+        write(wall, cpu, peak);
+    }
+
+    // Events and bytes the stage as a whole processed
+    void addEvents(uint64_t numEvents, double numBytes = 0) {
+        events += numEvents;
+        bytes += numBytes;
+    }
+
+private:
+    std::string name;
+    double start;
+    double cpuStart;
+    double wallClockStart;
+    uint64_t events = 0;
+    double bytes = 0;
+    std::map<std::string, TimerTotals> timersAtStart;
+
+    void write(double wall, double cpu, uint64_t peak) {
+        const char *target = getenv("EPD_METRICS");
+        if (target != nullptr && strcmp(target, "0") == 0) {
+            return;
+        }
+        std::string record = "{\"stage\": \"" + name + "\"";
+        char buffer[512];
+        snprintf(buffer, sizeof(buffer),
+                 ", \"pid\": %d, \"start\": %.3f, \"wall_seconds\": %.6g, \"cpu_seconds\": %.6g, \"peak_rss_kb\": %llu"
+                 ", \"events\": %llu, \"bytes\": %.6g, \"events_per_second\": %.6g, \"bytes_per_second\": %.6g",
+                 getpid(), wallClockStart, wall, cpu, (unsigned long long)peak, (unsigned long long)events, bytes,
+                 events / std::max(wall, 1e-9), bytes / std::max(wall, 1e-9));
+        record += buffer;
+        record += ", \"timers\": {";
+        std::map<std::string, TimerTotals> timers = Instrumentation::snapshot();
+        bool first = true;
+        for (std::map<std::string, TimerTotals>::iterator t = timers.begin(); t != timers.end(); t++) {
+            TimerTotals before = timersAtStart[t->first];
+            if (t->second.calls == before.calls) {
+                continue;
+            }
+            snprintf(buffer, sizeof(buffer), "%s\"%s\": {\"calls\": %llu, \"seconds\": %.6g, \"events\": %llu, \"bytes\": %.6g}",
+                     first ? "" : ", ", t->first.c_str(), (unsigned long long)(t->second.calls - before.calls),
+                     t->second.seconds - before.seconds, (unsigned long long)(t->second.events - before.events),
+                     t->second.bytes - before.bytes);
+            record += buffer;
+            first = false;
+        }
+        record += "}}\n";
+
+        // One append per record, so stages running side by side never interleave lines
+        const char *fileName = target != nullptr ? target : "data/metrics.jsonl";
+        int descriptor = open(fileName, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (descriptor < 0) {
+            std::cerr << "Could not append metrics to " << fileName << std::endl;
+            return;
+        }
+        if (::write(descriptor, record.data(), record.size()) != (ssize_t)record.size()) {
+            std::cerr << "Could not append metrics to " << fileName << std::endl;
+        }
+        close(descriptor);
+    }
+};
+
+#endif // INSTRUMENTATION
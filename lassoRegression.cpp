@@ -1,6 +1,7 @@
 /**
  * \brief Generates the vector W using lasso 
- * regression to correlate the EPD nMIP data to the TPC multiplicity
+ * regression to correlate the EPD nMIP data to the TPC multiplicity.
+ * Solved by coordinate descent, see lasso::generateWeights
  * 
  * \author Tristan Protzman
  * \date September 30, 2020
@@ -11,7 +12,10 @@
 
 // #define DEBUG
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <vector>
 
 // Root headers
 #include "TCanvas.h"
@@ -23,90 +27,146 @@
 #include "TStyle.h"
 #include "TVectorD.h"
 
+#include "eventStore.h"
+#include "histogramEngine.h"
+#include "instrumentation.h"
+#include "resultSink.h"
+
+namespace lasso {
+
 const uint32_t dim = 17;
 
-// Takes the data matrix c and global vector g and generates 
-// weights relating the two using ridge regression
-TMatrixD* generateWeights(const TMatrixD *c, const TVectorD * g, float alpha) {
-    // c is the data matrix
-    // g is the response vector
-    TMatrixD *data = new TMatrixD(TMatrixD::kTransposed, *c);
-    TMatrixD *ones = new TMatrixD(data->GetNcols(), 1);
-    TMatrixD *mean = new TMatrixD(data->GetNrows(), 1);
-    
-    // Calculate the average of the data matrix;
-    for (uint32_t i = 0; i < ones->GetNrows(); i++) {
-        (*ones)[i][0] = 1;
+// Soft thresholding, the closed form minimum of one coordinate of the lasso objective
+double softThreshold(double value, double threshold) {
+    if (value > threshold) {
+        return value - threshold;
     }
-    mean->Mult(*data, *ones);
-    TMatrixD *centeringData = new TMatrixD(*mean, TMatrixD::kMult, TMatrixD(TMatrixD::kTransposed, *ones));
-    (*data) -= (*centeringData);    // Centering the data matrix
-
-    // Calculating the mean of the response vector
-    double avgResponse = 0;
-    for (uint32_t i = 0; i < g->GetNoElements(); i++) {
-        avgResponse += (*g)[i];
-    }
-    avgResponse /= g->GetNoElements();
-    std::cout << "Average Response: " << avgResponse << std::endl;
-    TMatrixD *response = new TMatrixD(g->GetNoElements(), 1);
-    for (uint32_t i = 0; i < g->GetNoElements(); i++) {
-        (*response)[i][0] = (*g)[i] - avgResponse;
+    if (value < -threshold) {
+        return value + threshold;
     }
+    return 0;
+}
 
-    // Set up initial random weights vector
-    TMatrixD *weights = new TMatrixD(data->GetNcols(), 1);
-    for (uint32_t i = 0; i < weights->GetNrows(), i++) {
-        (*weights)[i][0] = 0.1 * i; // MAKE RANDOM
+// Takes the data matrix c and global vector g and generates weights relating the two using
+// lasso regression, minimizing 1/2 |G - C^T W - W_17|^2 + alpha |W|_1 with the bias unpenalized.
+// Coordinate descent runs on the centered Gram matrix, so each sweep costs 16 x 16 rather than
+// a pass over the events.  Weights use the linear layout, rings 0 to 15 and the bias at 16.
+TMatrixD* generateWeights(const TMatrixD *c, const TVectorD *g, float alpha,
+                          double tolerance = 1e-8, uint32_t maxSweeps = 10000) {
+    ScopedTimer timer("lasso_weights", c->GetNcols());
+    const uint32_t rings = dim - 1;
+    uint32_t numEvents = c->GetNcols();
+    std::cerr << "Processings " << numEvents << " events.\n";
+
+    // Means of the rings and the response
+    std::vector<double> mean(rings, 0);
+    double meanResponse = 0;
+    const double *data = c->GetMatrixArray();
+    const double *response = g->GetMatrixArray();
+    for (uint32_t r = 0; r < rings; r++) {
+        const double *ring = data + r * numEvents;
+        for (uint32_t j = 0; j < numEvents; j++) {
+            mean[r] += ring[j];
+        }
+        mean[r] /= numEvents;
     }
+    for (uint32_t j = 0; j < numEvents; j++) {
+        meanResponse += response[j];
+    }
+    meanResponse /= numEvents;
+
+    // A_{q, t} = sum_j (C_{q, j} - <C_q>)(C_{t, j} - <C_t>), B_t = sum_j (G_j - <G>)(C_{t, j} - <C_t>)
+    TMatrixD a(rings, rings);
+    std::vector<double> b(rings, 0);
+    for (uint32_t q = 0; q < rings; q++) {
+        const double *ringQ = data + q * numEvents;
+        for (uint32_t t = q; t < rings; t++) {
+            const double *ringT = data + t * numEvents;
+            double sum = 0;
+            for (uint32_t j = 0; j < numEvents; j++) {
+                sum += (ringQ[j] - mean[q]) * (ringT[j] - mean[t]);
+            }
+            a(q, t) = sum;
+            a(t, q) = sum;
+        }
+        for (uint32_t j = 0; j < numEvents; j++) {
+            b[q] += (response[j] - meanResponse) * (ringQ[j] - mean[q]);
+        }
+    }
+    std::cout << "Generated A and B" << std::endl;
+
+    // Sweep the coordinates until no weight moves by more than tolerance of the largest weight
+    std::vector<double> weights(rings, 0);
+    uint32_t sweep = 0;
+    for (; sweep < maxSweeps; sweep++) {
+        double largestChange = 0;
+        double largestWeight = 0;
+        for (uint32_t t = 0; t < rings; t++) {
+            if (a(t, t) <= 0) {
+                continue;   // A ring with no signal keeps a zero weight
+            }
+            double rho = b[t];
+            for (uint32_t q = 0; q < rings; q++) {
+                if (q != t) {
+                    rho -= a(t, q) * weights[q];
+                }
+            }
+            double updated = softThreshold(rho, alpha) / a(t, t);
+            largestChange = std::max(largestChange, std::abs(updated - weights[t]));
+            largestWeight = std::max(largestWeight, std::abs(updated));
+            weights[t] = updated;
+        }
+        if (largestChange <= tolerance * std::max(largestWeight, 1.)) {
+            break;
+        }
+    }
+    std::cout << "Coordinate descent finished after " << sweep + 1 << " sweeps" << std::endl;
 
-    // main weights loop
-    double weightDelta = 100000;
-    double epsilon = 0.5;
-    while 
-
-    
-    return nullptr;
+    TMatrixD *result = new TMatrixD(dim, 1);
+    (*result)[dim - 1][0] = meanResponse;
+    for (uint32_t t = 0; t < rings; t++) {
+        (*result)[t][0] = weights[t];
+        (*result)[dim - 1][0] -= weights[t] * mean[t];
+    }
+    return result;
 }
 
-
 // Uses the generated weights and the truncated nMIPs data to predict TPC multiplicity
-// X_t = sum_r W_r * C_{r, t}
+// X_t = sum_r W_r * C_{r, t} + W_17
 TVectorD* predictTPCMultiplicity(TMatrixD *weights, TMatrixD *epdData) {
+    ScopedTimer timer("lasso_predict", epdData->GetNcols());
     uint32_t numEvents = epdData->GetNcols();
     TVectorD *predictedTCPMultiplicity = new TVectorD(numEvents);   // Store our guesses
     for (uint32_t i = 0; i < numEvents; i++) {
-        if (i%100 == 0) {
-            // std::cout << "Working on event " << i << "/" << numEvents << std::endl;
-        }
-        (*predictedTCPMultiplicity)[i] = 0;//(*weights)[0][0]; // Add the bias
+        (*predictedTCPMultiplicity)[i] = (*weights)[dim - 1][0]; // Add the bias
         for (uint32_t j = 0; j < dim - 1; j++) {
-            (*predictedTCPMultiplicity)[i] += (*epdData)[j][i] * (*weights)[j + 1][0]; // Add the weighted input
+            (*predictedTCPMultiplicity)[i] += (*epdData)[j][i] * (*weights)[j][0]; // Add the weighted input
         }
     }
-    // predictedTCPMultiplicity->Print();
     return predictedTCPMultiplicity;
 }
 
+} // namespace lasso
+
 void lassoRegression(const char *inFileName = "data/detector_data.root", float alpha=1e7) {
+    StageMetrics metrics("lassoRegression");
     std::cout << "Running..." <<std::endl;
     
-    TFile inFile(inFileName);
-    TMatrixD *c;
-    TVectorD *g;
-    inFile.GetObject("ring_sums", c);           // should probably check for existance but...
-    inFile.GetObject("tpc_multiplicity", g);
+    TMatrixD *c = loadRingSums(inFileName);
+    TVectorD *g = loadColumn(inFileName, "tpc_multiplicity");
+    if (c == nullptr || g == nullptr) {
+        return;
+    }
+    metrics.addEvents(c->GetNcols(), c->GetNcols() * 17. * sizeof(double));
 
     std::cout << "Generating Weights.." << std::endl;
-    TMatrixD *weights = generateWeights(c, g, alpha);
-    return;
+    TMatrixD *weights = lasso::generateWeights(c, g, alpha);
     std::cout << "Weights Generated" << std::endl;
     std::cout << "Weights:\n";
     weights->Print();
 
     std::cout << "Applying linear weights..." << std::endl;
-    TVectorD *predictions = predictTPCMultiplicity(weights, c);
-    inFile.Close();
+    TVectorD *predictions = lasso::predictTPCMultiplicity(weights, c);
 
 
     uint32_t predictBins = 200;
@@ -117,18 +177,17 @@ void lassoRegression(const char *inFileName = "data/detector_data.root", float a
     int32_t realMin = 0;
     int32_t realMax = 350; 
     
-    TH2D *ridge_histogram = new TH2D(Form("alpha=%f", alpha), Form("alpha=%f;TPC RefMult;Ridge Regression Prediction", alpha),
-                                  realBins, realMin, realMax,
-                                  predictBins, predictMin, predictMax);
-    for (uint32_t i = 0; i < g->GetNrows(); i++) {
-        ridge_histogram->Fill((*g)[i], (*predictions)[i]);
+    Histogram2D counts(realBins, realMin, realMax, predictBins, predictMin, predictMax);
+    {
+        ScopedTimer timer("fill_histograms", g->GetNrows());
+        counts.fill(g->GetMatrixArray(), predictions->GetMatrixArray(), g->GetNrows());
     }
+    TH2D *lasso_histogram = counts.toTH2D(Form("lasso_alpha=%f", alpha), Form("alpha=%f;TPC RefMult;Lasso Regression Prediction", alpha));
     
-    TFile outFile("data/epd_tpc_relations.root", "UPDATE");
-    outFile.mkdir("methods", "methods", true);
-    outFile.cd("methods");
-    ridge_histogram->Write(Form("ridge_%f_detector", alpha));
-    outFile.Close();
+    ResultSink sink("data/epd_tpc_relations.root", Form("lasso_%.0e", alpha));
+    sink.add("methods", Form("lasso_%.0e", alpha), lasso_histogram);
+    sink.add("methods", Form("lasso_%.0e_weights", alpha), weights);
+    sink.commit();
 
     bool draw = false;
     if (!draw) {
@@ -144,7 +203,7 @@ void lassoRegression(const char *inFileName = "data/detector_data.root", float a
 
     TCanvas *canvas = new TCanvas("canvas", "canvas", 1000, 1000);
     gPad->SetLogz();
-    ridge_histogram->Draw("Colz");
+    lasso_histogram->Draw("Colz");
 
     std::cout << "Plotted " << g->GetNrows() << " events\n";
 }
\ No newline at end of file
@@ -25,135 +25,51 @@
 #include "TStyle.h"
 #include "TVectorD.h"
 
+#include "eventStore.h"
+#include "gram.h"
+#include "histogramEngine.h"
+#include "instrumentation.h"
+#include "resultSink.h"
 
-const uint32_t dim = 17;
 
-// (Step 1) A_{q, t}   = \sum_j=1^Nevents C_{q, j} C{t, j}
-// (Step 2) A_{17, t}  = \sum_j=1^Nevents C_{t, j}
-// (Step 3) A_{17, 17} = Nevents
-
-// (Step 4) B_t  = \sum_j=1^Nevents G_j C{t, j}
-// (Step 5) B_17 = \sum_j=1^Nevents G_j
-
-
-// Takes the matrix C and the vector G and generates the weight vector W
-TMatrixD* generateWeights (const TMatrixD *c, const TVectorD *g) {
-    TMatrixD *a = new TMatrixD(dim, dim);    // Creates a double precision matrix
-    TMatrixD *b = new TMatrixD(dim, 1);
-    int32_t numEvents = c->GetNcols();
-
-    std::cerr << "Processings " << numEvents << " events.\n";
-
-    // Generating A
-    // Step 1
-    std::cout << "Generating A..." << std::endl;
-    for (uint32_t q = 0; q < dim - 1; q++) {
-        for (uint32_t t = 0; t < dim - 1; t++) {
-            (*a)[q][t] = 0; // likely not needed
-            for (uint32_t j = 0; j < numEvents; j++) {
-                (*a)[q][t] += (*c)[q][j] * (*c)[t][j];
-            }
-        }
-    }
-
-    // Step 2
-    for (uint32_t t = 0; t < dim - 1; t++) {
-        for (uint32_t j = 0; j < numEvents; j++) {
-            (*a)[dim - 1][t] += (*c)[t][j];
-            (*a)[t][dim - 1] += (*c)[t][j];
-        }
-    }
-
-    // Step 3
-    (*a)[dim -1][dim -1] = numEvents;
-
-    std::cout << "Generated A" << std::endl;
-
-    // Step 4
-    for (uint32_t t = 0; t < dim - 1; t++) {
-        (*b)[t][0] = 0;
-        for (uint32_t j = 0; j < numEvents; j++) {
-            (*b)[t][0] += (*g)[j] * (*c)[t][j];
-        }
-    }
-
-    // Step 5
-    for (uint32_t j = 0; j < numEvents; j++) {
-        (*b)[dim - 1][0] += (*g)[j];
-    }
-
-    std::cout << "Generated B" << std::endl;
-    
-    // Debug printing
-    #ifdef DEBUG
-    std::cout << "A:\n";
-    a->Print();
-    std::cout << "\n\nB:\n";
-    b->Print();
-    #endif // DEBUG
-
-    // std::cout << "\n\n\nA:\n";
-    // for (uint32_t i = 0; i < 17; i++) {
-    //     for (uint32_t j = 0; j < 17; j++) {
-    //         std::cout << (*a)[i][j] << ", ";
-    //     }
-    //     std::cout << std::endl;
-    //     std::cout << (*b)[i][0] << ", ";
-    // }
-    // std::cout << "\n\n\n";
-
-    // Inverting A to solve Ax=B for x
-    std::cout << "Inverting A" << std::endl;
-    a->Invert();
-    TMatrixD *weights = new TMatrixD(17, 1);
-    weights->Mult(*a, *b);
-    
-
-    #ifdef DEBUG
-    std::cout << "A Inverted:\n";
-    a->Print();
-    #endif // DEBUG
-
-    
-    return weights;
-}
-
-// Uses the generated weights and the truncated nMIPs data to predict TPC multiplicity
-// X_t = sum_r W_r * C_{r, t} + W_17
-TVectorD* predictTPCMultiplicity(TMatrixD *weights, TMatrixD *epdData) {
-    uint32_t numEvents = epdData->GetNcols();
-    TVectorD *predictedTCPMultiplicity = new TVectorD(numEvents);   // Store our guesses
-    for (uint32_t i = 0; i < numEvents; i++) {
-        // if (i%100 == 0) {
-        //     std::cout << "Working on event " << i << "/" << numEvents << std::endl;
-        // }
-        (*predictedTCPMultiplicity)[i] = (*weights)[16][0]; // Add the bias
-        for (uint32_t j = 0; j < 16; j++) {
-            (*predictedTCPMultiplicity)[i] += (*epdData)[j][i] * (*weights)[j][0]; // Add the weighted input
-        }
-    }
-    // predictedTCPMultiplicity->Print();
-    return predictedTCPMultiplicity;
-}
-
-void linearWeights(const char *inFileName = "data/detector_data.root") {
+void linearWeights(const char *inFileName = "data/detector_data.root",
+                   const char *outFileName = "data/epd_tpc_relations.root") {
+    StageMetrics metrics("linearWeights");
     std::cout << "Running..." <<std::endl;
     
-    TFile inFile(inFileName);
-    TMatrixD *c;
-    TVectorD *g;
-    inFile.GetObject("ring_sums", c);           // should probably check for existance but...
-    inFile.GetObject("tpc_multiplicity", g);
+    // Floats straight from the ring cache, the sums are done in double (gram.h)
+    FloatRingSums data;
+    if (!loadFloatRingSums(inFileName, data)) {
+        return;
+    }
+    uint64_t numEvents = data.numEvents;
+    metrics.addEvents(numEvents, numEvents * (16. * sizeof(float) + sizeof(uint16_t)));
 
     std::cout << "Generating Weights.." << std::endl;
-    TMatrixD *weights = generateWeights(c, g);
+    double solution[gramDim];
+    {
+        ScopedTimer timer("linear_weights", numEvents);
+        WeightedGram gram = floatGram(data.rings, data.tpc, numEvents);
+        if (!gram.solve(solution)) {
+            std::cerr << "Gram matrix is not positive definite" << std::endl;
+            return;
+        }
+    }
+    TMatrixD *weights = gramWeightMatrix(solution);
     std::cout << "Weights Generated" << std::endl;
     std::cout << "Weights:\n";
     weights->Print();
 
     std::cout << "Applying linear weights..." << std::endl;
-    TVectorD *predictions = predictTPCMultiplicity(weights, c);
-    inFile.Close();
+    TVectorD *predictions = new TVectorD(numEvents);
+    TVectorD *g = new TVectorD(numEvents);
+    {
+        ScopedTimer timer("linear_predict", numEvents);
+        predictFromFloats(solution, data.rings, numEvents, predictions->GetMatrixArray());
+        for (uint64_t j = 0; j < numEvents; j++) {
+            (*g)[j] = data.tpc[j];
+        }
+    }
 
     // Everything from here down is plotting
 
@@ -170,15 +86,13 @@ void linearWeights(const char *inFileName = "data/detector_data.root") {
     int32_t realMin = 0;
     int32_t realMax = 350;
 
-    TH2D *predictVsReal = new TH2D("linear_simulated", "2D Histo;RefMult1;X_{#zeta'}",
-                                  realBins, realMin, realMax,
-                                  predictBins, predictMin, predictMax);
-    predictVsReal->SetTitle("X_{#zeta'} vs RefMult1, 7.7 GeV, TOF Selected");
-
-
-    for (uint32_t i = 0; i < g->GetNrows(); i++) {
-        predictVsReal->Fill((*g)[i], (*predictions)[i]);
+    Histogram2D counts(realBins, realMin, realMax, predictBins, predictMin, predictMax);
+    {
+        ScopedTimer timer("fill_histograms", g->GetNrows());
+        counts.fill(g->GetMatrixArray(), predictions->GetMatrixArray(), g->GetNrows());
     }
+    TH2D *predictVsReal = counts.toTH2D("linear_simulated", "2D Histo;RefMult1;X_{#zeta'}");
+    predictVsReal->SetTitle("X_{#zeta'} vs RefMult1, 7.7 GeV, TOF Selected");
 
 
     bool draw = true;
@@ -190,10 +104,8 @@ void linearWeights(const char *inFileName = "data/detector_data.root") {
 
     std::cout << "Plotted " << g->GetNrows() << " events\n";
 
-    TFile outFile("data/epd_tpc_relations.root", "UPDATE");
-    outFile.mkdir("methods", "methods", true);
-    outFile.cd("methods");
-    weights->Write("linear_weights");
-    predictVsReal->Write("linear");
-    outFile.Close();
+    ResultSink sink(outFileName, "linear");
+    sink.add("methods", "linear_weights", weights);
+    sink.add("methods", "linear", predictVsReal);
+    sink.commit();
 }
\ No newline at end of file
@@ -29,10 +29,15 @@
 #include "TMatrixDUtils.h"
 #include "TVectorDfwd.h"
 
+#include "eventStore.h"
+#include "histogramEngine.h"
+#include "instrumentation.h"
+#include "resultSink.h"
+
+
+namespace outerRings {
 
 const uint32_t real_dim = 17;
-const uint32_t inner_ring = 7;
-const uint32_t dim = real_dim - inner_ring;
 
 // (Step 1) A_{q, t}   = \sum_j=1^Nevents C_{q, j} C{t, j}
 // (Step 2) A_{17, t}  = \sum_j=1^Nevents C_{t, j}
@@ -42,8 +47,11 @@ const uint32_t dim = real_dim - inner_ring;
 // (Step 5) B_17 = \sum_j=1^Nevents G_j
 
 
-// Takes the matrix C and the vector G and generates the weight vector W
-TMatrixD* generateWeights (const TMatrixD *c, const TVectorD *g) {
+// Takes the matrix C and the vector G and generates the weight vector W from the rings at and
+// beyond inner_ring, the weights of the rings inside it are zero
+TMatrixD* generateWeights (const TMatrixD *c, const TVectorD *g, uint32_t inner_ring) {
+    ScopedTimer timer("outerRings_weights", c->GetNcols());
+    const uint32_t dim = real_dim - inner_ring;
     TMatrixD *a = new TMatrixD(dim, dim);    // Creates a double precision matrix
     TMatrixD *b = new TMatrixD(dim, 1);
     int32_t numEvents = c->GetNcols();
@@ -133,6 +141,7 @@ TMatrixD* generateWeights (const TMatrixD *c, const TVectorD *g) {
 // Uses the generated weights and the truncated nMIPs data to predict TPC multiplicity
 // X_t = sum_r W_r * C_{r, t} + W_17
 TVectorD* predictTPCMultiplicity(TMatrixD *weights, TMatrixD *epdData) {
+    ScopedTimer timer("outerRings_predict", epdData->GetNcols());
     uint32_t numEvents = epdData->GetNcols();
     TVectorD *predictedTCPMultiplicity = new TVectorD(numEvents);   // Store our guesses
     for (uint32_t i = 0; i < numEvents; i++) {
@@ -148,31 +157,39 @@ TVectorD* predictTPCMultiplicity(TMatrixD *weights, TMatrixD *epdData) {
     return predictedTCPMultiplicity;
 }
 
-void outerRingsLinearWeights(const char *inFileName = "data/detector_data.root") {
+} // namespace outerRings
+
+void outerRingsLinearWeights(const char *inFileName = "data/detector_data.root", uint32_t innerRing = 7,
+                             const char *outFileName = "data/epd_tpc_relations.root") {
+    StageMetrics metrics("outerRingsLinearWeights");
     std::cout << "Running..." <<std::endl;
+    if (innerRing == 0 || innerRing >= outerRings::real_dim - 1) {
+        std::cerr << "innerRing has to be between 1 and " << outerRings::real_dim - 2 << std::endl;
+        return;
+    }
     
-    TFile inFile(inFileName);
-    TMatrixD *c;
-    TVectorD *g;
-    inFile.GetObject("ring_sums", c);           // should probably check for existance but...
-    inFile.GetObject("tpc_multiplicity", g);
-    TMatrixD *detector_sums;
-    TVectorD *detector_refmult;
-    TFile detector("data/detector_data.root");
-    detector.GetObject("ring_sums", detector_sums);
+    TMatrixD *c = loadRingSums(inFileName);
+    TVectorD *g = loadColumn(inFileName, "tpc_multiplicity");
+    if (c == nullptr || g == nullptr) {
+        return;
+    }
+    metrics.addEvents(c->GetNcols(), c->GetNcols() * 17. * sizeof(double));
+    TMatrixD *detector_sums = loadRingSums("data/detector_data.root");
+    if (detector_sums == nullptr) {
+        return;
+    }
 
 
     std::cout << "Generating Weights.." << std::endl;
-    TMatrixD *weights = generateWeights(c, g);
+    TMatrixD *weights = outerRings::generateWeights(c, g, innerRing);
     std::cout << "Weights Generated" << std::endl;
     std::cout << "Weights:\n";
     weights->Print();
 
     std::cout << "Applying linear weights..." << std::endl;
-    TVectorD *predictions = predictTPCMultiplicity(weights, detector_sums);
-    inFile.Close();
-    detector.GetObject("tpc_multiplicity", g);
-    detector.Close();
+    TVectorD *predictions = outerRings::predictTPCMultiplicity(weights, detector_sums);
+    delete g;
+    g = loadColumn("data/detector_data.root", "tpc_multiplicity");
     
 
     // Everything from here down is plotting
@@ -190,15 +207,13 @@ void outerRingsLinearWeights(const char *inFileName = "data/detector_data.root")
     int32_t realMin = 0;
     int32_t realMax = 350;
 
-    TH2D *predictVsReal = new TH2D("linear_simulated", "2D Histo;RefMult1;X_{#zeta'}",
-                                  realBins, realMin, realMax,
-                                  predictBins, predictMin, predictMax);
-    predictVsReal->SetTitle("X_{#zeta'} vs RefMult1, 7.7 GeV, TOF Selected, Outer 9 Rings");
-
-
-    for (uint32_t i = 0; i < g->GetNrows(); i++) {
-        predictVsReal->Fill((*g)[i], (*predictions)[i]);
+    Histogram2D counts(realBins, realMin, realMax, predictBins, predictMin, predictMax);
+    {
+        ScopedTimer timer("fill_histograms", g->GetNrows());
+        counts.fill(g->GetMatrixArray(), predictions->GetMatrixArray(), g->GetNrows());
     }
+    TH2D *predictVsReal = counts.toTH2D("linear_outer", "2D Histo;RefMult1;X_{#zeta'}");
+    predictVsReal->SetTitle(Form("X_{#zeta'} vs RefMult1, 7.7 GeV, TOF Selected, Outer %u Rings", 16 - innerRing));
 
 
     bool draw = true;
@@ -210,10 +225,8 @@ void outerRingsLinearWeights(const char *inFileName = "data/detector_data.root")
 
     std::cout << "Plotted " << g->GetNrows() << " events\n";
 
-    TFile outFile("data/epd_tpc_relations.root", "UPDATE");
-    outFile.mkdir("methods", "methods", true);
-    outFile.cd("methods");
-    weights->Write("linear_weights_outer");
-    predictVsReal->Write("linear");
-    outFile.Close();
+    ResultSink sink(outFileName, "linear_outer");
+    sink.add("methods", "linear_outer_weights", weights);
+    sink.add("methods", "linear_outer", predictVsReal);
+    sink.commit();
 }
\ No newline at end of file
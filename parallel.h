@@ -0,0 +1,40 @@
+#ifndef PARALLEL
+#define PARALLEL
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <thread>
+#include <vector>
+
+// Number of worker threads, the hardware concurrency unless EPD_THREADS is set
+inline uint32_t defaultThreads() {
+    const char *requested = getenv("EPD_THREADS");
+    if (requested != nullptr && atoi(requested) > 0) {
+        return atoi(requested);
+    }
+    uint32_t hardware = std::thread::hardware_concurrency();
+    return hardware > 0 ? hardware : 1;
+}
+
+// Splits [0, n) into one contiguous chunk per thread and calls work(begin, end, thread).
+// Chunks are handed out in order, so thread t always sees events before thread t + 1.
+template <typename Work>
+void parallelFor(uint64_t n, uint32_t nThreads, Work work) {
+    if (nThreads <= 1 || n < nThreads) {
+        work(uint64_t(0), n, uint32_t(0));
+        return;
+    }
+    std::vector<std::thread> threads;
+    uint64_t chunk = (n + nThreads - 1) / nThreads;
+    for (uint32_t t = 0; t < nThreads; t++) {
+        uint64_t begin = t * chunk < n ? t * chunk : n;
+        uint64_t end = begin + chunk < n ? begin + chunk : n;
+        threads.push_back(std::thread(work, begin, end, t));
+    }
+    for (uint32_t t = 0; t < nThreads; t++) {
+        threads[t].join();
+    }
+}
+
+#endif // PARALLEL
@@ -0,0 +1,127 @@
+/**
+ * \brief Linear weights fitted separately for every run, since detector
+ *        conditions drift over a beam energy's running.  One multithreaded pass
+ *        accumulates a Gram matrix per run_id (groupedGram in gram.h), then all
+ *        runs are solved in parallel.  Runs with fewer than minEvents events, or
+ *        whose matrix is singular, keep the weights fitted to all events.
+ *
+ *        The run -> weights table goes to methods/linear_per_run_table (see
+ *        runWeights.h) and the prediction with each event's run weights to
+ *        methods/linear_per_run, next to the other methods.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#include <string.h>
+
+#include <iostream>
+#include <map>
+#include <vector>
+
+// Root headers
+#include "TH2D.h"
+#include "TMatrixD.h"
+#include "TROOT.h"
+#include "TVectorD.h"
+
+#include "eventStore.h"
+#include "gram.h"
+#include "histogramEngine.h"
+#include "instrumentation.h"
+#include "parallel.h"
+#include "resultSink.h"
+#include "runWeights.h"
+
+void perRunWeights(const char *inFileName = "data/detector_data.root",
+                   const char *outFileName = "data/epd_tpc_relations.root", uint32_t minEvents = 10000) {
+    StageMetrics metrics("perRunWeights");
+    if (!eventStoreHasColumn(inFileName, "run_id")) {
+        std::cerr << inFileName << " has no run_id column, it was ingested before runs were stored" << std::endl;
+        return;
+    }
+    TMatrixD *c = loadRingSums(inFileName);
+    TVectorD *g = loadColumn(inFileName, "tpc_multiplicity");
+    TVectorD *runColumn = loadColumn(inFileName, "run_id");
+    if (c == nullptr || g == nullptr || runColumn == nullptr) {
+        return;
+    }
+    uint64_t numEvents = c->GetNcols();
+    metrics.addEvents(numEvents, numEvents * 18. * sizeof(double));
+    std::vector<uint32_t> eventRuns(numEvents);
+    for (uint64_t j = 0; j < numEvents; j++) {
+        eventRuns[j] = (*runColumn)[j];
+    }
+
+    uint32_t nThreads = defaultThreads();
+    std::map<uint32_t, WeightedGram> grams;
+    {
+        ScopedTimer timer("grouped_gram", numEvents);
+        grams = groupedGram(c, g, eventRuns.data(), nullptr, nThreads);
+    }
+
+    // Row 0 of the table is every event together, the fallback
+    std::vector<uint32_t> runIds(1, 0);
+    std::vector<const WeightedGram *> runGrams(1, nullptr);
+    WeightedGram all;
+    for (std::map<uint32_t, WeightedGram>::iterator run = grams.begin(); run != grams.end(); run++) {
+        all.add(run->second);
+        if (run->first != 0) {
+            runIds.push_back(run->first);
+            runGrams.push_back(&run->second);
+        }
+    }
+    std::vector<double> runWeights(runIds.size() * gramDim);
+    if (!all.solve(&runWeights[0])) {
+        std::cerr << "Gram matrix of all events is singular" << std::endl;
+        return;
+    }
+
+    // Runs are independent, each thread solves a contiguous share of them
+    std::vector<uint8_t> fallback(runIds.size(), 0);
+    {
+        ScopedTimer timer("solve_runs", runIds.size() - 1);
+        parallelFor(runIds.size() - 1, nThreads, [&](uint64_t begin, uint64_t end, uint32_t thread) {
+            for (uint64_t i = begin + 1; i < end + 1; i++) {
+                double *solution = &runWeights[i * gramDim];
+                if (runGrams[i]->events < minEvents || !runGrams[i]->solve(solution)) {
+                    memcpy(solution, &runWeights[0], gramDim * sizeof(double));
+                    fallback[i] = 1;
+                }
+            }
+        });
+    }
+    uint32_t fallbacks = 0;
+    for (uint32_t i = 1; i < runIds.size(); i++) {
+        fallbacks += fallback[i];
+    }
+    std::cout << "Fitted " << runIds.size() - 1 - fallbacks << " runs, " << fallbacks
+              << " with fewer than " << minEvents << " events or a singular matrix use the global weights" << std::endl;
+
+    TMatrixD *table = RunWeightTable::toMatrix(runIds, runWeights);
+    RunWeightTable lookup(*table);
+    TVectorD *predictions = lookup.predict(c, eventRuns.data(), nThreads);
+
+    uint32_t predictBins = 200;
+    int32_t predictMin = -100;
+    int32_t predictMax = 300;
+
+    uint32_t realBins = 175;
+    int32_t realMin = 0;
+    int32_t realMax = 350;
+
+    Histogram2D counts(realBins, realMin, realMax, predictBins, predictMin, predictMax);
+    {
+        ScopedTimer timer("fill_histograms", numEvents);
+        counts.fill(g->GetMatrixArray(), predictions->GetMatrixArray(), numEvents);
+    }
+    TH2D *predictVsReal = counts.toTH2D("linear_per_run", "X_{#zeta'} vs RefMult1, weights per run;RefMult1;X_{#zeta'}");
+
+    ResultSink sink(outFileName, "linear_per_run");
+    sink.add("methods", "linear_per_run", predictVsReal);
+    sink.add("methods", "linear_per_run_table", table);
+    sink.commit();
+}
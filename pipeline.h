@@ -0,0 +1,431 @@
+/**
+ * \brief Runs the stages of flow.md as a DAG with cached outputs.  A stage
+ *        declares the files it reads and writes; a stage reading a file that
+ *        another stage writes depends on it.  Each stage gets a key hashed
+ *        from its name, parameters, source files and every local header they
+ *        include (followed recursively), the keys of the stages it depends on
+ *        and the content of its external inputs.  A stage whose
+ *        key matches the one stored after its last successful run, and whose
+ *        outputs all exist, is skipped (its restore callback runs instead).
+ *        The rest run in forked processes, up to nJobs at a time, as soon as
+ *        everything they depend on has finished.
+ *
+ *        The macros return early on failure and the child always exits 0, so a
+ *        stage only succeeds if every output was written after it started.  Its
+ *        old outputs are removed before it runs, except for a resumable stage
+ *        (an ingest that picks up its own checkpoint), whose outputs must still
+ *        be newer than the start.
+ *
+ *        Keys live in <stampDirectory>/<stage>.key.  Content hashes of large
+ *        external inputs are remembered per size and time stamp in
+ *        <stampDirectory>/inputs so unchanged files are not read again.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#ifndef PIPELINE
+#define PIPELINE
+
+#include <TROOT.h>
+#include <TSystem.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "batchRender.h"        // hashBytes, hashString
+#include "ringSumCache.h"       // fileChecksum, sourceStatus
+
+struct PipelineStage {
+    std::string name;
+    std::vector<std::string> inputs;
+    std::vector<std::string> outputs;
+    std::vector<std::string> sources;       // Code of the stage, part of the key
+    std::vector<std::pair<std::string, std::string>> parameters;
+    std::function<void()> run;
+    std::function<void()> restore;          // Optional, called instead of run when the outputs are current
+    bool resumable = false;                 // Continues from its existing outputs, they are not removed
+
+    PipelineStage(const char *stageName) : name(stageName) {}
+
+    PipelineStage &parameter(const char *parameterName, const std::string &value) {
+        parameters.push_back(std::make_pair(std::string(parameterName), value));
+        return *this;
+    }
+};
+
+class Pipeline {
+public:
+    Pipeline(const char *stampDirectory = "data/.pipeline", const char *sourceDirectory = ".")
+        : stamps(stampDirectory), sourceRoot(sourceDirectory) {}
+
+    void add(const PipelineStage &stage) {
+        stages.push_back(stage);
+    }
+
+    // Runs every stage that is out of date, or all of them with force.  Returns false if any failed.
+    bool run(uint32_t nJobs, bool force = false) {
+        gSystem->mkdir(stamps.c_str(), true);
+        std::vector<std::vector<uint32_t>> dependencies;
+        if (!resolve(dependencies)) {
+            return false;
+        }
+        loadInputHashes();
+
+        // Keys in dependency order, a stage's key includes the keys of its dependencies
+        std::vector<uint32_t> order;
+        if (!topologicalOrder(dependencies, order)) {
+            return false;
+        }
+        std::vector<uint64_t> keys(stages.size(), 0);
+        for (uint32_t o = 0; o < order.size(); o++) {
+            uint32_t s = order[o];
+            keys[s] = stageKey(s, dependencies[s], keys);
+        }
+        saveInputHashes();
+
+        // 0 waiting, 1 running, 2 done, 3 failed
+        std::vector<int32_t> state(stages.size(), 0);
+        std::map<pid_t, uint32_t> running;
+        std::vector<int64_t> started(stages.size(), 0);
+        uint32_t finished = 0;
+        bool good = true;
+        while (finished < stages.size()) {
+            bool progress = false;
+            for (uint32_t s = 0; s < stages.size(); s++) {
+                if (state[s] != 0) {
+                    continue;
+                }
+                int32_t ready = 2;
+                for (uint32_t d = 0; d < dependencies[s].size(); d++) {
+                    ready = std::min(ready, state[dependencies[s][d]] == 3 ? -1 : state[dependencies[s][d]] == 2 ? 2 : 0);
+                }
+                if (ready < 0) {
+                    std::cerr << "[" << stages[s].name << "] skipped, a dependency failed" << std::endl;
+                    state[s] = 3;
+                    finished++;
+                    good = false;
+                    progress = true;
+                    continue;
+                }
+                if (ready == 0) {
+                    continue;
+                }
+                if (!force && upToDate(s, keys[s])) {
+                    std::cout << "[" << stages[s].name << "] up to date" << std::endl;
+                    if (stages[s].restore) {
+                        stages[s].restore();
+                    }
+                    state[s] = 2;
+                    finished++;
+                    progress = true;
+                    continue;
+                }
+                if (running.size() >= nJobs) {
+                    continue;
+                }
+                std::cout << "[" << stages[s].name << "] running" << std::endl;
+                if (!prepareOutputs(s, started[s])) {
+                    state[s] = 3;
+                    finished++;
+                    good = false;
+                    progress = true;
+                    continue;
+                }
+                fflush(stdout);
+                fflush(stderr);
+                pid_t child = fork();
+                if (child == 0) {
+                    gROOT->SetBatch(kTRUE);
+                    stages[s].run();
+                    fflush(stdout);
+                    fflush(stderr);
+                    _exit(0);
+                }
+                if (child < 0) {
+                    std::cerr << "[" << stages[s].name << "] could not fork" << std::endl;
+                    state[s] = 3;
+                    finished++;
+                    good = false;
+                    progress = true;
+                    continue;
+                }
+                running[child] = s;
+                state[s] = 1;
+                progress = true;
+            }
+            if (progress) {
+                continue;
+            }
+            if (running.empty()) {
+                std::cerr << "Pipeline stalled" << std::endl;
+                return false;
+            }
+
+            // Wait for any stage, a stage succeeded if it exited cleanly and wrote all its outputs anew
+            int status = 0;
+            pid_t child = waitpid(-1, &status, 0);
+            if (child < 0 || running.find(child) == running.end()) {
+                continue;
+            }
+            uint32_t s = running[child];
+            running.erase(child);
+            finished++;
+            std::string missing = staleOutput(s, started[s]);
+            if (WIFEXITED(status) && WEXITSTATUS(status) == 0 && missing.empty()) {
+                writeKey(s, keys[s]);
+                state[s] = 2;
+                std::cout << "[" << stages[s].name << "] done" << std::endl;
+            }
+            else {
+                state[s] = 3;
+                good = false;
+                std::cerr << "[" << stages[s].name << "] failed"
+                          << (missing.empty() ? "" : ", did not write " + missing) << std::endl;
+            }
+        }
+        return good;
+    }
+
+private:
+    std::string stamps;
+    std::string sourceRoot;
+    std::vector<PipelineStage> stages;
+    std::map<std::string, std::string> inputHashes;     // file -> "size mtime hash"
+
+    // Dependencies from matching inputs to outputs, every output has exactly one producer
+    bool resolve(std::vector<std::vector<uint32_t>> &dependencies) {
+        std::map<std::string, uint32_t> producers;
+        for (uint32_t s = 0; s < stages.size(); s++) {
+            for (uint32_t o = 0; o < stages[s].outputs.size(); o++) {
+                if (producers.count(stages[s].outputs[o])) {
+                    std::cerr << stages[s].outputs[o] << " is written by both " << stages[producers[stages[s].outputs[o]]].name
+                              << " and " << stages[s].name << std::endl;
+                    return false;
+                }
+                producers[stages[s].outputs[o]] = s;
+            }
+        }
+        dependencies.assign(stages.size(), std::vector<uint32_t>());
+        for (uint32_t s = 0; s < stages.size(); s++) {
+            for (uint32_t i = 0; i < stages[s].inputs.size(); i++) {
+                std::map<std::string, uint32_t>::iterator producer = producers.find(stages[s].inputs[i]);
+                if (producer != producers.end() && producer->second != s) {
+                    dependencies[s].push_back(producer->second);
+                }
+            }
+        }
+        return true;
+    }
+
+    bool topologicalOrder(const std::vector<std::vector<uint32_t>> &dependencies, std::vector<uint32_t> &order) {
+        std::vector<int32_t> mark(stages.size(), 0);
+        std::function<bool(uint32_t)> visit = [&](uint32_t s) {
+            if (mark[s] == 2) {
+                return true;
+            }
+            if (mark[s] == 1) {
+                std::cerr << "Pipeline has a cycle through " << stages[s].name << std::endl;
+                return false;
+            }
+            mark[s] = 1;
+            for (uint32_t d = 0; d < dependencies[s].size(); d++) {
+                if (!visit(dependencies[s][d])) {
+                    return false;
+                }
+            }
+            mark[s] = 2;
+            order.push_back(s);
+            return true;
+        };
+        for (uint32_t s = 0; s < stages.size(); s++) {
+            if (!visit(s)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint64_t stageKey(uint32_t s, const std::vector<uint32_t> &dependencies, const std::vector<uint64_t> &keys) {
+        const PipelineStage &stage = stages[s];
+        uint64_t key = hashString(stage.name, hashBytes(nullptr, 0));
+        for (uint32_t p = 0; p < stage.parameters.size(); p++) {
+            key = hashString(stage.parameters[p].second, hashString(stage.parameters[p].first, key));
+        }
+        std::vector<std::string> sources = sourceClosure(stage.sources);
+        for (uint32_t f = 0; f < sources.size(); f++) {
+            key = hashString(sources[f], key);
+            key = hashString(contentHash(sourceRoot + "/" + sources[f]), key);
+        }
+        for (uint32_t d = 0; d < dependencies.size(); d++) {
+            key = hashBytes(&keys[dependencies[d]], sizeof(uint64_t), key);
+        }
+        // Files from outside the pipeline go in by content
+        for (uint32_t i = 0; i < stage.inputs.size(); i++) {
+            bool produced = false;
+            for (uint32_t d = 0; d < dependencies.size(); d++) {
+                const std::vector<std::string> &outputs = stages[dependencies[d]].outputs;
+                produced = produced || std::find(outputs.begin(), outputs.end(), stage.inputs[i]) != outputs.end();
+            }
+            if (!produced) {
+                key = hashString(stage.inputs[i], key);
+                key = hashString(contentHash(stage.inputs[i]), key);
+            }
+        }
+        return key;
+    }
+
+    // The sources and every header under sourceRoot they include with #include "...", recursively,
+    // sorted.  ROOT and StPicoEvent headers are not followed.
+    std::vector<std::string> sourceClosure(const std::vector<std::string> &sources) {
+        std::set<std::string> seen;
+        std::set<std::string> closure(sources.begin(), sources.end());
+        std::vector<std::string> pending(sources);
+        while (!pending.empty()) {
+            std::string file = pending.back();
+            pending.pop_back();
+            if (!seen.insert(file).second) {
+                continue;
+            }
+            FILE *input = fopen((sourceRoot + "/" + file).c_str(), "r");
+            if (input == nullptr) {
+                continue;
+            }
+            closure.insert(file);
+            char line[4096];
+            char header[1024];
+            while (fgets(line, sizeof(line), input) != nullptr) {
+                if (sscanf(line, " #include \"%1023[^\"]\"", header) == 1) {
+                    pending.push_back(header);
+                }
+            }
+            fclose(input);
+        }
+        return std::vector<std::string>(closure.begin(), closure.end());
+    }
+
+    // Content hash of a file, reused while its size and time stamp are unchanged.  "missing" if absent.
+    std::string contentHash(const std::string &file) {
+        uint64_t size;
+        int64_t modified;
+        if (!sourceStatus(file.c_str(), size, modified)) {
+            return "missing";
+        }
+        std::string stamp = Form("%llu %lld", (unsigned long long)size, (long long)modified);
+        std::map<std::string, std::string>::iterator known = inputHashes.find(file);
+        if (known != inputHashes.end() && known->second.compare(0, stamp.size() + 1, stamp + " ") == 0) {
+            return known->second.substr(stamp.size() + 1);
+        }
+        std::string hash = Form("%016llx", (unsigned long long)fileChecksum(file.c_str()));
+        inputHashes[file] = stamp + " " + hash;
+        return hash;
+    }
+
+    void loadInputHashes() {
+        FILE *file = fopen((stamps + "/inputs").c_str(), "r");
+        if (file == nullptr) {
+            return;
+        }
+        char name[4096];
+        unsigned long long size;
+        long long modified;
+        char hash[32];
+        while (fscanf(file, "%4095s %llu %lld %31s", name, &size, &modified, hash) == 4) {
+            inputHashes[name] = Form("%llu %lld %s", size, modified, hash);
+        }
+        fclose(file);
+    }
+
+    void saveInputHashes() {
+        FILE *file = fopen((stamps + "/inputs").c_str(), "w");
+        if (file == nullptr) {
+            return;
+        }
+        for (std::map<std::string, std::string>::iterator i = inputHashes.begin(); i != inputHashes.end(); i++) {
+            fprintf(file, "%s %s\n", i->first.c_str(), i->second.c_str());
+        }
+        fclose(file);
+    }
+
+    std::string missingOutput(uint32_t s) {
+        for (uint32_t o = 0; o < stages[s].outputs.size(); o++) {
+            if (gSystem->AccessPathName(stages[s].outputs[o].c_str())) {     // True when the file is missing
+                return stages[s].outputs[o];
+            }
+        }
+        return "";
+    }
+
+    // Removes the outputs of a stage about to run, unless it is resumable, and stamps its start.
+    // started gets the time stamp the outputs have to reach, from the file system's own clock.
+    bool prepareOutputs(uint32_t s, int64_t &started) {
+        const PipelineStage &stage = stages[s];
+        if (!stage.resumable) {
+            for (uint32_t o = 0; o < stage.outputs.size(); o++) {
+                if (unlink(stage.outputs[o].c_str()) != 0 && errno != ENOENT) {
+                    std::cerr << "[" << stage.name << "] could not remove " << stage.outputs[o] << std::endl;
+                    return false;
+                }
+            }
+        }
+        std::string stamp = stamps + "/" + stage.name + ".started";
+        FILE *file = fopen(stamp.c_str(), "w");
+        uint64_t size;
+        if (file == nullptr || fclose(file) != 0 || !sourceStatus(stamp.c_str(), size, started)) {
+            std::cerr << "[" << stage.name << "] could not write " << stamp << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // The first output that is missing or older than started, "" if there is none
+    std::string staleOutput(uint32_t s, int64_t started) {
+        for (uint32_t o = 0; o < stages[s].outputs.size(); o++) {
+            uint64_t size;
+            int64_t modified;
+            if (!sourceStatus(stages[s].outputs[o].c_str(), size, modified) || modified < started) {
+                return stages[s].outputs[o];
+            }
+        }
+        return "";
+    }
+
+    bool upToDate(uint32_t s, uint64_t key) {
+        if (!missingOutput(s).empty()) {
+            return false;
+        }
+        FILE *stamp = fopen((stamps + "/" + stages[s].name + ".key").c_str(), "r");
+        if (stamp == nullptr) {
+            return false;
+        }
+        unsigned long long stored = 0;
+        bool match = fscanf(stamp, "%llx", &stored) == 1 && stored == key;
+        fclose(stamp);
+        return match;
+    }
+
+    void writeKey(uint32_t s, uint64_t key) {
+        FILE *stamp = fopen((stamps + "/" + stages[s].name + ".key").c_str(), "w");
+        if (stamp != nullptr) {
+            fprintf(stamp, "%llx\n", (unsigned long long)key);
+            fclose(stamp);
+        }
+    }
+};
+
+#endif // PIPELINE
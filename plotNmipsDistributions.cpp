@@ -22,48 +22,115 @@
 #include <TText.h>
 
 #include <iostream>
+#include <vector>
+
+#include "batchRender.h"
+#include "histogramEngine.h"
+#include "instrumentation.h"
+#include "eventStore.h"
+#include "parallel.h"
 
 const int RINGS = 16;
 
-void plotNmipsDistributions() {
-    // Open data files
-    TFile simulated_data("data/simulated_data.root");
-    TFile detector_data("data/detector_data.root");
+// The per ring histograms of one dataset, as count arrays until they are plotted
+struct RingHistograms {
+    std::vector<Histogram1D> nmips;
+    std::vector<Histogram1D> nmipsCentral;       // b < 7.5, only for datasets with an impact parameter
+    std::vector<Histogram2D> nmipsVsRefmult;
+
+    RingHistograms(uint32_t nmipBins, double nmipMin, double nmipMax,
+                   uint32_t refmultBins2D, double refmultMin2D, double refmultMax2D,
+                   uint32_t nmipBins2D, double nmipMin2D, double nmipMax2D, uint32_t nThreads) {
+        for (uint32_t i = 0; i < RINGS; i++) {
+            nmips.emplace_back(nmipBins, nmipMin, nmipMax, nThreads);
+            nmipsCentral.emplace_back(nmipBins, nmipMin, nmipMax, nThreads);
+            nmipsVsRefmult.emplace_back(refmultBins2D, refmultMin2D, refmultMax2D, nmipBins2D, nmipMin2D, nmipMax2D, nThreads);
+        }
+    }
+};
+
+// Fills all the histograms of a dataset in a single multithreaded pass.  Each thread
+// takes its events a block at a time, and all 16 rings, RefMult1 and the impact
+// parameter of the block are histogrammed while they are in cache, instead of
+// walking the whole dataset once per ring and per histogram.
+void fillRingHistograms(const TMatrixD *nmips, const TVectorD *refmult1, const TVectorD *impactParameter,
+                        RingHistograms &histograms) {
+    uint64_t numEvents = nmips->GetNcols();
+    const double *rings = nmips->GetMatrixArray();      // Ring r of event j at r * numEvents + j
+    const double *refmult = refmult1->GetMatrixArray();
+    const double *impact = impactParameter != nullptr ? impactParameter->GetMatrixArray() : nullptr;
+    std::vector<uint8_t> central(impact != nullptr ? numEvents : 0);
+    ScopedTimer timer("fill_histograms", numEvents, numEvents * (RINGS + 2) * sizeof(double));
+
+    parallelFor(numEvents, histograms.nmips[0].threadCount(), [&](uint64_t begin, uint64_t end, uint32_t thread) {
+        for (uint64_t first = begin; first < end; first += histogramBlock) {
+            uint64_t last = end - first < histogramBlock ? end : first + histogramBlock;
+            if (impact != nullptr) {
+                for (uint64_t j = first; j < last; j++) {
+                    central[j] = impact[j] < 7.5;
+                }
+            }
+            for (uint32_t i = 0; i < RINGS; i++) {
+                const double *ring = rings + i * numEvents;
+                histograms.nmips[i].fillRange(ring, nullptr, first, last, thread);
+                if (impact != nullptr) {
+                    histograms.nmipsCentral[i].fillRange(ring, central.data(), first, last, thread);
+                }
+                histograms.nmipsVsRefmult[i].fillRange(refmult, ring, nullptr, first, last, thread);
+            }
+        }
+    });
+}
 
+void plotNmipsDistributions(uint32_t renderWorkers = 4) {
+    StageMetrics metrics("plotNmipsDistributions");
     // Load simulated data
-    TMatrixD *sim_nmips;
-    TVectorD *sim_impact_parameter;
-    TVectorD *sim_refmult1;
-    simulated_data.GetObject("ring_sums", sim_nmips);
-    simulated_data.GetObject("tpc_multiplicity", sim_refmult1);
-    simulated_data.GetObject("impact_parameter", sim_impact_parameter);
-    simulated_data.Close();
+    TMatrixD *sim_nmips = loadRingSums("data/simulated_data.root");
+    TVectorD *sim_refmult1 = loadColumn("data/simulated_data.root", "tpc_multiplicity");
+    TVectorD *sim_impact_parameter = loadColumn("data/simulated_data.root", "impact_parameter");
 
     // Load detector data
-    TMatrixD *det_nmips;
-    TVectorD *det_refmult1;
-    detector_data.GetObject("ring_sums", det_nmips);
-    detector_data.GetObject("tpc_multiplicity", det_refmult1);
-    detector_data.Close();
+    TMatrixD *det_nmips = loadRingSums("data/detector_data.root");
+    TVectorD *det_refmult1 = loadColumn("data/detector_data.root", "tpc_multiplicity");
+    if (sim_nmips == nullptr || sim_refmult1 == nullptr || sim_impact_parameter == nullptr ||
+        det_nmips == nullptr || det_refmult1 == nullptr) {
+        return;
+    }
+    metrics.addEvents(sim_nmips->GetNcols() + det_nmips->GetNcols());
 
     uint32_t num_bins = 60;
     int32_t lower_bin = 0;
     int32_t upper_bin = 60;
 
-    // Create and fill histograms
+    int32_t refmult1_bins, refmult1_min, refmult1_max;
+    int32_t nmips_bins, nmips_min, nmips_max;
+    refmult1_bins = 50;
+    refmult1_min = 0;
+    refmult1_max = 300;
+    nmips_bins = 50;
+    nmips_min = 0;
+    nmips_max = 60;
+
+    // Fill every ring histogram of a dataset in one pass over its events
+    uint32_t nThreads = defaultThreads();
+    RingHistograms sim_counts(num_bins, lower_bin, upper_bin, refmult1_bins, refmult1_min, refmult1_max,
+                              nmips_bins, nmips_min, nmips_max, nThreads);
+    RingHistograms det_counts(num_bins, lower_bin, upper_bin, refmult1_bins, refmult1_min, refmult1_max,
+                              nmips_bins, nmips_min, nmips_max, nThreads);
+    fillRingHistograms(sim_nmips, sim_refmult1, sim_impact_parameter, sim_counts);
+    fillRingHistograms(det_nmips, det_refmult1, nullptr, det_counts);
+
+    // Create histograms
     TH1D **sim_histograms = (TH1D**)malloc(RINGS * sizeof(TH1D*));
     TH1D **sim_histograms_bFiltered = (TH1D**)malloc(RINGS * sizeof(TH1D*));
     TH1D **det_histograms = (TH1D**)malloc(RINGS * sizeof(TH1D*));
     for (uint32_t i = 0; i < RINGS; i++) {
-        sim_histograms[i] = new TH1D(Form("sim_nmips_ring_%d", i + 1),
-                                     Form("UrQMD nmips distribution, ring %d", i + 1),
-                                     num_bins, lower_bin, upper_bin);
-        sim_histograms_bFiltered[i] = new TH1D(Form("sim_nmips_ring_%d", i + 1),
-                                     Form("UrQMD nmips distribution, ring %d, b<7.5", i + 1),
-                                     num_bins, lower_bin, upper_bin);
-        det_histograms[i] = new TH1D(Form("det_nmips_ring_%d", i + 1),
-                                     Form("Detector nmips distribution, ring %d", i + 1),
-                                     num_bins, lower_bin, upper_bin);
+        sim_histograms[i] = sim_counts.nmips[i].toTH1D(Form("sim_nmips_ring_%d", i + 1),
+                                                       Form("UrQMD nmips distribution, ring %d", i + 1));
+        sim_histograms_bFiltered[i] = sim_counts.nmipsCentral[i].toTH1D(Form("sim_nmips_ring_%d", i + 1),
+                                                                        Form("UrQMD nmips distribution, ring %d, b<7.5", i + 1));
+        det_histograms[i] = det_counts.nmips[i].toTH1D(Form("det_nmips_ring_%d", i + 1),
+                                                       Form("Detector nmips distribution, ring %d", i + 1));
 
         sim_histograms[i]->SetXTitle("nmips");
         sim_histograms[i]->SetYTitle("Count");
@@ -71,35 +138,13 @@ void plotNmipsDistributions() {
         sim_histograms_bFiltered[i]->SetYTitle("Count");
         det_histograms[i]->SetXTitle("nmips");
         det_histograms[i]->SetYTitle("Count");
-
-        // Fill data    
-        // Simulation    
-        for (uint32_t j = 0; j < sim_nmips->GetNcols(); j++) {
-            // if ((*sim_impact_parameter)[j] < 7.5) {
-                sim_histograms[i]->Fill((*sim_nmips)[i][j]);//, 1. / sim_nmips->GetNcols());
-            // }
-        }
-        for (uint32_t j = 0; j < sim_nmips->GetNcols(); j++) {
-            if ((*sim_impact_parameter)[j] < 7.5) {
-                sim_histograms_bFiltered[i]->Fill((*sim_nmips)[i][j]);//, 1. / sim_nmips->GetNcols());
-            }
-        }
-        // Detector Data
-        for (uint32_t j = 0; j < det_nmips->GetNcols(); j++) {
-            // if ((*det_refmult1)[j] > 25) {
-                det_histograms[i]->Fill((*det_nmips)[i][j]);//, 1. / det_nmips->GetNcols());
-            // }
-        }
     }
 
-    gStyle->SetPalette(kBird);
-    gStyle->SetOptStat(0);
-    TCanvas *canvas = new TCanvas("canvas", "Nmips Comparison", 1000, 1000);
-    canvas->Divide(4, 4);
+    std::vector<PlotJob> jobs;
+    PlotJob nmipsJob("canvas", "histograms/nmips_distributions.png", 4, 4);
     for (uint32_t i = 0; i < RINGS; i++) {
-        TLegend *legend = new TLegend(0.75,0.7,0.95,0.85);
-        THStack *stack = new THStack(Form("sim_nmips_ring_%d", i + 1), Form("nmips distribution, ring %d", i + 1));
-        canvas->cd(i + 1);
+        THStack *stack = new THStack(Form("sim_nmips_ring_%d", i + 1), Form("nmips distribution, ring %d;nmips;count", i + 1));
+        PlotPad &pad = nmipsJob.pads[i];
 
         std::cout << "Ring " << i + 1 << " Max Bin: " << det_histograms[i]->GetMaximumBin() << "\t" << sim_histograms[i]->GetMaximumBin() << std::endl;
         sim_histograms[i]->Scale(1. / sim_histograms[i]->Integral());        
@@ -122,100 +167,72 @@ void plotNmipsDistributions() {
         det_histograms[i]->SetMarkerSize(0.7);
         stack->Add(det_histograms[i]);
         
-        stack->Draw("nostack hist p");
-        stack->GetXaxis()->SetTitle("nmips");
-        stack->GetYaxis()->SetTitle("count");
-        stack->GetXaxis()->SetTickLength(0);
-        stack->GetYaxis()->SetTickLength(0);
+        pad.add(stack, "nostack hist p");
+        pad.afterDraw = [stack]() {
+            stack->GetXaxis()->SetTickLength(0);
+            stack->GetYaxis()->SetTickLength(0);
+        };
         
-        legend->AddEntry(sim_histograms[i], "UrQMD");
-        legend->AddEntry(sim_histograms_bFiltered[i], "UrQMD, b<7.5");
-        legend->AddEntry(det_histograms[i], "Detector");
-        legend->Draw();
+        pad.legend = true;
+        pad.legendX1 = 0.75;
+        pad.legendY1 = 0.7;
+        pad.legendX2 = 0.95;
+        pad.legendY2 = 0.85;
+        pad.addLegendEntry(sim_histograms[i], "UrQMD", "lpf");
+        pad.addLegendEntry(sim_histograms_bFiltered[i], "UrQMD, b<7.5", "lpf");
+        pad.addLegendEntry(det_histograms[i], "Detector", "lpf");
     }
-    canvas->Draw();
-    canvas->SaveAs("histograms/nmips_distributions.png");
+    jobs.push_back(nmipsJob);
 
     // Plotting nmips vs refmult1 for detector data
-    int32_t refmult1_bins, refmult1_min, refmult1_max;
-    int32_t nmips_bins, nmips_min, nmips_max;
-    refmult1_bins = 50;
-    refmult1_min = 0;
-    refmult1_max = 300;
-    nmips_bins = 50;
-    nmips_min = 0;
-    nmips_max = 60;
-
     TH2D **det_nmips_refmult1 = (TH2D**)malloc(RINGS * sizeof(TH2D*));
     for (uint32_t i = 0; i < RINGS; i++) {
-        det_nmips_refmult1[i] = new TH2D(Form("det_nmips_refmult_%d)", i+1), Form("nMIPs vs RefMult1, Detector, ring %d", i + 1),
-                                     refmult1_bins, refmult1_min, refmult1_max,
-                                     nmips_bins, nmips_min, nmips_max);
+        det_nmips_refmult1[i] = det_counts.nmipsVsRefmult[i].toTH2D(Form("det_nmips_refmult_%d)", i+1), Form("nMIPs vs RefMult1, Detector, ring %d", i + 1));
         det_nmips_refmult1[i]->SetXTitle("refmult1");
         det_nmips_refmult1[i]->SetYTitle("nmips");
-        for (uint32_t j = 0; j < det_nmips->GetNcols(); j++) {
-            det_nmips_refmult1[i]->Fill((*det_refmult1)[j], (*det_nmips)[i][j]);
-        }
     }
 
-    TCanvas *canvas2 = new TCanvas("canvas2", "RefMult1 vs nMIPs", 1000, 1000);
-    canvas2->Divide(4, 4);
+    PlotJob detectorJob("canvas2", "histograms/det_nmips_refmult1.png", 4, 4);
     for (uint32_t i = 0; i < RINGS; i++) {
-        canvas2->cd(i + 1);
-        gPad->SetLogz();
-        det_nmips_refmult1[i]->Draw("colz");
+        detectorJob.pads[i].logz = true;
+        detectorJob.pads[i].add(det_nmips_refmult1[i], "colz");
     }
-    canvas2->Draw();
-    canvas2->SaveAs("histograms/det_nmips_refmult1.png");
+    jobs.push_back(detectorJob);
 
 
     // Plotting nmips vs refmult1 for simulation
     TH2D **sim_nmips_refmult1 = (TH2D**)malloc(RINGS * sizeof(TH2D*));
     for (uint32_t i = 0; i < RINGS; i++) {
-        sim_nmips_refmult1[i] = new TH2D(Form("sim_nmips_refmult_%d)", i+1), Form("nMIPs vs RefMult1, UrQMD, ring %d", i + 1),
-                                     refmult1_bins, refmult1_min, refmult1_max,
-                                     nmips_bins, nmips_min, nmips_max);
+        sim_nmips_refmult1[i] = sim_counts.nmipsVsRefmult[i].toTH2D(Form("sim_nmips_refmult_%d)", i+1), Form("nMIPs vs RefMult1, UrQMD, ring %d", i + 1));
         sim_nmips_refmult1[i]->SetXTitle("refmult1");
         sim_nmips_refmult1[i]->SetYTitle("nmips");
-        for (uint32_t j = 0; j < sim_nmips->GetNcols(); j++) {
-            sim_nmips_refmult1[i]->Fill((*sim_refmult1)[j], (*sim_nmips)[i][j]);
-        }
     }
 
-    TCanvas *canvas3 = new TCanvas("canvas3", "RefMult1 vs nMIPs", 1000, 1000);
-    canvas3->Divide(4, 4);
+    PlotJob simulationJob("canvas3", "histograms/sim_nmips_refmult1.png", 4, 4);
     for (uint32_t i = 0; i < RINGS; i++) {
-        canvas3->cd(i + 1);
-        gPad->SetLogz();
-        sim_nmips_refmult1[i]->Draw("colz");
+        simulationJob.pads[i].logz = true;
+        simulationJob.pads[i].add(sim_nmips_refmult1[i], "colz");
     }
-    canvas3->Draw();
-    canvas3->SaveAs("histograms/sim_nmips_refmult1.png");
+    jobs.push_back(simulationJob);
 
     // Plotting 3 rings
-    TCanvas *canvas4 = new TCanvas("Canvas4", "RefMult1 vs nMIPs", 1000, 1000);
-    canvas4->Divide(2, 3);
-    TText **pearson_coefficients = (TText**)malloc(6 * sizeof(TText*));
+    PlotJob comparisonJob("Canvas4", "histograms/det_sim_comparison.png", 2, 3);
 
     int ring_selection[] = {0, 2, 4};
     for (uint32_t i = 0; i < 3; i++) {
-        canvas4->cd(2 * i + 1);
-        gPad->SetLogz();
-        det_nmips_refmult1[ring_selection[i]]->Draw("colz");
+        PlotPad &detectorPad = comparisonJob.pads[2 * i];
+        detectorPad.logz = true;
+        detectorPad.add(det_nmips_refmult1[ring_selection[i]], "colz");
         double corr = det_nmips_refmult1[ring_selection[i]]->GetCorrelationFactor();
-        pearson_coefficients[2 * i] = new TText();
-        pearson_coefficients[2 * i]->DrawText(120, 50, Form("Pearsons Coefficient: %f", corr));
+        detectorPad.texts.push_back({120, 50, Form("Pearsons Coefficient: %f", corr)});
 
-
-        canvas4->cd(2 * i + 2);
-        gPad->SetLogz();
-        sim_nmips_refmult1[ring_selection[i]]->Draw("colz");
+        PlotPad &simulationPad = comparisonJob.pads[2 * i + 1];
+        simulationPad.logz = true;
+        simulationPad.add(sim_nmips_refmult1[ring_selection[i]], "colz");
         corr = sim_nmips_refmult1[ring_selection[i]]->GetCorrelationFactor();
-        pearson_coefficients[2 * i + 1] = new TText();
-        pearson_coefficients[2 * i + 1]->DrawText(120, 50, Form("Pearsons Coefficient: %f", corr));
+        simulationPad.texts.push_back({120, 50, Form("Pearsons Coefficient: %f", corr)});
     }
+    jobs.push_back(comparisonJob);
 
-    canvas4->Draw();
-    canvas4->SaveAs("histograms/det_sim_comparison.png");
-
+    renderPlots(jobs, renderWorkers);
 }
\ No newline at end of file
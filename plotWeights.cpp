@@ -18,7 +18,13 @@
 #include <TCanvas.h>
 #include <TLegend.h>
 
-void plotWeights() {
+#include <vector>
+
+#include "batchRender.h"
+#include "instrumentation.h"
+
+void plotWeights(uint32_t renderWorkers = 1) {
+    StageMetrics metrics("plotWeights");
     TFile detector_data("data/epd_tpc_relations.root");
     TFile simulator_data("data/epd_tpc_relations_simulated.root");
     TMatrixD *detector_weights, *detector_weights_outer, *simulator_weights, *simulator_weights_outer;
@@ -29,7 +35,7 @@ void plotWeights() {
         exit(1);
     }
 
-    detector_data.GetDirectory("methods")->GetObject("linear_weights_outer", detector_weights_outer);
+    detector_data.GetDirectory("methods")->GetObject("linear_outer_weights", detector_weights_outer);
     if (detector_weights_outer == nullptr) {
         printf("Could not read detector linear weights, why?\n");
         exit(1);
@@ -41,7 +47,7 @@ void plotWeights() {
         exit(1);
     }
 
-    simulator_data.GetDirectory("methods")->GetObject("linear_weights_outer", simulator_weights_outer);
+    simulator_data.GetDirectory("methods")->GetObject("linear_outer_weights", simulator_weights_outer);
     if (simulator_weights == nullptr) {
         printf("Could not read simulator outer ring linear weights, why?\n");
         exit(1);
@@ -87,9 +93,10 @@ void plotWeights() {
     simulator_weight_outer_graph->SetTitle(Form("Simulator Weights, Outer %d Rings, Bias=%f", outer_sim_rings_used, (*simulator_weights_outer)[16][0]));
     detector_weight_outer_graph->SetTitle(Form("Detector Weights, Outer %d Rings, Bias=%f", outer_sim_rings_used, (*detector_weights_outer)[16][0]));
 
-    TCanvas *canvas = new TCanvas("Weights");
+    PlotJob job("Weights", "histograms/weights.png");
+    job.width = 700;
+    job.height = 500;
     TMultiGraph *graph = new TMultiGraph();
-    TLegend *legend;
 
     detector_weight_graph->SetLineColor(kBlue);
     simulator_weight_graph->SetLineColor(kRed);
@@ -111,15 +118,23 @@ void plotWeights() {
     graph->Add(simulator_weight_graph);
     graph->Add(simulator_weight_outer_graph);
 
-    graph->SetTitle("Linear Weighting Weights");
-    graph->GetXaxis()->SetTitle("Ring");
-    graph->GetYaxis()->SetTitle("Weight");
-
-    graph->Draw("alp");
-    legend = canvas->BuildLegend(0.13, 0.6, 0.43, 0.8);
-    legend->Draw();
-    zero->Draw("l");
-    canvas->Draw();
+    graph->SetTitle("Linear Weighting Weights;Ring;Weight");
+
+    PlotPad &pad = job.pads[0];
+    pad.add(graph, "alp");
+    pad.add(zero, "l");
+    pad.legend = true;
+    pad.legendX1 = 0.13;
+    pad.legendY1 = 0.6;
+    pad.legendX2 = 0.43;
+    pad.legendY2 = 0.8;
+    pad.addLegendEntry(detector_weight_graph, detector_weight_graph->GetTitle(), "lp");
+    pad.addLegendEntry(detector_weight_outer_graph, detector_weight_outer_graph->GetTitle(), "lp");
+    pad.addLegendEntry(simulator_weight_graph, simulator_weight_graph->GetTitle(), "lp");
+    pad.addLegendEntry(simulator_weight_outer_graph, simulator_weight_outer_graph->GetTitle(), "lp");
+
+    std::vector<PlotJob> jobs(1, job);
+    renderPlots(jobs, renderWorkers);
 
     detector_data.Close();
     simulator_data.Close();
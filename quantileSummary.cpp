@@ -15,50 +15,65 @@
 #include <TCanvas.h>
 #include <TFile.h>
 #include <TH1D.h>
+#include <TH2D.h>
 #include <TLegend.h>
 #include <TGraph.h>
 #include <TColor.h>
 #include <TStyle.h>
 #include <TMultiGraph.h>
+#include <TTree.h>
 
+#include <cmath>
 #include <iostream> 
+#include <map>
+#include <string>
 #include <vector>
 
-// Since data is stored as 5 percent ranges, it is convenient to be able to ask
-// for a larger range in dynamic way, combinding them as needed.
-TH1D *getQuantileRange(int min, int max, TDirectory *dir, const char *mode) {
-    if (min % 5 != 0 || max % 5 != 0) {
-        std::cerr << "Quantiles are stored in 5%% increments, cannot get desired range: " << min << "-" << max << std::endl;
+#include "quantiles.h"
+#include "batchRender.h"
+#include "instrumentation.h"
+
+// The quantile stage stores one cumulative percentile x multiplicity histogram per
+// axis, so any range is the difference of two of its rows.
+TH2D *loadCumulative(TDirectory *dir, const char *mode) {
+    TH2D *cumulative = nullptr;
+    dir->GetObject(Form("%s_cumulative", mode), cumulative);
+    if (cumulative == nullptr) {
+        std::cerr << "Could not find " << mode << "_cumulative, rerun quantiles.cpp" << std::endl;
         return nullptr;
     }
+    cumulative->SetDirectory(nullptr);
+    return cumulative;
+}
 
-    TH1D *range = nullptr;
-
-    int numQuantiles = (max - min) / 5;
-    std::cout << "Loading " << numQuantiles << "bins" << std::endl;
-    dir->GetObject(Form("%s_%d%%-%d%%;1", mode, min, min + 5), range);
-    // std::cout << "form: " << Form("%s_%d%%-%d%%;1", mode, min, min + 5) << std::endl;
-    if (range == nullptr) {
-        std::cerr << "WTF" << std::endl;
+TH1D *getQuantileRange(double min, double max, TH2D *cumulative, const char *mode) {
+    if (min < 0 || max > 100 || min >= max) {
+        std::cerr << "Invalid quantile range: " << min << "-" << max << std::endl;
+        return nullptr;
     }
-    
-    for (uint32_t i = 1; i < numQuantiles; i++) {
-        // std::cout << "This better not be running" << std::endl;
-        TH1D *temp = nullptr;
-        dir->GetObject(Form("%s_%d%%-%d%%;1", mode, min + 5 * i, min + 5 * (i + 1)), temp);
-        // std::cout << "Form 2: " << Form("%s_%d%%-%d%%;1", mode, min + 5 * i, min + 5 * (i + 1)) << std::endl;
-        if (temp == nullptr) {
-            std::cerr << "WTF" << std::endl;
-        }
-        range->Add(temp);
-        delete temp;
+
+    TAxis *percentiles = cumulative->GetXaxis();
+    int32_t lowerEdge = percentiles->FindBin(min);
+    int32_t upperEdge = percentiles->FindBin(max);
+    if (fabs(percentiles->GetBinCenter(lowerEdge) - min) > 1e-6 || fabs(percentiles->GetBinCenter(upperEdge) - max) > 1e-6) {
+        std::cerr << "Percentiles are stored in " << percentiles->GetBinWidth(1) << "% steps, rounding "
+                  << min << "-" << max << " to " << percentiles->GetBinCenter(lowerEdge) << "-"
+                  << percentiles->GetBinCenter(upperEdge) << std::endl;
     }
-    TH1D *retVal = (TH1D*)range->Clone(Form("%s_%d_%d", mode, min, max));
-    return retVal;
+
+    // Projections are detached so repeated ranges don't get reused by name
+    TH1D *range = cumulative->ProjectionY(Form("%s_%g_%g", mode, min, max), upperEdge, upperEdge);
+    range->SetDirectory(nullptr);
+    TH1D *below = cumulative->ProjectionY(Form("%s_below_%g", mode, min), lowerEdge, lowerEdge);
+    below->SetDirectory(nullptr);
+    range->Add(below, -1);
+    range->ResetStats();
+    delete below;
+    return range;
 }
 
 // Recreates figure 11, comparing tpc quantiles to epd quantiles
-void quantileComparison(TDirectory *dir, const char *name) {
+void quantileComparison(TDirectory *dir, const char *name, std::vector<PlotJob> &jobs) {
     // dir->pwd();
     // dir->ls();
     // We want to compare the 0-5% (95-100%), 20-30% (70-80%), and 90-100% (0-10%) ranges
@@ -66,14 +81,22 @@ void quantileComparison(TDirectory *dir, const char *name) {
     TH1D *tpc_65_70,  *epd_65_70;
     TH1D *tpc_15_20,  *epd_15_20;
 
-    tpc_15_20 = (TH1D*)getQuantileRange(50, 60, dir, "tpc")->Clone();
-    epd_15_20 = (TH1D*)getQuantileRange(50, 60, dir, "epd")->Clone();
+    TH2D *tpcCumulative = loadCumulative(dir, "tpc");
+    TH2D *epdCumulative = loadCumulative(dir, "epd");
+    if (tpcCumulative == nullptr || epdCumulative == nullptr) {
+        return;
+    }
+
+    tpc_15_20 = getQuantileRange(50, 60, tpcCumulative, "tpc");
+    epd_15_20 = getQuantileRange(50, 60, epdCumulative, "epd");
 
-    tpc_65_70 = (TH1D*)getQuantileRange(75, 85, dir, "tpc")->Clone();
-    epd_65_70 = (TH1D*)getQuantileRange(75, 85, dir, "epd")->Clone();
+    tpc_65_70 = getQuantileRange(75, 85, tpcCumulative, "tpc");
+    epd_65_70 = getQuantileRange(75, 85, epdCumulative, "epd");
 
-    tpc_95_100 = (TH1D*)getQuantileRange(95, 100, dir, "tpc")->Clone();
-    epd_95_100 = (TH1D*)getQuantileRange(95, 100, dir, "epd")->Clone();
+    tpc_95_100 = getQuantileRange(95, 100, tpcCumulative, "tpc");
+    epd_95_100 = getQuantileRange(95, 100, epdCumulative, "epd");
+    delete tpcCumulative;
+    delete epdCumulative;
 
     TH1D **quantileTPCProjects = (TH1D**)malloc(3 * sizeof(TH1D*));
     TH1D **quantileEPDProjects = (TH1D**)malloc(3 * sizeof(TH1D*));
@@ -88,18 +111,15 @@ void quantileComparison(TDirectory *dir, const char *name) {
     quantileEPDProjects[2] = epd_95_100;
 
     // Plot results
-    TCanvas *canvas = new TCanvas(name, name, 1000, 1000);
-    canvas->SetLogy();
+    PlotJob job(name, Form("histograms/%s.png", name));
+    PlotPad &pad = job.pads[0];
+    pad.logy = true;
+    pad.legend = true;
     tpc_15_20->SetMinimum(1);
 
-    TLegend *legend = new TLegend(0.65, 0.78, 0.75, 0.85);
-    legend->SetBorderSize(0);
-    legend->SetFillColor(0);
-    legend->SetTextSize(0.03);
-
-    char *formatA = "hist l p";
-    char *formatB = "same hist l p";
-    char *format = formatB;
+    const char *formatA = "hist l p";
+    const char *formatB = "same hist l p";
+    const char *format = formatA;
     quantileTPCProjects[0]->SetTitle(Form("Centrality Comparison, %s", name));
     quantileTPCProjects[0]->SetYTitle("Counts");
     quantileTPCProjects[0]->SetStats(0);
@@ -110,49 +130,51 @@ void quantileComparison(TDirectory *dir, const char *name) {
         quantileTPCProjects[i]->SetMarkerColor(kRed);
         quantileTPCProjects[i]->SetMarkerStyle(kOpenTriangleUp);
         quantileTPCProjects[i]->SetMarkerSize(0.5);
-        quantileTPCProjects[i]->Draw(format);  
+        pad.add(quantileTPCProjects[i], format, i == 0 ? "RefMult" : "");
         format = formatB;
 
         quantileEPDProjects[i]->SetLineColor(kBlue);
         quantileEPDProjects[i]->SetMarkerColor(kBlue);
         quantileEPDProjects[i]->SetMarkerStyle(kStar);
         quantileEPDProjects[i]->SetMarkerSize(0.5);
-        quantileEPDProjects[i]->Draw(format);
-
-        
+        pad.add(quantileEPDProjects[i], format, i == 0 ? "X_{#zeta'}" : "");
     }
-    legend->AddEntry(quantileTPCProjects[0], "RefMult", "l");
-    legend->AddEntry(quantileEPDProjects[0], "X_{#zeta'}", "l");
-    legend->Draw();
-
-    canvas->Draw();
-    canvas->SaveAs(Form("histograms/%s.png", name));
-
+    jobs.push_back(job);
 }
 
 // Compare the variance of 10% quantiles, as in figure 12 in the paper I am referencing
-TGraph *quantileVarianceComparison(TDirectory *dir, const char *name) {
+TGraph *quantileVarianceComparison(const std::vector<SliceMoments> &moments, const char *name) {
     const int numQuantiles = 10;
-    int quantilesRange = 100 / numQuantiles;
-    TH1D *epdQuantiles[numQuantiles];
-    TH1D *tpcQuantiles[numQuantiles];
-
-    TList *keys = dir->GetListOfKeys();
-    for (uint32_t i = 0; i < numQuantiles; i++) {
-        tpcQuantiles[i] = getQuantileRange(i * quantilesRange, (i + 1) * quantilesRange, dir, "tpc");
-        epdQuantiles[i] = getQuantileRange(i * quantilesRange, (i + 1) * quantilesRange, dir, "epd");
+    int slicesPerQuantile = momentSlices / numQuantiles;
+
+    // Pool the 5% slices of the moments table into 10% ranges
+    double tpcCount[numQuantiles] = {0}, tpcSum[numQuantiles] = {0}, tpcSumSquares[numQuantiles] = {0};
+    double epdCount[numQuantiles] = {0}, epdSum[numQuantiles] = {0}, epdSumSquares[numQuantiles] = {0};
+    for (uint32_t i = 0; i < moments.size(); i++) {
+        const SliceMoments &slice = moments[i];
+        uint32_t quantile = uint32_t(slice.low * momentSlices / 100 + 0.5) / slicesPerQuantile;
+        double *count = slice.axis == 0 ? tpcCount : epdCount;
+        double *sum = slice.axis == 0 ? tpcSum : epdSum;
+        double *sumSquares = slice.axis == 0 ? tpcSumSquares : epdSumSquares;
+        count[quantile] += slice.count;
+        sum[quantile] += slice.count * slice.mean;
+        sumSquares[quantile] += slice.count * (slice.variance + slice.mean * slice.mean);
     }
 
     double *tpcVariance = (double*)malloc(numQuantiles * sizeof(double));
     double *epdVariance = (double*)malloc(numQuantiles * sizeof(double));
     double *count = (double*)malloc(numQuantiles * sizeof(double)); //memory leaks here
     for (uint32_t i = 0; i < numQuantiles; i++) {
-        tpcVariance[i] = tpcQuantiles[i]->GetRMS();
-        if (tpcQuantiles[i]->GetRMS() < 0.0001) {
+        double tpcMean = tpcCount[i] > 0 ? tpcSum[i] / tpcCount[i] : 0;
+        double epdMean = epdCount[i] > 0 ? epdSum[i] / epdCount[i] : 0;
+        double tpcRMS = tpcCount[i] > 0 ? sqrt(fmax(tpcSumSquares[i] / tpcCount[i] - tpcMean * tpcMean, 0)) : 0;
+        double epdRMS = epdCount[i] > 0 ? sqrt(fmax(epdSumSquares[i] / epdCount[i] - epdMean * epdMean, 0)) : 0;
+        tpcVariance[i] = tpcRMS;
+        if (tpcRMS < 0.0001) {
             epdVariance[i] = 1;
         }
         else {
-            epdVariance[i] = epdQuantiles[i]->GetRMS() / tpcQuantiles[i]->GetRMS();
+            epdVariance[i] = epdRMS / tpcRMS;
         }
         count[i] = i + 1;
     }
@@ -163,65 +185,88 @@ TGraph *quantileVarianceComparison(TDirectory *dir, const char *name) {
     return graphs;
 }
 
-void quantileSummary(char *infile="data/epd_tpc_relations.root") {
+// Reads quantiles/slice_moments written by quantiles.cpp, grouped by method
+std::map<std::string, std::vector<SliceMoments>> loadSliceMoments(TDirectory *quantile_directory) {
+    std::map<std::string, std::vector<SliceMoments>> moments;
+    TTree *table = nullptr;
+    quantile_directory->GetObject("slice_moments", table);
+    if (table == nullptr) {
+        std::cerr << "Could not find quantiles/slice_moments, rerun quantiles.cpp" << std::endl;
+        return moments;
+    }
+    SliceMoments row;
+    readSliceMoments(table, &row);
+    for (Long64_t i = 0; i < table->GetEntries(); i++) {
+        table->GetEntry(i);
+        moments[row.method].push_back(row);
+    }
+    delete table;
+    return moments;
+}
+
+void quantileSummary(const char *infile="data/epd_tpc_relations.root", uint32_t renderWorkers = 4) {
+    StageMetrics metrics("quantileSummary");
     TFile rootFile(infile);
     TDirectory *quantile_directory = rootFile.GetDirectory("quantiles");
 
     TList *methods = quantile_directory->GetListOfKeys();
 
     std::vector<TGraph*> *varianceGraphs = new std::vector<TGraph*>;
+    std::vector<PlotJob> jobs;
+    std::map<std::string, std::vector<SliceMoments>> moments = loadSliceMoments(quantile_directory);
 
     for (TIter method = methods->begin(); method != methods->end(); ++method) {
         const char *methodName = (*method)->GetName();
         // if (0 != strcmp(methodName, "linear_detector")) {
         //     continue;
         // }
+        TDirectory *method_directory = quantile_directory->GetDirectory(methodName);
+        if (method_directory == nullptr) {  // slice_moments lives next to the method directories
+            continue;
+        }
         std::cout << methodName << std::endl;
-        quantileComparison(quantile_directory->GetDirectory(methodName), methodName);
-        varianceGraphs->push_back(quantileVarianceComparison(quantile_directory->GetDirectory(methodName), methodName));
+        quantileComparison(method_directory, methodName, jobs);
+        if (moments.count(methodName) != 0) {
+            varianceGraphs->push_back(quantileVarianceComparison(moments[methodName], methodName));
+        }
     }
 
     // Plotting variance graph
 
-    TCanvas c2("variances", "variances", 1000, 1000);
-    TLegend *legend = new TLegend(0.65, 0.65, 0.75, 0.8);
+    PlotJob varianceJob("variances", "histograms/variances.png");
+    PlotPad &pad = varianceJob.pads[0];
+    pad.legend = true;
+    pad.legendX1 = 0.68;
+    pad.legendY1 = 0.72;
+    pad.legendX2 = 0.85;
+    pad.legendY2 = 0.88;
     TMultiGraph *graph = new TMultiGraph();
-    legend->SetBorderSize(0);
-    legend->SetFillColor(0);
-    legend->SetTextSize(0.03);
     // gPad->SetLogy();
 
     const int colors[] = {8, 2, 3, 4, 1};
     const int markers[] = {4, 27, 28, 25, 26};
 
     for (uint32_t i = 0; i < varianceGraphs->size(); i++) {
-        (*varianceGraphs)[i]->SetLineColor(i + 1);
-        if (i == 0) {
-            (*varianceGraphs)[i]->Draw("AL*");
-        }
-        else {
-            (*varianceGraphs)[i]->Draw("L*");
-        }
-
         (*varianceGraphs)[i]->SetMarkerSize(3);
-        (*varianceGraphs)[i]->SetMarkerStyle(markers[i]);
-        (*varianceGraphs)[i]->SetLineColor(colors[i]);
+        (*varianceGraphs)[i]->SetMarkerStyle(markers[i % 5]);
+        (*varianceGraphs)[i]->SetLineColor(colors[i % 5]);
 
         graph->Add((*varianceGraphs)[i]);
-        legend->AddEntry((*varianceGraphs)[i], (*varianceGraphs)[i]->GetTitle());
     }
-    c2.Draw();
-    TLegend *l2 = c2.BuildLegend(0.68, 0.72, 0.85, 0.88, "Method");
-    l2->SetName("Method");
-    graph->SetTitle("Centrality Ratios");
-    for (uint32_t j = 0; j < 10; j++) {
-        graph->GetXaxis()->ChangeLabel(-j, 60, .02, -1, -1, -1, Form("%d-%d%%  ", 10 * (j - 1), 10 * j));
+    graph->SetTitle("Centrality Ratios;;#sigma^{2}_{method}/#sigma^{2}_{refmult}");
+    pad.add(graph, "alp");
+    for (uint32_t i = 0; i < varianceGraphs->size(); i++) {
+        pad.addLegendEntry((*varianceGraphs)[i], (*varianceGraphs)[i]->GetTitle(), "lp");
     }
-    graph->GetYaxis()->SetTitle("#sigma^{2}_{method}/#sigma^{2}_{refmult}");
-    graph->Draw("alp");
-    // legend->Draw();
-    l2->Draw();
-    c2.SaveAs("histograms/variances.png");
+    // The multigraph only has axes once it is drawn
+    pad.afterDraw = [graph]() {
+        for (uint32_t j = 0; j < 10; j++) {
+            graph->GetXaxis()->ChangeLabel(-j, 60, .02, -1, -1, -1, Form("%d-%d%%  ", 10 * (j - 1), 10 * j));
+        }
+    };
+    jobs.push_back(varianceJob);
+
+    renderPlots(jobs, renderWorkers);
     rootFile.Close();
     delete varianceGraphs;
 }
@@ -21,13 +21,24 @@
 #include <TCanvas.h>
 #include <TLegend.h>
 #include <TStyle.h>
+#include <TSystem.h>
+#include <TMatrixD.h>
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
 
 #include "quantiles.h"
+#include "centralityClassifier.h"
+#include "instrumentation.h"
+#include "resultSink.h"
 
 const int32_t numberQuantiles = 100;
+const int32_t percentileBins = 200;     // Resolution of the cumulative store, 0.5%
 bool draw = false;
 
 // getQuantileRange creates a histogram of the data in the specified quantile range
@@ -97,13 +108,107 @@ TH2D **getQuantileRange(int lowerQuantile, int upperQuantile, TH2D *histogram, d
     return quantileHistogram;
 }
 
-TH1D ***quantileAnalysis(TH2D *histogram, const char *keyName) {
+// getPercentileBoundaries fills the percentileBins - 1 boundaries between the
+// percentile slices of the selection axis (0 = RefMult, 1 = X_zeta')
+void getPercentileBoundaries(TH2D *histogram, int axis, double *boundaries) {
+    TH1D *selectionProjection = axis == 0 ? histogram->ProjectionX("selection_px") : histogram->ProjectionY("selection_py");
+    double probabilities[percentileBins - 1];
+    for (uint32_t i = 0; i < percentileBins - 1; i++) {
+        probabilities[i] = double(i + 1) / percentileBins;
+    }
+    selectionProjection->GetQuantiles(percentileBins - 1, boundaries, probabilities);
+    delete selectionProjection;
+}
+
+// getSliceCounts sorts every event of the histogram into a percentile slice of the
+// selection axis and projects each slice onto RefMult.  Slice k holds the events
+// between boundary k - 1 and k, returned as a flat percentileBins x nBinsX array.
+std::vector<double> getSliceCounts(TH2D *histogram, int axis) {
+    int32_t nBinsX = histogram->GetNbinsX();
+    int32_t nBinsY = histogram->GetNbinsY();
+    TAxis *selectionAxis = axis == 0 ? histogram->GetXaxis() : histogram->GetYaxis();
+
+    double boundaries[percentileBins - 1];
+    getPercentileBoundaries(histogram, axis, boundaries);
+
+    // The slice only depends on the bin of the selection axis, so look it up once per bin
+    uint32_t nSelectionBins = axis == 0 ? nBinsX : nBinsY;
+    std::vector<uint32_t> sliceOfBin(nSelectionBins);
+    for (uint32_t i = 0; i < nSelectionBins; i++) {
+        double center = selectionAxis->GetBinCenter(i + 1);
+        sliceOfBin[i] = std::lower_bound(boundaries, boundaries + percentileBins - 1, center) - boundaries;
+    }
+
+    std::vector<double> sliceCounts(percentileBins * nBinsX, 0);
+    for (uint32_t i = 0; i < nBinsX; i++) {
+        for (uint32_t j = 0; j < nBinsY; j++) {
+            uint32_t slice = sliceOfBin[axis == 0 ? i : j];
+            sliceCounts[slice * nBinsX + i] += histogram->GetBinContent(i + 1, j + 1);
+        }
+    }
+    return sliceCounts;
+}
+
+// getCumulativeQuantiles stores the RefMult projection of everything below each
+// percentile edge.  Bin e of the x axis is centered on percentile 100 * e / percentileBins,
+// so the projection of any range [low, high) is row(high) - row(low).
+TH2D *getCumulativeQuantiles(TH2D *histogram, int axis, const char *name, const char *keyName) {
+    int32_t nBinsX = histogram->GetNbinsX();
+    std::vector<double> sliceCounts = getSliceCounts(histogram, axis);
+
+    double halfStep = 50. / percentileBins;
+    TH2D *cumulative = new TH2D(name, keyName,
+                                percentileBins + 1, -halfStep, 100 + halfStep,
+                                nBinsX, histogram->GetXaxis()->GetXmin(), histogram->GetXaxis()->GetXmax());
+    cumulative->SetXTitle("Percentile");
+    cumulative->SetYTitle("Multiplicity");
+
+    std::vector<double> runningSum(nBinsX, 0);
+    for (uint32_t edge = 1; edge <= percentileBins; edge++) {
+        for (uint32_t i = 0; i < nBinsX; i++) {
+            runningSum[i] += sliceCounts[(edge - 1) * nBinsX + i];
+            cumulative->SetBinContent(edge + 1, i + 1, runningSum[i]);
+        }
+    }
+    cumulative->ResetStats();
+    return cumulative;
+}
+
+// writeCutTable freezes the weights and the X_zeta' percentile boundaries of a method
+// into data/cut_tables/<method>.cut so other analyses can classify events with
+// centralityClassifier.h without reading this file
+void writeCutTable(TH2D *histogram, TMatrixD *weights, const char *keyName) {
+    double boundaries[percentileBins - 1];
+    getPercentileBoundaries(histogram, 1, boundaries);
+
+    double ringWeights[16];
+    for (uint32_t i = 0; i < 16; i++) {
+        ringWeights[i] = (*weights)[i][0];
+    }
+
+    gSystem->mkdir("data/cut_tables", true);
+    const char *fileName = Form("data/cut_tables/%s.cut", keyName);
+    if (!CentralityClassifier::write(fileName, ringWeights, 16, (*weights)[16][0],
+                                     boundaries, percentileBins - 1, 100. / percentileBins)) {
+        std::cerr << "Could not write cut table " << fileName << std::endl;
+    }
+}
+
+TH2D **quantileAnalysis(TH2D *histogram, const char *keyName) {
     // Storing the quantiles
     double xxQuantiles[numberQuantiles];    // X axis x coordinate
     double yxQuantiles[numberQuantiles];    // y axis x coordinate
     double xyQuantiles[numberQuantiles];    // x axis y coordinate
     double yyQuantiles[numberQuantiles];    // y axis y coordinate
 
+    TH2D **cumulativeQuantiles = (TH2D**)malloc(sizeof(TH2D*) * 2);
+    cumulativeQuantiles[0] = getCumulativeQuantiles(histogram, 0, "tpc_cumulative", keyName);
+    cumulativeQuantiles[1] = getCumulativeQuantiles(histogram, 1, "epd_cumulative", keyName);
+
+    if (!draw) {
+        return cumulativeQuantiles;
+    }
+
     TH1D *xProjection = histogram->ProjectionX();
     for (uint32_t i = 0; i < numberQuantiles; i++) {
         xxQuantiles[i] = double(i + 1) / numberQuantiles;
@@ -125,20 +230,6 @@ TH1D ***quantileAnalysis(TH2D *histogram, const char *keyName) {
     TGraphQQ *qq = new TGraphQQ(numberQuantiles, yyQuantiles, numberQuantiles, xyQuantiles);
 
 
-    TH2D ***quantileSections = (TH2D***)malloc(sizeof(TH2D**) * 20);
-    TH1D ***quantileProjections = (TH1D***)malloc(sizeof(TH1D**) * 20);
-
-    for (uint32_t i = 0; i < 20; i++) {
-        int minQuant, maxQuant;
-        minQuant = 5 * i;
-        maxQuant = 5 + 5 * i;
-        quantileSections[i] = getQuantileRange(minQuant, maxQuant, histogram, xyQuantiles, yyQuantiles, keyName);
-        quantileProjections[i] = (TH1D**)malloc(sizeof(TH1D*) * 2);
-        quantileProjections[i][0] = quantileSections[i][0]->ProjectionX();
-        quantileProjections[i][0]->SetTitle(Form("tpc_%d%%-%d%%", minQuant, maxQuant));
-        quantileProjections[i][1] = quantileSections[i][1]->ProjectionX();
-        quantileProjections[i][1]->SetTitle(Form("epd_%d%%-%d%%", minQuant, maxQuant));
-    }
     // quantileHistograms[0] = getQuantileRange(0, 10, histogram, xyQuantiles, yyQuantiles, method);
 
 
@@ -261,37 +352,127 @@ TH1D ***quantileAnalysis(TH2D *histogram, const char *keyName) {
         }
         canvas2->Draw();
     }
-    return quantileProjections;
+    return cumulativeQuantiles;
 }
 
-void runQuantileAnalysis(TH2D *input, TDirectory *output, const char *keyName) {
-    // Change this to loop over all the histograms in epd_tpc_relations.root
-    TH1D ***quantileProjectsions = quantileAnalysis(input, keyName);
-    for (uint32_t i = 0; i < 20; i++) {
-        output->WriteObject(quantileProjectsions[i][0], quantileProjectsions[i][0]->GetTitle());
-        output->WriteObject(quantileProjectsions[i][1], quantileProjectsions[i][1]->GetTitle());
+// fillSliceMoments records the moments of the RefMult distribution in every 5% slice of
+// both axes, so quantileSummary can compare variances without touching the histograms
+void fillSliceMoments(TH2D *histogram, const char *keyName, TTree *moments, SliceMoments *row) {
+    int32_t nBinsX = histogram->GetNbinsX();
+    uint32_t binsPerSlice = percentileBins / momentSlices;
+    std::vector<double> centers(nBinsX);
+    for (uint32_t i = 0; i < nBinsX; i++) {
+        centers[i] = histogram->GetXaxis()->GetBinCenter(i + 1);
     }
+
+    strncpy(row->method, keyName, sizeof(row->method) - 1);
+    row->method[sizeof(row->method) - 1] = 0;
+    for (int32_t axis = 0; axis < 2; axis++) {
+        std::vector<double> sliceCounts = getSliceCounts(histogram, axis);
+        for (uint32_t k = 0; k < momentSlices; k++) {
+            // Projection of the slice onto RefMult
+            std::vector<double> projection(nBinsX, 0);
+            for (uint32_t slice = k * binsPerSlice; slice < (k + 1) * binsPerSlice; slice++) {
+                for (uint32_t i = 0; i < nBinsX; i++) {
+                    projection[i] += sliceCounts[slice * nBinsX + i];
+                }
+            }
+
+            double count = 0, sum = 0;
+            for (uint32_t i = 0; i < nBinsX; i++) {
+                count += projection[i];
+                sum += projection[i] * centers[i];
+            }
+            double mean = count > 0 ? sum / count : 0;
+            double m2 = 0, m3 = 0, m4 = 0;
+            for (uint32_t i = 0; i < nBinsX; i++) {
+                double deviation = centers[i] - mean;
+                m2 += projection[i] * deviation * deviation;
+                m3 += projection[i] * deviation * deviation * deviation;
+                m4 += projection[i] * deviation * deviation * deviation * deviation;
+            }
+
+            row->axis = axis;
+            row->low = 100. * k / momentSlices;
+            row->high = 100. * (k + 1) / momentSlices;
+            row->count = count;
+            row->mean = mean;
+            row->variance = count > 0 ? m2 / count : 0;
+            row->skewness = row->variance > 0 ? (m3 / count) / pow(row->variance, 1.5) : 0;
+            row->kurtosis = row->variance > 0 ? (m4 / count) / (row->variance * row->variance) - 3 : 0;
+            moments->Fill();
+        }
+    }
+}
+
+// Queues the cumulative quantiles of a method as quantiles/<method>, they are kept in queued
+// until the sink has committed
+void runQuantileAnalysis(TH2D *input, ResultSink &sink, const char *keyName, std::vector<TObject*> &queued) {
+    TH2D **cumulativeQuantiles = quantileAnalysis(input, keyName);
+    std::string directory = std::string("quantiles/") + keyName;
+    for (uint32_t i = 0; i < 2; i++) {
+        sink.add(directory.c_str(), cumulativeQuantiles[i]->GetName(), cumulativeQuantiles[i]);
+        queued.push_back(cumulativeQuantiles[i]);
+    }
+    free(cumulativeQuantiles);
 }
 
+// Reads the fits of inHistName and writes quantiles/ back through a ResultSink, so the fits and
+// plots running at the same time never see the file half written
 void quantiles(const char *inHistName="data/epd_tpc_relations.root") {
-    TFile rootFile(inHistName, "UPDATE");
+    StageMetrics metrics("quantiles");
+    TFile rootFile(inHistName);
     TDirectory *methods_directory = rootFile.GetDirectory("methods");
-    TDirectory *quantile_directory = rootFile.mkdir("quantiles", "quantiles", true);
+    if (methods_directory == nullptr) {
+        std::cerr << inHistName << " holds no methods, run the fits first" << std::endl;
+        return;
+    }
     TList *keys = methods_directory->GetListOfKeys();
     TH2D *inputHistogram;
+
+    ResultSink sink(inHistName, "quantiles");
+    std::vector<TObject*> queued;
+    SliceMoments row;
+    TTree *moments = new TTree("slice_moments", "RefMult moments per method and 5% slice");
+    moments->SetDirectory(nullptr);     // In memory until the sink writes it
+    branchSliceMoments(moments, &row);
+    queued.push_back(moments);
     // std::vector<const char*> histograms;
     
     // Get names of histograms
     for (TIter key = keys->begin(); key != keys->end(); ++key) {
         const char *keyName = (*key)->GetName();
-        std::cout << keyName << std::endl;
+        // The methods directory also holds the weight matrices, only histograms get quantiles
+        inputHistogram = nullptr;
         methods_directory->GetObject(keyName, inputHistogram);
-        runQuantileAnalysis(inputHistogram, quantile_directory->mkdir(keyName, keyName, true), keyName);
+        if (inputHistogram == nullptr) {
+            continue;
+        }
+        std::cout << keyName << std::endl;
+        ScopedTimer timer("quantile_analysis");
+        metrics.addEvents(inputHistogram->GetEntries());
+        runQuantileAnalysis(inputHistogram, sink, keyName, queued);
+        fillSliceMoments(inputHistogram, keyName, moments, &row);
+
+        // Methods store their weights next to the histogram as <method>_weights
+        TMatrixD *weights = nullptr;
+        methods_directory->GetObject(Form("%s_weights", keyName), weights);
+        if (weights == nullptr || weights->GetNrows() != 17) {
+            std::cout << "No weights stored for " << keyName << ", skipping cut table" << std::endl;
+            continue;
+        }
+        writeCutTable(inputHistogram, weights, keyName);
+        delete weights;
+    }
+    sink.add("quantiles", "slice_moments", moments);
+    if (!sink.commit()) {
+        std::cerr << "Could not write the quantiles to " << inHistName << std::endl;
+    }
+    for (uint32_t i = 0; i < queued.size(); i++) {
+        delete queued[i];
     }
 
 
     rootFile.Close();
     return;
-
-
-}
\ No newline at end of file
+}
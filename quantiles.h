@@ -3,9 +3,49 @@
 
 #include "TROOT.h"
 #include "TH2D.h"
+#include "TTree.h"
 
-void quantileAnalysis(TH2D *histogram);
+// Returns the tpc and epd cumulative percentile x multiplicity histograms
+TH2D **quantileAnalysis(TH2D *histogram, const char *keyName);
 
+// One row of quantiles/slice_moments: moments of the RefMult distribution of the events
+// in one 5% slice of the tpc (axis 0) or epd (axis 1) percentiles of a method
+const int32_t momentSlices = 20;
+struct SliceMoments {
+    char method[64];
+    int32_t axis;
+    double low;
+    double high;
+    double count;
+    double mean;
+    double variance;
+    double skewness;
+    double kurtosis;    // Excess kurtosis, like TH1::GetKurtosis
+};
 
-#endif // QUANTILES
+inline void branchSliceMoments(TTree *tree, SliceMoments *row) {
+    tree->Branch("method", row->method, "method/C");
+    tree->Branch("axis", &row->axis, "axis/I");
+    tree->Branch("low", &row->low, "low/D");
+    tree->Branch("high", &row->high, "high/D");
+    tree->Branch("count", &row->count, "count/D");
+    tree->Branch("mean", &row->mean, "mean/D");
+    tree->Branch("variance", &row->variance, "variance/D");
+    tree->Branch("skewness", &row->skewness, "skewness/D");
+    tree->Branch("kurtosis", &row->kurtosis, "kurtosis/D");
+}
+
+inline void readSliceMoments(TTree *tree, SliceMoments *row) {
+    tree->SetBranchAddress("method", row->method);
+    tree->SetBranchAddress("axis", &row->axis);
+    tree->SetBranchAddress("low", &row->low);
+    tree->SetBranchAddress("high", &row->high);
+    tree->SetBranchAddress("count", &row->count);
+    tree->SetBranchAddress("mean", &row->mean);
+    tree->SetBranchAddress("variance", &row->variance);
+    tree->SetBranchAddress("skewness", &row->skewness);
+    tree->SetBranchAddress("kurtosis", &row->kurtosis);
+}
 
+
+#endif // QUANTILES
@@ -0,0 +1,96 @@
+/**
+ * \brief Rewrites an event store with ring sums rebuilt from its hit store, with a
+ *        different nMIP clamp than the ingest's [0.2, 3], so trying a clamp no
+ *        longer needs the picoDsts.  RefMult and the extra detector columns are
+ *        copied, and the hits go along so the new store can be rebuilt again.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#include <iostream>
+#include <vector>
+
+// Root headers
+#include "TMatrixD.h"
+#include "TROOT.h"
+#include "TVectorD.h"
+
+#include "epdHits.h"
+#include "eventStore.h"
+#include "hitStore.h"
+#include "instrumentation.h"
+
+void rebuildStore(const char *inFileName = "data/detector_data.root",
+                  const char *outFileName = "data/detector_data_rebuilt.root",
+                  float low = nMipThreshold, float high = nMipCeiling) {
+    StageMetrics metrics("rebuildStore");
+    HitStore *hits = HitStore::open(inFileName);
+    TVectorD *tpc = readColumn(inFileName, "tpc_multiplicity");
+    if (hits == nullptr || tpc == nullptr) {
+        return;
+    }
+    uint64_t numEvents = hits->numberOfEvents();
+    if (numEvents != (uint64_t)tpc->GetNrows()) {
+        std::cerr << "Hits and tpc_multiplicity of " << inFileName << " disagree on the number of events" << std::endl;
+        return;
+    }
+    metrics.addEvents(numEvents, hits->numberOfHits() * sizeof(uint32_t));
+
+    TMatrixD *rings;
+    {
+        ScopedTimer timer("rebuild_rings", numEvents, hits->numberOfHits() * sizeof(uint32_t));
+        rings = rebuildRingSums(*hits, low, high);
+    }
+    std::cout << "Rebuilt the ring sums of " << numEvents << " events with nMIP clamped to [" << low << ", "
+              << high << "]" << std::endl;
+
+    // The detector columns the ingest writes, when the input has them
+    const char *columnNames[] = {"tof_multiplicity", "run_id", "vz"};
+    const char columnTypes[] = {'s', 'i', 'F'};
+    std::vector<uint32_t> outColumns;
+    std::vector<TVectorD*> columns;
+    EventStoreWriter store(outFileName);
+    store.enableHits();
+    for (uint32_t i = 0; i < 3; i++) {
+        if (eventStoreHasColumn(inFileName, columnNames[i])) {
+            columns.push_back(readColumn(inFileName, columnNames[i]));
+            outColumns.push_back(store.addColumn(columnNames[i], columnTypes[i]));
+        }
+    }
+    if (!store.good()) {
+        return;
+    }
+
+    ScopedTimer timer("store_write", numEvents);
+    const uint64_t *offsets = hits->offsets();
+    const uint32_t *packed = hits->hits();
+    const double *ringArray = rings->GetMatrixArray();
+    float sums[eventStoreRings];
+    for (uint64_t j = 0; j < numEvents; j++) {
+        for (uint32_t r = 0; r < eventStoreRings; r++) {
+            sums[r] = ringArray[r * numEvents + j];
+        }
+        for (uint32_t c = 0; c < columns.size(); c++) {
+            if (columns[c] != nullptr) {
+                store.setColumn(outColumns[c], (*columns[c])[j]);
+            }
+        }
+        for (uint64_t i = offsets[j]; i < offsets[j + 1]; i++) {
+            store.addHit(hitTile(packed[i]), hitNmip(packed[i]));
+        }
+        store.fill(sums, (*tpc)[j]);
+    }
+    store.close();
+    std::cout << "Wrote " << outFileName << std::endl;
+
+    for (uint32_t c = 0; c < columns.size(); c++) {
+        delete columns[c];
+    }
+    delete rings;
+    delete tpc;
+    delete hits;
+}
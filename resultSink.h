@@ -0,0 +1,263 @@
+/**
+ * \brief Lets several methods write into data/epd_tpc_relations.root at the same
+ *        time.  Producers queue named outputs (safe across threads), commit()
+ *        writes them to a per-producer shard file and merges the shard into the
+ *        target.  The merge holds an exclusive lock on <target>.lock, works on a
+ *        private copy of the target and renames it into place, so a reader or a
+ *        crashed producer never sees a half written file.
+ *
+ *        Usage:
+ *            ResultSink sink("data/epd_tpc_relations.root", "linear");
+ *            sink.add("methods", "linear", predictVsReal);
+ *            sink.add("methods", "linear_weights", weights);
+ *            sink.commit();
+ *
+ *        Queued objects are not copied, they have to stay alive until commit().
+ *        Large trees come from createTree() instead, which makes them in the
+ *        shard file itself: their baskets go to disk as they fill, and commit()
+ *        writes and deletes them.
+ *
+ *        Every merge copies the whole target before adding the shard, so a commit
+ *        costs the size of the target, not of the shard.  That is fine for the
+ *        relations files (histograms and small tables); a producer with a lot of
+ *        data commits it once rather than in pieces.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#ifndef RESULT_SINK
+#define RESULT_SINK
+
+#include <TROOT.h>
+#include <TFile.h>
+#include <TKey.h>
+#include <TList.h>
+#include <TSystem.h>
+#include <TTree.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "instrumentation.h"
+
+class ResultSink {
+public:
+    ResultSink(const char *target = "data/epd_tpc_relations.root", const char *producer = "results")
+        : targetFile(target), producerName(producer) {}
+
+    // A shard left open by createTree() without a commit() is dropped
+    ~ResultSink() {
+        if (shard != nullptr) {
+            shard->Close();
+            delete shard;
+            unlink(shardTemporary.c_str());
+        }
+    }
+
+    // Queues object to be written as directory/name, directory may be nested ("quantiles/linear")
+    void add(const char *directory, const char *name, TObject *object) {
+        std::lock_guard<std::mutex> guard(queueLock);
+        Entry entry;
+        entry.directory = directory;
+        entry.name = name;
+        entry.object = object;
+        queue.push_back(entry);
+    }
+
+    // A tree to be written as directory/name, made in the shard so it is flushed to disk while it
+    // fills.  The sink owns it, commit() writes and deletes it.  nullptr when the shard could not
+    // be created.
+    TTree *createTree(const char *directory, const char *name, const char *title) {
+        std::lock_guard<std::recursive_mutex> commitGuard(processLock());
+        if (!openShard()) {
+            return nullptr;
+        }
+        TDirectory *previous = gDirectory;
+        TTree *tree = new TTree(name, title);
+        tree->SetDirectory(makeDirectory(shard, directory));
+        previous->cd();
+        std::lock_guard<std::mutex> guard(queueLock);
+        trees.push_back(tree);
+        return tree;
+    }
+
+    // Shards live in a shards directory next to the target, one per target and producer
+    std::string shardFile() const {
+        size_t slash = targetFile.find_last_of('/');
+        std::string directory = slash == std::string::npos ? "." : targetFile.substr(0, slash);
+        std::string base = slash == std::string::npos ? targetFile : targetFile.substr(slash + 1);
+        base = base.substr(0, base.find_last_of('.'));
+        return directory + "/shards/" + base + "." + producerName + ".root";
+    }
+
+    // Writes everything queued so far to the shard and merges it into the target
+    bool commit() {
+        ScopedTimer timer("result_sink_commit");
+        std::lock_guard<std::recursive_mutex> commitGuard(processLock());
+        std::vector<Entry> entries;
+        std::vector<TTree*> filled;
+        {
+            std::lock_guard<std::mutex> guard(queueLock);
+            entries.swap(queue);
+            filled.swap(trees);
+        }
+        if (!openShard()) {
+            return false;
+        }
+        for (uint32_t i = 0; i < entries.size(); i++) {
+            makeDirectory(shard, entries[i].directory)->WriteTObject(entries[i].object, entries[i].name.c_str(), "Overwrite");
+        }
+        for (uint32_t i = 0; i < filled.size(); i++) {
+            filled[i]->GetDirectory()->cd();
+            filled[i]->Write(filled[i]->GetName(), TObject::kOverwrite);
+        }
+        shard->Close();         // Deletes the trees with the file
+        delete shard;
+        shard = nullptr;
+        std::string shardName = shardFile();
+        if (rename(shardTemporary.c_str(), shardName.c_str()) != 0) {
+            std::cerr << "Could not move " << shardTemporary << " to " << shardName << std::endl;
+            return false;
+        }
+        return mergeShard(shardName.c_str(), targetFile.c_str());
+    }
+
+    // Copies every object of shard into target, replacing objects with the same path.
+    // The file lock keeps other processes out, the mutex other threads of this one.
+    static bool mergeShard(const char *shard, const char *target) {
+        std::lock_guard<std::recursive_mutex> guard(processLock());
+        int lockFile = open(Form("%s.lock", target), O_CREAT | O_RDWR, 0644);
+        if (lockFile < 0 || flock(lockFile, LOCK_EX) != 0) {
+            std::cerr << "Could not lock " << target << std::endl;
+            if (lockFile >= 0) {
+                close(lockFile);
+            }
+            return false;
+        }
+
+        std::string temporary = uniqueName(target);
+        bool good = true;
+        if (!gSystem->AccessPathName(target)) {   // False when the file exists
+            good = TFile::Cp(target, temporary.c_str(), false);
+        }
+        TFile *input = good ? TFile::Open(shard) : nullptr;
+        TFile *output = good ? TFile::Open(temporary.c_str(), "UPDATE") : nullptr;
+        good = input != nullptr && !input->IsZombie() && output != nullptr && !output->IsZombie();
+        if (good) {
+            copyDirectory(input, output);
+            output->Close();
+            input->Close();
+            good = rename(temporary.c_str(), target) == 0;
+        }
+        if (!good) {
+            std::cerr << "Could not merge " << shard << " into " << target << std::endl;
+            unlink(temporary.c_str());
+        }
+        delete input;
+        delete output;
+
+        flock(lockFile, LOCK_UN);
+        close(lockFile);
+        return good;
+    }
+
+private:
+    struct Entry {
+        std::string directory;
+        std::string name;
+        TObject *object;
+    };
+
+    std::string targetFile;
+    std::string producerName;
+    std::mutex queueLock;
+    std::vector<Entry> queue;
+    std::vector<TTree*> trees;
+    TFile *shard = nullptr;                 // Open from the first createTree() or commit()
+    std::string shardTemporary;
+
+    // Opens the temporary shard this sink writes into, unless it is open already
+    bool openShard() {
+        if (shard != nullptr) {
+            return true;
+        }
+        std::string shardName = shardFile();
+        gSystem->mkdir(shardName.substr(0, shardName.find_last_of('/')).c_str(), true);
+        shardTemporary = uniqueName(shardName);
+        TDirectory *previous = gDirectory;
+        shard = TFile::Open(shardTemporary.c_str(), "RECREATE");
+        previous->cd();
+        if (shard == nullptr || shard->IsZombie()) {
+            std::cerr << "Could not create shard " << shardTemporary << std::endl;
+            delete shard;
+            shard = nullptr;
+            return false;
+        }
+        return true;
+    }
+
+    static std::recursive_mutex &processLock() {
+        static std::recursive_mutex lock;
+        return lock;
+    }
+
+    // Unique per process and thread, so concurrent committers never share a temporary file
+    static std::string uniqueName(const std::string &file) {
+        return file + Form(".tmp.%d.%zu", getpid(), std::hash<std::thread::id>()(std::this_thread::get_id()));
+    }
+
+    static TDirectory *makeDirectory(TDirectory *base, const std::string &path) {
+        TDirectory *directory = base;
+        size_t start = 0;
+        while (start < path.size()) {
+            size_t slash = path.find('/', start);
+            std::string name = path.substr(start, slash == std::string::npos ? std::string::npos : slash - start);
+            if (!name.empty()) {
+                directory = directory->mkdir(name.c_str(), name.c_str(), true);
+            }
+            start = slash == std::string::npos ? path.size() : slash + 1;
+        }
+        return directory;
+    }
+
+    static void copyDirectory(TDirectory *input, TDirectory *output) {
+        TIter next(input->GetListOfKeys());
+        TKey *key;
+        while ((key = (TKey*)next())) {
+            if (key->GetCycle() != input->GetKey(key->GetName())->GetCycle()) {
+                continue;   // Only the newest cycle of every key
+            }
+            if (strcmp(key->GetClassName(), "TDirectoryFile") == 0) {
+                copyDirectory(input->GetDirectory(key->GetName()), output->mkdir(key->GetName(), key->GetTitle(), true));
+                continue;
+            }
+            TObject *object = key->ReadObj();
+            if (object->InheritsFrom("TTree")) {
+                // Trees keep their baskets in the shard, so they have to be copied rather than rewritten
+                output->cd();
+                TTree *copy = ((TTree*)object)->CloneTree(-1, "fast");
+                copy->Write(key->GetName(), TObject::kOverwrite);
+                delete copy;
+            }
+            else {
+                output->WriteTObject(object, key->GetName(), "Overwrite");
+            }
+            delete object;
+        }
+    }
+};
+
+#endif // RESULT_SINK
@@ -23,11 +23,19 @@
 #include "TStyle.h"
 #include "TVectorD.h"
 
+#include "eventStore.h"
+#include "histogramEngine.h"
+#include "instrumentation.h"
+#include "resultSink.h"
+
+namespace ridge {
+
 const uint32_t dim = 17;
 
 // Takes the data matrix c and global vector g and generates 
 // weights relating the two using ridge regression
 TMatrixD* generateWeights(const TMatrixD *c, const TVectorD * g, float alpha) {
+    ScopedTimer timer("ridge_weights", c->GetNcols());
     TMatrixD* data = new TMatrixD(c->GetNrows() + 1, c->GetNcols());
     TMatrixD* expected = new TMatrixD(dim, 1);
     TMatrixD* identity = new TMatrixD(dim, dim);
@@ -86,6 +94,7 @@ TMatrixD* generateWeights(const TMatrixD *c, const TVectorD * g, float alpha) {
 // Uses the generated weights and the truncated nMIPs data to predict TPC multiplicity
 // X_t = sum_r W_r * C_{r, t}
 TVectorD* predictTPCMultiplicity(TMatrixD *weights, TMatrixD *epdData) {
+    ScopedTimer timer("ridge_predict", epdData->GetNcols());
     uint32_t numEvents = epdData->GetNcols();
     TVectorD *predictedTCPMultiplicity = new TVectorD(numEvents);   // Store our guesses
     for (uint32_t i = 0; i < numEvents; i++) {
@@ -101,24 +110,27 @@ TVectorD* predictTPCMultiplicity(TMatrixD *weights, TMatrixD *epdData) {
     return predictedTCPMultiplicity;
 }
 
+} // namespace ridge
+
 void ridgeRegression(const char *inFileName = "data/detector_data.root", float alpha=-1e5) {
+    StageMetrics metrics("ridgeRegression");
     std::cout << "Running..." <<std::endl;
     
-    TFile inFile(inFileName);
-    TMatrixD *c;
-    TVectorD *g;
-    inFile.GetObject("ring_sums", c);           // should probably check for existance but...
-    inFile.GetObject("tpc_multiplicity", g);
+    TMatrixD *c = loadRingSums(inFileName);
+    TVectorD *g = loadColumn(inFileName, "tpc_multiplicity");
+    if (c == nullptr || g == nullptr) {
+        return;
+    }
+    metrics.addEvents(c->GetNcols(), c->GetNcols() * 17. * sizeof(double));
 
     std::cout << "Generating Weights.." << std::endl;
-    TMatrixD *weights = generateWeights(c, g, alpha);
+    TMatrixD *weights = ridge::generateWeights(c, g, alpha);
     std::cout << "Weights Generated" << std::endl;
     std::cout << "Weights:\n";
     weights->Print();
 
     std::cout << "Applying linear weights..." << std::endl;
-    TVectorD *predictions = predictTPCMultiplicity(weights, c);
-    inFile.Close();
+    TVectorD *predictions = ridge::predictTPCMultiplicity(weights, c);
 
 
     uint32_t predictBins = 200;
@@ -129,18 +141,24 @@ void ridgeRegression(const char *inFileName = "data/detector_data.root", float a
     int32_t realMin = 0;
     int32_t realMax = 350; 
     
-    TH2D *ridge_histogram = new TH2D(Form("alpha=%.0e", alpha), Form("alpha=%.0e;RefMult1; X'_{#zeta'}", alpha),
-                                  realBins, realMin, realMax,
-                                  predictBins, predictMin, predictMax);
-    for (uint32_t i = 0; i < g->GetNrows(); i++) {
-        ridge_histogram->Fill((*g)[i], (*predictions)[i]);
+    Histogram2D counts(realBins, realMin, realMax, predictBins, predictMin, predictMax);
+    {
+        ScopedTimer timer("fill_histograms", g->GetNrows());
+        counts.fill(g->GetMatrixArray(), predictions->GetMatrixArray(), g->GetNrows());
     }
+    TH2D *ridge_histogram = counts.toTH2D(Form("alpha=%.0e", alpha), Form("alpha=%.0e;RefMult1; X'_{#zeta'}", alpha));
     
-    TFile outFile("data/epd_tpc_relations.root", "UPDATE");
-    outFile.mkdir("methods", "methods", true);
-    outFile.cd("methods");
-    ridge_histogram->Write(Form("ridge_%.0e", alpha));
-    outFile.Close();
+    ResultSink sink("data/epd_tpc_relations.root", Form("ridge_%.0e", alpha));
+    sink.add("methods", Form("ridge_%.0e", alpha), ridge_histogram);
+    // Stored in the linear weights layout (rings 0-15, bias 16) for the cut tables,
+    // predictTPCMultiplicity doesn't apply the bias so neither does this
+    TMatrixD *linearLayout = new TMatrixD(ridge::dim, 1);
+    for (uint32_t i = 0; i < ridge::dim - 1; i++) {
+        (*linearLayout)[i][0] = (*weights)[i + 1][0];
+    }
+    (*linearLayout)[ridge::dim - 1][0] = 0;
+    sink.add("methods", Form("ridge_%.0e_weights", alpha), linearLayout);
+    sink.commit();
 
     bool draw = true;
     if (!draw) {
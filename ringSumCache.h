@@ -0,0 +1,291 @@
+/**
+ * \brief Flat binary sidecar of the ring sums, so fitters can mmap them instead
+ *        of deserializing the event store on every start.  data/foo.root gets
+ *        data/foo.ringcache, laid out as
+ *
+ *            RingCacheHeader                      (padded to 4096 bytes)
+ *            ring 0 of every event, ring 1, ...   (floats, rows of ring_sums)
+ *            tpc_multiplicity of every event      (uint16, page aligned)
+ *
+ *        These are the types of the event store, so nothing is lost, at half the
+ *        size of doubles.  Only event stores are cached, the old files of whole
+ *        TMatrixD objects hold doubles.  The float path (FloatRingSums in
+ *        eventStore.h) works on the mapping directly; the TMatrixD loaders copy
+ *        from it and release() its pages.  The header
+ *        records the size, modification time and checksum of the source file.
+ *        A cache whose source only got a new time stamp is accepted after the
+ *        checksum matches, any other change makes the loaders rebuild it.
+ *
+ *        Set EPD_RING_CACHE=0 to bypass the cache.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#ifndef RING_SUM_CACHE
+#define RING_SUM_CACHE
+
+#include <TROOT.h>
+#include <TMatrixD.h>
+#include <TVectorD.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+const char ringCacheMagic[8] = "EPDRSUM";
+const uint32_t ringCacheVersion = 2;      // 1 held doubles
+const uint64_t ringCacheAlignment = 4096;
+
+struct RingCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nRings;
+    uint64_t nEvents;
+    uint64_t ringOffset;        // Bytes from the start of the file, page aligned
+    uint64_t tpcOffset;
+    uint64_t sourceSize;
+    int64_t sourceModified;     // ns since the epoch
+    uint64_t sourceChecksum;
+};
+
+inline bool ringCacheEnabled() {
+    const char *setting = getenv("EPD_RING_CACHE");
+    return setting == nullptr || strcmp(setting, "0") != 0;
+}
+
+// data/detector_data.root -> data/detector_data.ringcache
+inline std::string ringCacheFile(const char *source) {
+    std::string file = source;
+    size_t dot = file.find_last_of('.');
+    if (dot != std::string::npos && file.find('/', dot) == std::string::npos) {
+        file = file.substr(0, dot);
+    }
+    return file + ".ringcache";
+}
+
+inline uint64_t alignCacheOffset(uint64_t offset) {
+    return (offset + ringCacheAlignment - 1) / ringCacheAlignment * ringCacheAlignment;
+}
+
+// 64 bit words mixed with a multiply and rotate, fast enough to hash a few GB at disk speed
+inline uint64_t fileChecksum(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) {
+        return 0;
+    }
+    const size_t chunk = 1 << 20;
+    uint64_t *buffer = (uint64_t*)malloc(chunk);
+    uint64_t hash = 14695981039346656037ull;
+    size_t length;
+    while ((length = fread(buffer, 1, chunk, file)) > 0) {
+        if (length % 8 != 0) {
+            memset((char*)buffer + length, 0, 8 - length % 8);
+        }
+        for (size_t i = 0; i < (length + 7) / 8; i++) {
+            hash = (hash ^ buffer[i]) * 0x9E3779B97F4A7C15ull;
+            hash = (hash << 31) | (hash >> 33);
+        }
+        hash ^= length;
+    }
+    free(buffer);
+    fclose(file);
+    return hash;
+}
+
+inline bool sourceStatus(const char *source, uint64_t &size, int64_t &modified) {
+    struct stat status;
+    if (stat(source, &status) != 0) {
+        return false;
+    }
+    size = status.st_size;
+    modified = int64_t(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+    return true;
+}
+
+class RingSumCache {
+public:
+    // The mapping of source's cache, nullptr when the cache is missing or stale.  Mappings stay
+    // for the rest of the process, the float path hands out pointers into them.  A mapping is
+    // reused while the source keeps its size and time stamp; once the source changes (an ingest
+    // or rebuild rerun in the same session) it leaves the registry and the cache is checked again.
+    static RingSumCache *open(const char *source) {
+        std::lock_guard<std::mutex> guard(registryLock());
+        std::map<std::string, RingSumCache*> &caches = registry();
+        std::map<std::string, RingSumCache*>::iterator found = caches.find(source);
+        if (found != caches.end()) {
+            uint64_t size;
+            int64_t modified;
+            const RingCacheHeader &mapped = found->second->header;
+            if (sourceStatus(source, size, modified) && size == mapped.sourceSize && modified == mapped.sourceModified) {
+                return found->second;
+            }
+            caches.erase(found);        // Stays mapped for whoever still points into it
+        }
+
+        std::string cacheFile = ringCacheFile(source);
+        int descriptor = ::open(cacheFile.c_str(), O_RDWR);
+        if (descriptor < 0) {
+            return nullptr;
+        }
+        struct stat status;
+        RingCacheHeader header;
+        if (fstat(descriptor, &status) != 0 || pread(descriptor, &header, sizeof(header), 0) != sizeof(header) ||
+            !valid(header, status.st_size, source, descriptor)) {
+            close(descriptor);
+            return nullptr;
+        }
+        // Read only, the float path hands out pointers into it
+        void *mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        close(descriptor);
+        if (mapping == MAP_FAILED) {
+            std::cerr << "Could not map " << cacheFile << std::endl;
+            return nullptr;
+        }
+        madvise(mapping, status.st_size, MADV_SEQUENTIAL);
+
+        RingSumCache *cache = new RingSumCache();
+        cache->mapping = (char*)mapping;
+        cache->length = status.st_size;
+        cache->header = header;
+        caches[source] = cache;
+        return cache;
+    }
+
+    // Writes the cache of source from its ring sums and RefMult, replacing any old cache atomically
+    static bool build(const char *source, const TMatrixD *rings, const TVectorD *tpc) {
+        RingCacheHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, ringCacheMagic, sizeof(header.magic));
+        header.version = ringCacheVersion;
+        header.nRings = rings->GetNrows();
+        header.nEvents = rings->GetNcols();
+        header.ringOffset = alignCacheOffset(sizeof(header));
+        header.tpcOffset = alignCacheOffset(header.ringOffset + header.nRings * header.nEvents * sizeof(float));
+        if (tpc->GetNrows() != (int64_t)header.nEvents || !sourceStatus(source, header.sourceSize, header.sourceModified)) {
+            return false;
+        }
+        header.sourceChecksum = fileChecksum(source);
+
+        std::string cacheFile = ringCacheFile(source);
+        std::string temporary = cacheFile + Form(".tmp.%d", getpid());
+        int descriptor = ::open(temporary.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        if (descriptor < 0) {
+            std::cerr << "Could not create " << temporary << std::endl;
+            return false;
+        }
+        // The values came from the float and 16 bit columns of an event store, so the conversion
+        // back is exact
+        std::vector<float> ringValues(header.nRings * header.nEvents);
+        const double *ringArray = rings->GetMatrixArray();
+        for (uint64_t i = 0; i < ringValues.size(); i++) {
+            ringValues[i] = ringArray[i];
+        }
+        std::vector<uint16_t> tpcValues(header.nEvents);
+        const double *tpcArray = tpc->GetMatrixArray();
+        for (uint64_t j = 0; j < header.nEvents; j++) {
+            tpcValues[j] = tpcArray[j] <= 0 ? 0 : tpcArray[j] >= 65535 ? 65535 : uint16_t(tpcArray[j] + 0.5);
+        }
+        bool good = writeAt(descriptor, &header, sizeof(header), 0) &&
+                    writeAt(descriptor, ringValues.data(), ringValues.size() * sizeof(float), header.ringOffset) &&
+                    writeAt(descriptor, tpcValues.data(), tpcValues.size() * sizeof(uint16_t), header.tpcOffset);
+        good = close(descriptor) == 0 && good;
+        if (good) {
+            good = rename(temporary.c_str(), cacheFile.c_str()) == 0;
+        }
+        if (!good) {
+            std::cerr << "Could not write " << cacheFile << std::endl;
+            unlink(temporary.c_str());
+        }
+        return good;
+    }
+
+    uint32_t numberOfRings() const {
+        return header.nRings;
+    }
+
+    uint64_t numberOfEvents() const {
+        return header.nEvents;
+    }
+
+    const float *ring(uint32_t r) const {
+        return (const float*)(mapping + header.ringOffset) + r * header.nEvents;
+    }
+
+    const uint16_t *tpcMultiplicity() const {
+        return (const uint16_t*)(mapping + header.tpcOffset);
+    }
+
+    // Drops the pages of the mapping from the process once a loader has copied what it needs.
+    // The mapping stays valid, pages read again come back from the file.
+    void release() const {
+        madvise(mapping, length, MADV_DONTNEED);
+    }
+
+private:
+    char *mapping = nullptr;
+    uint64_t length = 0;
+    RingCacheHeader header;
+
+    static std::map<std::string, RingSumCache*> &registry() {
+        static std::map<std::string, RingSumCache*> caches;
+        return caches;
+    }
+
+    static std::mutex &registryLock() {
+        static std::mutex lock;
+        return lock;
+    }
+
+    static bool writeAt(int descriptor, const void *data, uint64_t length, uint64_t offset) {
+        const char *bytes = (const char*)data;
+        while (length > 0) {
+            ssize_t written = pwrite(descriptor, bytes, length, offset);
+            if (written <= 0) {
+                return false;
+            }
+            bytes += written;
+            length -= written;
+            offset += written;
+        }
+        return true;
+    }
+
+    // Size and time stamp decide in the common case, the checksum only when the time stamp moved
+    static bool valid(RingCacheHeader &header, uint64_t cacheSize, const char *source, int descriptor) {
+        if (memcmp(header.magic, ringCacheMagic, sizeof(header.magic)) != 0 || header.version != ringCacheVersion ||
+            cacheSize < header.tpcOffset + header.nEvents * sizeof(uint16_t)) {
+            return false;
+        }
+        uint64_t size;
+        int64_t modified;
+        if (!sourceStatus(source, size, modified) || size != header.sourceSize) {
+            return false;
+        }
+        if (modified == header.sourceModified) {
+            return true;
+        }
+        if (fileChecksum(source) != header.sourceChecksum) {
+            return false;
+        }
+        header.sourceModified = modified;
+        pwrite(descriptor, &header, sizeof(header), 0);
+        return true;
+    }
+};
+
+#endif // RING_SUM_CACHE
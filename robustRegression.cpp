@@ -0,0 +1,251 @@
+/**
+ * \brief Robust linear weights correlating the EPD nMIP data to the TPC
+ *        multiplicity.  Least squares is pulled by pile up and other outliers that
+ *        get past the TOF/TPC cut, so this minimizes a Huber or Tukey bisquare loss
+ *        instead, with iteratively reweighted least squares (IRLS).
+ *
+ *        It starts from the least squares weights.  Each iteration is then a single
+ *        multithreaded pass that computes every event's residual, its robust weight
+ *        and the weighted Gram matrix (gram.h), and histograms |residual| for the
+ *        scale of the next iteration.  The scale is the MAD, median |residual| /
+ *        0.6745, except in the first pass where the least squares RMS is used.
+ *        Since the median is only known once the pass is over, the scale a pass
+ *        weights with comes from the residuals of the previous solution, one
+ *        iteration behind; taking it from the current residuals would cost a
+ *        second pass per iteration, and the two agree once the fit converges.
+ *        The fit stops when the largest weight changes by less than tolerance
+ *        relative to the largest weight, or after maxIterations.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Root headers
+#include "TH2D.h"
+#include "TMatrixD.h"
+#include "TROOT.h"
+#include "TVectorD.h"
+
+#include "eventStore.h"
+#include "gram.h"
+#include "histogramEngine.h"
+#include "instrumentation.h"
+#include "parallel.h"
+#include "resultSink.h"
+
+namespace robust {
+
+enum Loss {
+    huber,
+    tukey
+};
+
+const double huberK = 1.345;            // 95% efficiency for Gaussian residuals
+const double tukeyC = 4.685;            // Same for the bisquare
+const double madToSigma = 0.6745;
+const uint32_t residualBins = 8192;     // |residual| histogram for the MAD
+const double residualRange = 20;        // in units of the current scale, beyond goes to the overflow
+
+// IRLS weight of a residual u in units of the scale
+inline double robustWeight(Loss loss, double u) {
+    double size = fabs(u);
+    if (loss == huber) {
+        return size <= huberK ? 1 : huberK / size;
+    }
+    double ratio = u / tukeyC;
+    double inside = 1 - ratio * ratio;
+    return size < tukeyC ? inside * inside : 0;
+}
+
+// The outcome of one pass, the Gram of the robust weights and the residuals of the solution passed in
+struct IrlsPass {
+    WeightedGram gram;
+    std::vector<uint64_t> absResiduals = std::vector<uint64_t>(residualBins + 1, 0);     // Last bin is the overflow
+    uint64_t outliers = 0;     // Events beyond huberK or tukeyC
+
+    void add(const IrlsPass &other) {
+        gram.add(other.gram);
+        for (uint32_t i = 0; i <= residualBins; i++) {
+            absResiduals[i] += other.absResiduals[i];
+        }
+        outliers += other.outliers;
+    }
+
+    // MAD scale of the residuals of this pass, for the next one, or fallback when the median is in
+    // the overflow
+    double madScale(double histogramMax, double fallback) const {
+        uint64_t half = (gram.events + 1) / 2;
+        uint64_t seen = 0;
+        for (uint32_t i = 0; i < residualBins; i++) {
+            if (seen + absResiduals[i] >= half) {
+                double within = absResiduals[i] > 0 ? double(half - seen) / absResiduals[i] : 0;
+                return (i + within) * histogramMax / residualBins / madToSigma;
+            }
+            seen += absResiduals[i];
+        }
+        return fallback;
+    }
+};
+
+// Residuals against solution, their weights at scale and the weighted Gram, in one pass over the events
+IrlsPass irlsPass(const TMatrixD *c, const TVectorD *g, Loss loss, const double *solution, double scale,
+                  double histogramMax, uint32_t nThreads) {
+    uint64_t numEvents = c->GetNcols();
+    const double *rings = c->GetMatrixArray();
+    const double *target = g->GetMatrixArray();
+    double cut = (loss == huber ? huberK : tukeyC) * scale;
+    std::vector<IrlsPass> partial(nThreads);
+    parallelFor(numEvents, nThreads, [&](uint64_t begin, uint64_t end, uint32_t thread) {
+        IrlsPass &pass = partial[thread];
+        double residual[gramBlock];
+        double weight[gramBlock];
+        for (uint64_t first = begin; first < end; first += gramBlock) {
+            uint32_t length = end - first < gramBlock ? end - first : gramBlock;
+            for (uint32_t i = 0; i < length; i++) {
+                residual[i] = target[first + i] - solution[gramDim - 1];
+            }
+            for (uint32_t r = 0; r < gramDim - 1; r++) {
+                const double *row = rings + r * numEvents + first;
+                for (uint32_t i = 0; i < length; i++) {
+                    residual[i] -= solution[r] * row[i];
+                }
+            }
+            for (uint32_t i = 0; i < length; i++) {
+                weight[i] = robustWeight(loss, residual[i] / scale);
+                pass.outliers += fabs(residual[i]) > cut;
+                double position = fabs(residual[i]) / histogramMax * residualBins;
+                uint32_t bin = position < residualBins ? (uint32_t)position : residualBins;
+                pass.absResiduals[bin]++;
+            }
+            pass.gram.accumulate(rings, numEvents, target, first, length, weight);
+        }
+    });
+    IrlsPass total;
+    for (uint32_t t = 0; t < nThreads; t++) {
+        total.add(partial[t]);
+    }
+    total.gram.symmetrize();
+    return total;
+}
+
+// Returns the weights in the linear layout, rings 0-15 and the bias in 16, or nullptr if a solve fails
+TMatrixD *generateWeights(const TMatrixD *c, const TVectorD *g, Loss loss, uint32_t maxIterations, double tolerance) {
+    ScopedTimer timer(loss == huber ? "robust_huber_weights" : "robust_tukey_weights", c->GetNcols());
+    uint32_t nThreads = defaultThreads();
+    uint64_t numEvents = c->GetNcols();
+    if (numEvents <= gramDim) {
+        std::cerr << "Too few events for a robust fit" << std::endl;
+        return nullptr;
+    }
+
+    // Least squares to start from
+    double solution[gramDim];
+    WeightedGram gram = weightedGram(c, g, nullptr, nThreads);
+    if (!gram.solve(solution)) {
+        std::cerr << "Least squares Gram matrix is singular" << std::endl;
+        return nullptr;
+    }
+    double scale = sqrt(fmax(gram.weightedRss(solution), 0) / (numEvents - gramDim));
+
+    std::cout << "iteration   scale   max relative change   outliers" << std::endl;
+    for (uint32_t iteration = 1; iteration <= maxIterations; iteration++) {
+        if (!(scale > 0)) {
+            std::cout << "Residuals vanish, nothing to reweight" << std::endl;
+            break;
+        }
+        double histogramMax = residualRange * scale;
+        IrlsPass pass = irlsPass(c, g, loss, solution, scale, histogramMax, nThreads);
+        double next[gramDim];
+        if (!pass.gram.solve(next)) {
+            std::cerr << "Weighted Gram matrix is singular at iteration " << iteration << std::endl;
+            return nullptr;
+        }
+        double largest = 0;
+        double change = 0;
+        for (uint32_t q = 0; q < gramDim; q++) {
+            largest = fmax(largest, fabs(solution[q]));
+            change = fmax(change, fabs(next[q] - solution[q]));
+        }
+        change /= fmax(largest, 1e-12);
+        memcpy(solution, next, sizeof(solution));
+
+        printf("%9u   %5.3g   %19.3g   %8.4f\n", iteration, scale, change, double(pass.outliers) / numEvents);
+        scale = pass.madScale(histogramMax, scale);
+        if (change < tolerance) {
+            std::cout << "Converged after " << iteration << " iterations" << std::endl;
+            break;
+        }
+    }
+    return gramWeightMatrix(solution);
+}
+
+} // namespace robust
+
+// loss is "huber" or "tukey", the method is stored as robust_<loss>
+void robustRegression(const char *inFileName = "data/detector_data.root", const char *loss = "huber",
+                      uint32_t maxIterations = 10, double tolerance = 1e-4,
+                      const char *outFileName = "data/epd_tpc_relations.root") {
+    StageMetrics metrics("robustRegression");
+    robust::Loss lossFunction;
+    if (strcmp(loss, "huber") == 0) {
+        lossFunction = robust::huber;
+    }
+    else if (strcmp(loss, "tukey") == 0) {
+        lossFunction = robust::tukey;
+    }
+    else {
+        std::cerr << "Unknown loss " << loss << ", use huber or tukey" << std::endl;
+        return;
+    }
+
+    TMatrixD *c = loadRingSums(inFileName);
+    TVectorD *g = loadColumn(inFileName, "tpc_multiplicity");
+    if (c == nullptr || g == nullptr) {
+        return;
+    }
+    metrics.addEvents(c->GetNcols(), c->GetNcols() * 17. * sizeof(double));
+
+    TMatrixD *weights = robust::generateWeights(c, g, lossFunction, maxIterations, tolerance);
+    if (weights == nullptr) {
+        return;
+    }
+    std::cout << "Weights:\n";
+    weights->Print();
+    TVectorD *predictions;
+    {
+        ScopedTimer timer("robust_predict", c->GetNcols());
+        predictions = predictFromRings(weights->GetMatrixArray(), c);     // 17 x 1, the solution layout
+    }
+
+    uint32_t predictBins = 200;
+    int32_t predictMin = -100;
+    int32_t predictMax = 300;
+
+    uint32_t realBins = 175;
+    int32_t realMin = 0;
+    int32_t realMax = 350;
+
+    std::string method = std::string("robust_") + loss;
+    Histogram2D counts(realBins, realMin, realMax, predictBins, predictMin, predictMax);
+    {
+        ScopedTimer timer("fill_histograms", g->GetNrows());
+        counts.fill(g->GetMatrixArray(), predictions->GetMatrixArray(), g->GetNrows());
+    }
+    TH2D *predictVsReal = counts.toTH2D(method.c_str(), Form("X_{#zeta'} vs RefMult1, %s loss;RefMult1;X_{#zeta'}", loss));
+
+    ResultSink sink(outFileName, method.c_str());
+    sink.add("methods", method.c_str(), predictVsReal);
+    sink.add("methods", (method + "_weights").c_str(), weights);
+    sink.commit();
+}
@@ -0,0 +1,135 @@
+/**
+ * \brief Linear weights per run.  perRunWeights.cpp stores them in the relations
+ *        file as methods/<method>_table, a TMatrixD with one row per run: the run
+ *        id, then the 17 weights in the linear layout (rings 0-15, bias 16).  Row 0
+ *        has run id 0, which STAR never uses, and the weights fitted to all events;
+ *        runs missing from the table get those.
+ *
+ *            RunWeightTable *table = RunWeightTable::load("data/epd_tpc_relations.root");
+ *            const double *weights = table->weightsFor(event->runId());
+ *
+ *        predict() is the per event prediction kernel for a whole store.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#ifndef RUN_WEIGHTS
+#define RUN_WEIGHTS
+
+#include <TROOT.h>
+#include <TFile.h>
+#include <TMatrixD.h>
+#include <TVectorD.h>
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "gram.h"
+#include "parallel.h"
+
+class RunWeightTable {
+public:
+    // Table rows as described above, they need not be sorted
+    RunWeightTable(const TMatrixD &table) {
+        std::vector<std::pair<uint32_t, uint32_t>> order;
+        for (int32_t row = 0; row < table.GetNrows(); row++) {
+            order.push_back(std::make_pair((uint32_t)table[row][0], (uint32_t)row));
+        }
+        std::sort(order.begin(), order.end());
+        for (uint32_t i = 0; i < order.size(); i++) {
+            runs.push_back(order[i].first);
+            for (uint32_t q = 0; q < gramDim; q++) {
+                weights.push_back(table[order[i].second][q + 1]);
+            }
+        }
+    }
+
+    // methods/<method>_table of a relations file, nullptr if it is missing or malformed
+    static RunWeightTable *load(const char *fileName, const char *method = "linear_per_run") {
+        TFile file(fileName);
+        if (file.IsZombie()) {
+            std::cerr << "Could not open " << fileName << std::endl;
+            return nullptr;
+        }
+        TMatrixD *table = nullptr;
+        file.GetObject(Form("methods/%s_table", method), table);
+        if (table == nullptr || table->GetNcols() != (int32_t)gramDim + 1 || table->GetNrows() == 0 ||
+            (*table)[0][0] != 0) {
+            std::cerr << fileName << " has no run weight table for " << method << std::endl;
+            delete table;
+            return nullptr;
+        }
+        RunWeightTable *loaded = new RunWeightTable(*table);
+        delete table;
+        return loaded;
+    }
+
+    // Builds the stored matrix, runWeights holds gramDim weights per run and run 0 must be the global fit
+    static TMatrixD *toMatrix(const std::vector<uint32_t> &runIds, const std::vector<double> &runWeights) {
+        TMatrixD *table = new TMatrixD(runIds.size(), gramDim + 1);
+        for (uint32_t row = 0; row < runIds.size(); row++) {
+            (*table)[row][0] = runIds[row];
+            for (uint32_t q = 0; q < gramDim; q++) {
+                (*table)[row][q + 1] = runWeights[row * gramDim + q];
+            }
+        }
+        return table;
+    }
+
+    uint32_t numberOfRuns() const {
+        return runs.size() - 1;
+    }
+
+    // The weights of run, or the global ones if the run is not in the table
+    const double *weightsFor(uint32_t run) const {
+        std::vector<uint32_t>::const_iterator found = std::lower_bound(runs.begin(), runs.end(), run);
+        uint32_t row = found != runs.end() && *found == run ? found - runs.begin() : 0;
+        return &weights[row * gramDim];
+    }
+
+    // X_j = sum_r W_r(run_j) C_{r, j} + W_16(run_j) for every event of the ring sums c.  Events of the
+    // same run are mostly consecutive, so the lookup happens once per block of a run and the
+    // weighted sum over a block is a vectorized loop per ring.
+    TVectorD *predict(const TMatrixD *c, const uint32_t *eventRuns, uint32_t nThreads = 0) const {
+        uint64_t numEvents = c->GetNcols();
+        const double *rings = c->GetMatrixArray();
+        TVectorD *predictions = new TVectorD(numEvents);
+        double *output = predictions->GetMatrixArray();
+        parallelFor(numEvents, nThreads > 0 ? nThreads : defaultThreads(),
+                    [&](uint64_t begin, uint64_t end, uint32_t thread) {
+            uint64_t first = begin;
+            while (first < end) {
+                uint32_t run = eventRuns[first];
+                uint64_t last = first + 1;
+                while (last < end && last - first < gramBlock && eventRuns[last] == run) {
+                    last++;
+                }
+                const double *w = weightsFor(run);
+                for (uint64_t j = first; j < last; j++) {
+                    output[j] = w[gramDim - 1];
+                }
+                for (uint32_t r = 0; r < gramDim - 1; r++) {
+                    const double *row = rings + r * numEvents;
+                    for (uint64_t j = first; j < last; j++) {
+                        output[j] += w[r] * row[j];
+                    }
+                }
+                first = last;
+            }
+        });
+        return predictions;
+    }
+
+private:
+    std::vector<uint32_t> runs;         // Sorted, runs[0] is 0 for the global weights
+    std::vector<double> weights;        // gramDim per run, in the order of runs
+};
+
+#endif // RUN_WEIGHTS
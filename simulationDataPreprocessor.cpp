@@ -24,9 +24,13 @@
 #include "TNtuple.h"
 #include "TTreeReader.h"
 
+#include "eventStore.h"
+#include "instrumentation.h"
+
 const uint8_t RINGS = 16;
 
 void simulationDataPreprocessor(const char *inFileName = "data/CentralityNtupleout06212020_7.7.root" ) {
+    StageMetrics metrics("simulationDataPreprocessor");
     std::cout << "Converting data format..." << std::endl;
     TFile *inFile = TFile::Open(inFileName);
 
@@ -34,9 +38,11 @@ void simulationDataPreprocessor(const char *inFileName = "data/CentralityNtupleo
     Long64_t numEvents = eventReader.GetEntries();
     std::cout << "Processing " << numEvents << " events" << std::endl;
 
-    TMatrixD *ringSums = new TMatrixD(RINGS, numEvents);
-    TVectorD *tpcMultiplicity = new TVectorD(numEvents);
-    TVectorD *impactParameter = new TVectorD(numEvents);
+    EventStoreWriter store("data/simulated_data.root");
+    uint32_t impactColumn = store.addColumn("impact_parameter", 'F');
+    if (!store.good()) {
+        return;
+    }
 
     std::vector<TTreeReaderValue<Float_t>> ringReaders;
     for (uint32_t i = 1; i <= RINGS; i++) {
@@ -46,23 +52,16 @@ void simulationDataPreprocessor(const char *inFileName = "data/CentralityNtupleo
     TTreeReaderValue<Float_t> refMul(eventReader, "RefMult1");
     TTreeReaderValue<Float_t> impact(eventReader, "b");
 
-    Long64_t i = 0;
+    Float_t ringSums[RINGS];
     while(eventReader.Next()) {
         for (uint32_t j = 0; j < RINGS; j++) {
-            double nmips = *(ringReaders[j]);
-            (*ringSums)[j][i] = *(ringReaders[j]);
+            ringSums[j] = *(ringReaders[j]);
         }
-        (*tpcMultiplicity)[i] = *refMul;
-        (*impactParameter)[i] = *impact;
-        i++;
+        store.setColumn(impactColumn, *impact);
+        store.fill(ringSums, *refMul);
     }
-    // ringSums->Print();
-    // tpcMultiplicity->Print();
-
-    TFile outFile("data/simulated_data.root", "RECREATE");
-    ringSums->Write("ring_sums");
-    tpcMultiplicity->Write("tpc_multiplicity");
-    impactParameter->Write("impact_parameter");
-    outFile.Close();
+    metrics.addEvents(store.entries(), store.entries() * (RINGS + 2.) * sizeof(Float_t));
+    store.close();
+    inFile->Close();
 
 }
\ No newline at end of file
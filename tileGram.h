@@ -0,0 +1,182 @@
+/**
+ * \brief Normal equations of the per tile linear model, X = sum_t W_t nMIP_t + W_744,
+ *        over all 744 EPD tiles instead of the 16 ring sums.  With x_j the 744 tile
+ *        nMIPs of event j and a trailing 1,
+ *
+ *            A = sum_j x_j x_j^T,    B = sum_j g_j x_j
+ *
+ *        is 745 x 745.  An event fires tens to a hundred tiles, so it adds a sparse
+ *        outer product: for its hits sorted by tile, every pair (i <= k) updates
+ *        A[tile_i][tile_k] of the upper triangle.  Threads take contiguous ranges
+ *        of events, so every hit is read and decoded once, into their own TileGram
+ *        (4.4 MB of A each), and the partial sums are added in thread order like
+ *        weightedGram() in gram.h: results repeat for a given thread count.
+ *
+ *        Hits come from the hit store (hitStore.h) and are clamped like the ring sums.
+ *
+ *        solve() is a Cholesky factorization with a small ridge on the tiles, which
+ *        keeps tiles that never fired (zero rows) from making A singular; they get
+ *        weight 0.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#ifndef TILE_GRAM
+#define TILE_GRAM
+
+#include <TROOT.h>
+#include <TMatrixD.h>
+#include <TVectorD.h>
+
+#include <math.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "epdHits.h"
+#include "hitStore.h"
+#include "parallel.h"
+
+const uint32_t tileGramDim = epdTiles + 1;      // The tiles and the bias
+const double tileGramRidge = 1e-6;              // Relative to the mean tile diagonal
+
+struct TileGram {
+    std::vector<double> a = std::vector<double>(tileGramDim * tileGramDim, 0);     // Upper triangle, row major
+    std::vector<double> b = std::vector<double>(tileGramDim, 0);
+    double sumG2 = 0;
+    uint64_t events = 0;
+
+    void add(const TileGram &other) {
+        for (uint64_t i = 0; i < a.size(); i++) {
+            a[i] += other.a[i];
+        }
+        for (uint32_t q = 0; q < tileGramDim; q++) {
+            b[q] += other.b[q];
+        }
+        sumG2 += other.sumG2;
+        events += other.events;
+    }
+
+    // Solves (A + ridge * I_tiles) x = B, ridge is tileGramRidge times the mean diagonal of the
+    // tiles.  Returns false if the matrix is still not positive definite.
+    bool solve(double *solution) const {
+        const uint32_t n = tileGramDim;
+        double trace = 0;
+        for (uint32_t q = 0; q < n - 1; q++) {
+            trace += a[q * n + q];
+        }
+        double ridge = tileGramRidge * (trace > 0 ? trace / (n - 1) : 1);
+
+        // Row q of l holds L[q][0..q], so both rows of every dot product are contiguous
+        std::vector<double> l(n * n, 0);
+        for (uint32_t q = 0; q < n; q++) {
+            double *lq = &l[q * n];
+            for (uint32_t t = 0; t <= q; t++) {
+                const double *lt = &l[t * n];
+                double sum = a[t * n + q] + (q == t && q < n - 1 ? ridge : 0);
+                for (uint32_t k = 0; k < t; k++) {
+                    sum -= lq[k] * lt[k];
+                }
+                if (q == t) {
+                    if (!(sum > 0)) {
+                        return false;
+                    }
+                    lq[q] = sqrt(sum);
+                }
+                else {
+                    lq[t] = sum / lt[t];
+                }
+            }
+        }
+        std::vector<double> y(n);
+        for (uint32_t q = 0; q < n; q++) {
+            double sum = b[q];
+            for (uint32_t k = 0; k < q; k++) {
+                sum -= l[q * n + k] * y[k];
+            }
+            y[q] = sum / l[q * n + q];
+        }
+        for (int32_t q = n - 1; q >= 0; q--) {
+            double sum = y[q];
+            for (uint32_t k = q + 1; k < n; k++) {
+                sum -= l[k * n + q] * solution[k];
+            }
+            solution[q] = sum / l[q * n + q];
+        }
+        return true;
+    }
+};
+
+// A and B of every event in hits, g holds the TPC multiplicity per event
+inline TileGram tileGram(const HitStore &hits, const double *g, uint32_t nThreads = 0) {
+    const uint32_t n = tileGramDim;
+    uint64_t numEvents = hits.numberOfEvents();
+    const uint64_t *offsets = hits.offsets();
+    const uint32_t *packed = hits.hits();
+    nThreads = nThreads > 0 ? nThreads : defaultThreads();
+    std::vector<TileGram> partial(nThreads);
+    parallelFor(numEvents, nThreads, [&](uint64_t begin, uint64_t end, uint32_t thread) {
+        TileGram &own = partial[thread];
+        double *a = own.a.data();
+        double *b = own.b.data();
+        std::vector<uint32_t> tiles;
+        std::vector<double> nMips;
+        for (uint64_t j = begin; j < end; j++) {
+            // Decoded and clamped once per event, hits that clamp to 0 add nothing
+            tiles.clear();
+            nMips.clear();
+            for (uint64_t i = offsets[j]; i < offsets[j + 1]; i++) {
+                double x = clampNmip(hitNmip(packed[i]));
+                if (x != 0) {
+                    tiles.push_back(hitTile(packed[i]));
+                    nMips.push_back(x);
+                }
+            }
+            for (uint32_t i = 0; i < tiles.size(); i++) {
+                double *row = a + tiles[i] * n;
+                double x = nMips[i];
+                for (uint32_t k = i; k < tiles.size(); k++) {
+                    row[tiles[k]] += x * nMips[k];
+                }
+                row[n - 1] += x;
+                b[tiles[i]] += x * g[j];
+            }
+            b[n - 1] += g[j];
+            own.sumG2 += g[j] * g[j];
+        }
+        own.events += end - begin;
+    });
+
+    TileGram gram;
+    for (uint32_t t = 0; t < nThreads; t++) {
+        gram.add(partial[t]);
+    }
+    gram.a[(n - 1) * n + n - 1] = gram.events;
+    return gram;
+}
+
+// X_j = sum_hits W_tile nMIP + W_744 for every event in hits
+inline TVectorD *predictFromTiles(const HitStore &hits, const double *weights, uint32_t nThreads = 0) {
+    uint64_t numEvents = hits.numberOfEvents();
+    const uint64_t *offsets = hits.offsets();
+    const uint32_t *packed = hits.hits();
+    TVectorD *predictions = new TVectorD(numEvents);
+    double *output = predictions->GetMatrixArray();
+    parallelFor(numEvents, nThreads > 0 ? nThreads : defaultThreads(),
+                [&](uint64_t begin, uint64_t end, uint32_t thread) {
+        for (uint64_t j = begin; j < end; j++) {
+            double prediction = weights[tileGramDim - 1];
+            for (uint64_t i = offsets[j]; i < offsets[j + 1]; i++) {
+                prediction += weights[hitTile(packed[i])] * clampNmip(hitNmip(packed[i]));
+            }
+            output[j] = prediction;
+        }
+    });
+    return predictions;
+}
+
+#endif // TILE_GRAM
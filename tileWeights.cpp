@@ -0,0 +1,91 @@
+/**
+ * \brief Linear weights per EPD tile.  The ring sums add up the tiles of a ring
+ *        (tile / 2), this fits one weight to each of the 744 tiles instead, from
+ *        the hits the ingest keeps in the hit store (hitStore.h).  The 745 x 745
+ *        normal equations come from one multithreaded sparse pass (tileGram.h) and
+ *        are solved by Cholesky.
+ *
+ *        The prediction goes to methods/linear_tiles and the weights, tiles in
+ *        epdTileIndex order and the bias last, to methods/linear_tiles_weights.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#include <iostream>
+#include <vector>
+
+// Root headers
+#include "TH2D.h"
+#include "TMatrixD.h"
+#include "TROOT.h"
+#include "TVectorD.h"
+
+#include "eventStore.h"
+#include "histogramEngine.h"
+#include "instrumentation.h"
+#include "parallel.h"
+#include "resultSink.h"
+#include "tileGram.h"
+
+void tileWeights(const char *inFileName = "data/detector_data.root",
+                 const char *outFileName = "data/epd_tpc_relations.root") {
+    StageMetrics metrics("tileWeights");
+    HitStore *hits = HitStore::open(inFileName);
+    TVectorD *g = loadColumn(inFileName, "tpc_multiplicity");
+    if (hits == nullptr || g == nullptr) {
+        return;
+    }
+    uint64_t numEvents = hits->numberOfEvents();
+    if (numEvents != (uint64_t)g->GetNrows()) {
+        std::cerr << "Hits and tpc_multiplicity of " << inFileName << " disagree on the number of events" << std::endl;
+        return;
+    }
+    metrics.addEvents(numEvents, hits->numberOfHits() * sizeof(uint32_t) + numEvents * sizeof(double));
+    std::cout << numEvents << " events with " << double(hits->numberOfHits()) / numEvents << " hits on average" << std::endl;
+
+    uint32_t nThreads = defaultThreads();
+    TileGram gram;
+    {
+        ScopedTimer timer("tile_gram", numEvents);
+        gram = tileGram(*hits, g->GetMatrixArray(), nThreads);
+    }
+    std::vector<double> solution(tileGramDim);
+    {
+        ScopedTimer timer("tile_solve");
+        if (!gram.solve(solution.data())) {
+            std::cerr << "Tile Gram matrix is not positive definite" << std::endl;
+            return;
+        }
+    }
+    TMatrixD *weights = new TMatrixD(tileGramDim, 1);
+    for (uint32_t q = 0; q < tileGramDim; q++) {
+        (*weights)[q][0] = solution[q];
+    }
+    TVectorD *predictions = predictFromTiles(*hits, solution.data(), nThreads);
+
+    uint32_t predictBins = 200;
+    int32_t predictMin = -100;
+    int32_t predictMax = 300;
+
+    uint32_t realBins = 175;
+    int32_t realMin = 0;
+    int32_t realMax = 350;
+
+    Histogram2D counts(realBins, realMin, realMax, predictBins, predictMin, predictMax);
+    {
+        ScopedTimer timer("fill_histograms", numEvents);
+        counts.fill(g->GetMatrixArray(), predictions->GetMatrixArray(), numEvents);
+    }
+    TH2D *predictVsReal = counts.toTH2D("linear_tiles", "X_{#zeta'} vs RefMult1, weights per tile;RefMult1;X_{#zeta'}");
+
+    ResultSink sink(outFileName, "linear_tiles");
+    sink.add("methods", "linear_tiles", predictVsReal);
+    sink.add("methods", "linear_tiles_weights", weights);
+    sink.commit();
+    delete predictions;
+    delete hits;
+}
@@ -3,6 +3,10 @@
  * 
  * We hope to be able to use this as a selector of events to avoid pile up in the
  * tpc detector
+ *
+ * tpcVsTofScan evaluates each of the three cut styles over a grid of thresholds
+ * in one pass, giving efficiency and rejection curves and the selected events
+ * at every grid point, so a cut can be picked from the whole trade-off.
  * 
  * \author Tristan Protzman
  * \date September 24, 2020
@@ -10,24 +14,66 @@
  * 
  */
 
+#include <math.h>
 #include <stdlib.h>
 
 #include <TCanvas.h>
 #include <TFile.h>
+#include <TGraph.h>
 #include <TH2D.h>
 #include <TPad.h>
 #include <TROOT.h>
 #include <TStyle.h>
 #include <TVectorD.h>
 
-void tpcVsTofSelection(const char *inFileName = "data/detector_data.root") {
-    TFile inFile(inFileName);
-    TVectorD *tpc;
-    TVectorD *tof;
+#include <vector>
+
+#include "eventStore.h"
+#include "histogramEngine.h"
+#include "instrumentation.h"
+#include "parallel.h"
+#include "resultSink.h"
 
-    inFile.GetObject("tpc_multiplicity", tpc);
-    inFile.GetObject("tof_multiplicity", tof);
-    inFile.Close();
+// The three cut styles, each passing more events as its threshold grows
+enum PileupCut {
+    windowCut,                  // |2 tpc - tof| < threshold
+    toleranceCut,               // tof (1 - threshold) < 2 tpc < tof (1 + threshold)
+    percentDifferenceCut,       // |2 tpc - tof| / mean(2 tpc, tof) < threshold
+    numPileupCuts
+};
+
+const char *pileupCutNames[numPileupCuts] = {"window", "tolerance", "percent_difference"};
+const double pileupScanMin[numPileupCuts] = {10, 0.1, 0.1};     // Default scan ranges
+const double pileupScanMax[numPileupCuts] = {100, 1, 1};
+const uint64_t scanBankBudget = 256ull << 20;                  // Bytes of per thread scan counts
+
+// tofVal is the TOF multiplicity over 2, as everywhere in this file
+inline bool passesPileupCut(PileupCut cut, double tpcVal, double tofVal, double threshold) {
+    switch (cut) {
+        case windowCut:
+            return fabs((2 * tpcVal) - tofVal) < threshold;
+        case toleranceCut:
+            return tofVal * (1 - threshold) < 2 * tpcVal && tofVal * (1 + threshold) > 2 * tpcVal;
+        default:
+            return fabs(((2 * tpcVal) - tofVal) / (((2 * tpcVal) + tofVal) / 2)) < threshold;
+    }
+}
+
+// TPC excess, the pile up the scan measures rejection on: 2 tpc above the band around tof that
+// the tolerance cut keeps at excessTolerance
+inline bool isTpcExcess(double tpcVal, double tofVal, double excessTolerance) {
+    return 2 * tpcVal > tofVal * (1 + excessTolerance);
+}
+
+void tpcVsTofSelection(const char *inFileName = "data/detector_data.root") {
+    StageMetrics metrics("tpcVsTofSelection");
+    // Only the two multiplicity columns are read, the ring sums stay on disk
+    TVectorD *tpc = loadColumn(inFileName, "tpc_multiplicity");
+    TVectorD *tof = loadColumn(inFileName, "tof_multiplicity");
+    if (tpc == nullptr || tof == nullptr) {
+        return;
+    }
+    metrics.addEvents(tpc->GetNrows());
 
 
     gStyle->SetPalette(kBird);
@@ -43,46 +89,45 @@ void tpcVsTofSelection(const char *inFileName = "data/detector_data.root") {
     int32_t tofMin = 0;
     int32_t tofMax = 450; 
 
-    TH2D *tofVsTpc = new TH2D("TPC vs TOF", "2D Histo;b TOF Tray Multiplicity;TPC RefMult",
-                                  tpcBins, tpcMin, tpcMax,
-                                  tofBins, tofMin, tofMax);
-
     int selectionWindow = 50;
-    TH2D *windowTofVsTpc = new TH2D("Windowed", "2D Histo;TPC RefMult;b TOF Tray Multiplicity",
-                                        tofBins, tofMin, tofMax,
-                                        tpcBins, tpcMin, tpcMax);
-
     float tolerance1 = 0.8;
-    TH2D *toleranceTofVsTpc = new TH2D("tolerance", "2D Histo;b TOF Tray Multiplicity;TPC RefMult",
-                                        tofBins, tofMin, tofMax,
-                                        tpcBins, tpcMin, tpcMax);
-
     float percentDifference = 0.8;
-    TH2D *tolerance2TofVsTpc = new TH2D("percent difference", "2D Histo;b TOF Tray Multiplicity;TPC RefMult",
-                                    tofBins, tofMin, tofMax,
-                                    tpcBins, tpcMin, tpcMax);
-
 
-
-    for (uint32_t i = 0; i < tpc->GetNrows(); i++) {
+    // The halved TOF multiplicity and which of the selections each event passes, as
+    // columns so all four histograms come from the same filling engine
+    uint64_t numEvents = tpc->GetNrows();
+    const double *tpcVals = tpc->GetMatrixArray();
+    std::vector<double> tofVals(numEvents);
+    std::vector<uint8_t> inWindow(numEvents);
+    std::vector<uint8_t> inTolerance(numEvents);
+    std::vector<uint8_t> inPercentDifference(numEvents);
+    for (uint64_t i = 0; i < numEvents; i++) {
         double tpcVal, tofVal;
-        tpcVal = (*tpc)[i];
+        tpcVal = tpcVals[i];
         tofVal = (*tof)[i] / 2;
-        tofVsTpc->Fill(tpcVal, tofVal);
-        // Windowed
-        if (abs((2 * tpcVal) - tofVal) < selectionWindow) {
-            windowTofVsTpc->Fill(tofVal, tpcVal);
-        }
-        // Tolerance
-        if (tofVal * (1 - tolerance1) < 2 * tpcVal && tofVal * (1 + tolerance1) > 2 * tpcVal) {
-            toleranceTofVsTpc->Fill(tofVal, tpcVal);
-        }
-        // Percent Difference
-        if (abs(((2 * tpcVal) - tofVal) / (((2 * tpcVal) + tofVal) / 2)) < percentDifference) {
-            tolerance2TofVsTpc->Fill(tofVal, tpcVal);
-        }
+        tofVals[i] = tofVal;
+        inWindow[i] = passesPileupCut(windowCut, tpcVal, tofVal, selectionWindow);
+        inTolerance[i] = passesPileupCut(toleranceCut, tpcVal, tofVal, tolerance1);
+        inPercentDifference[i] = passesPileupCut(percentDifferenceCut, tpcVal, tofVal, percentDifference);
     }
 
+    Histogram2D allCounts(tpcBins, tpcMin, tpcMax, tofBins, tofMin, tofMax);
+    Histogram2D windowCounts(tofBins, tofMin, tofMax, tpcBins, tpcMin, tpcMax);
+    Histogram2D toleranceCounts(tofBins, tofMin, tofMax, tpcBins, tpcMin, tpcMax);
+    Histogram2D percentDifferenceCounts(tofBins, tofMin, tofMax, tpcBins, tpcMin, tpcMax);
+    {
+        ScopedTimer timer("fill_histograms", numEvents);
+        allCounts.fill(tpcVals, tofVals.data(), numEvents);
+        windowCounts.fill(tofVals.data(), tpcVals, numEvents, inWindow.data());
+        toleranceCounts.fill(tofVals.data(), tpcVals, numEvents, inTolerance.data());
+        percentDifferenceCounts.fill(tofVals.data(), tpcVals, numEvents, inPercentDifference.data());
+    }
+
+    TH2D *tofVsTpc = allCounts.toTH2D("TPC vs TOF", "2D Histo;b TOF Tray Multiplicity;TPC RefMult");
+    TH2D *windowTofVsTpc = windowCounts.toTH2D("Windowed", "2D Histo;TPC RefMult;b TOF Tray Multiplicity");
+    TH2D *toleranceTofVsTpc = toleranceCounts.toTH2D("tolerance", "2D Histo;b TOF Tray Multiplicity;TPC RefMult");
+    TH2D *tolerance2TofVsTpc = percentDifferenceCounts.toTH2D("percent difference", "2D Histo;b TOF Tray Multiplicity;TPC RefMult");
+
     TCanvas *canvas = new TCanvas("canvas", "canvas");
     // canvas->Divide(2, 2);
     
@@ -108,3 +153,152 @@ void tpcVsTofSelection(const char *inFileName = "data/detector_data.root") {
     
     canvas->Draw();
 }
+
+
+/**
+ * Scans gridPoints thresholds of every cut style, evenly spaced over the default ranges
+ * above, in a single multithreaded pass over the TPC and TOF columns.  The cuts are
+ * nested, so each event only needs the first threshold it passes: it goes into that
+ * layer of a histogram bank, and merging layers 0 to k cumulatively gives the events
+ * selected at threshold k.  Per cut style outFileName gets
+ *     efficiency      fraction of all events kept, against the threshold
+ *     rejection       fraction of TPC excess events removed, against the threshold
+ *     tradeoff        rejection against efficiency
+ *     selected_<k>    TOF vs TPC of the events kept at threshold k
+ * TPC excess events lie above the TPC-TOF correlation band, where pile up puts extra tracks:
+ * 2 tpc > tof (1 + excessTolerance).  The default is the loosest tolerance of the scan, so
+ * the excess is what even the loosest tolerance cut drops, not the upper half of the band.
+ * Every thread keeps its own counts, 3 x gridPoints x 152 x 152 x 8 bytes (11 MB at 20
+ * grid points), so the threads are capped to keep the banks within scanBankBudget.
+ */
+void tpcVsTofScan(const char *inFileName = "data/detector_data.root",
+                  const char *outFileName = "data/tpc_tof_scan.root", uint32_t gridPoints = 20,
+                  double excessTolerance = pileupScanMax[toleranceCut]) {
+    StageMetrics metrics("tpcVsTofScan");
+    if (gridPoints < 2) {
+        std::cerr << "A scan needs at least two grid points" << std::endl;
+        return;
+    }
+    if (!(excessTolerance >= 0)) {
+        std::cerr << "The TPC excess tolerance has to be positive" << std::endl;
+        return;
+    }
+    TVectorD *tpc = loadColumn(inFileName, "tpc_multiplicity");
+    TVectorD *tof = loadColumn(inFileName, "tof_multiplicity");
+    if (tpc == nullptr || tof == nullptr) {
+        return;
+    }
+    uint64_t numEvents = tpc->GetNrows();
+    metrics.addEvents(numEvents);
+    const double *tpcVals = tpc->GetMatrixArray();
+    const double *tofCounts = tof->GetMatrixArray();
+
+    std::vector<std::vector<double>> thresholds(numPileupCuts, std::vector<double>(gridPoints));
+    for (uint32_t c = 0; c < numPileupCuts; c++) {
+        for (uint32_t k = 0; k < gridPoints; k++) {
+            thresholds[c][k] = pileupScanMin[c] + (pileupScanMax[c] - pileupScanMin[c]) * k / (gridPoints - 1);
+        }
+    }
+
+    uint32_t tpcBins = 150;
+    int32_t tpcMin = 0;
+    int32_t tpcMax = 300;
+
+    uint32_t tofBins = 150;
+    int32_t tofMin = 0;
+    int32_t tofMax = 450;
+
+    uint64_t bankBytes = uint64_t(numPileupCuts) * gridPoints * (tofBins + 2) * (tpcBins + 2) * sizeof(uint64_t);
+    uint64_t threadLimit = scanBankBudget / bankBytes;
+    uint32_t nThreads = threadLimit < defaultThreads() ? (threadLimit > 0 ? threadLimit : 1) : defaultThreads();
+    std::vector<HistogramBank2D> selected;
+    for (uint32_t c = 0; c < numPileupCuts; c++) {
+        selected.emplace_back(gridPoints, tofBins, tofMin, tofMax, tpcBins, tpcMin, tpcMax, nThreads);
+    }
+    // Per thread, cut and first passed threshold, all events and TPC excess events
+    std::vector<uint64_t> firstPassed(nThreads * numPileupCuts * gridPoints, 0);
+    std::vector<uint64_t> firstPassedExcess(nThreads * numPileupCuts * gridPoints, 0);
+    std::vector<uint64_t> excessEvents(nThreads, 0);
+
+    {
+        ScopedTimer timer("pileup_scan", numEvents, numEvents * 2 * sizeof(double));
+        parallelFor(numEvents, nThreads, [&](uint64_t begin, uint64_t end, uint32_t thread) {
+            double tofVals[histogramBlock];
+            int32_t passed[histogramBlock];
+            int32_t layer[histogramBlock];
+            for (uint64_t first = begin; first < end; first += histogramBlock) {
+                uint32_t length = end - first < histogramBlock ? end - first : histogramBlock;
+                const double *blockTpc = tpcVals + first;
+                for (uint32_t i = 0; i < length; i++) {
+                    tofVals[i] = tofCounts[first + i] / 2;
+                    excessEvents[thread] += isTpcExcess(blockTpc[i], tofVals[i], excessTolerance);
+                }
+                for (uint32_t c = 0; c < numPileupCuts; c++) {
+                    // Thresholds passed, the first passed one is gridPoints minus that
+                    const double *cutThresholds = thresholds[c].data();
+                    for (uint32_t i = 0; i < length; i++) {
+                        passed[i] = 0;
+                    }
+                    for (uint32_t k = 0; k < gridPoints; k++) {
+                        for (uint32_t i = 0; i < length; i++) {
+                            passed[i] += passesPileupCut((PileupCut)c, blockTpc[i], tofVals[i], cutThresholds[k]);
+                        }
+                    }
+                    uint64_t *counts = firstPassed.data() + (thread * numPileupCuts + c) * gridPoints;
+                    uint64_t *excessCounts = firstPassedExcess.data() + (thread * numPileupCuts + c) * gridPoints;
+                    for (uint32_t i = 0; i < length; i++) {
+                        layer[i] = passed[i] > 0 ? gridPoints - passed[i] : -1;
+                        if (layer[i] >= 0) {
+                            counts[layer[i]]++;
+                            excessCounts[layer[i]] += isTpcExcess(blockTpc[i], tofVals[i], excessTolerance);
+                        }
+                    }
+                    selected[c].fillRange(tofVals, blockTpc, layer, 0, length, thread);
+                }
+            }
+        });
+    }
+
+    uint64_t totalExcess = 0;
+    for (uint32_t t = 0; t < nThreads; t++) {
+        totalExcess += excessEvents[t];
+    }
+    std::cout << totalExcess << " of " << numEvents << " events have 2 RefMult above TOF (1 + " << excessTolerance
+              << ")" << std::endl;
+
+    ResultSink sink(outFileName, "tpc_tof_scan");
+    for (uint32_t c = 0; c < numPileupCuts; c++) {
+        const char *name = pileupCutNames[c];
+        TGraph *efficiency = new TGraph(gridPoints);
+        TGraph *rejection = new TGraph(gridPoints);
+        TGraph *tradeoff = new TGraph(gridPoints);
+        efficiency->SetTitle(Form("%s;threshold;efficiency", name));
+        rejection->SetTitle(Form("%s;threshold;TPC excess rejection", name));
+        tradeoff->SetTitle(Form("%s;efficiency;TPC excess rejection", name));
+
+        std::cout << name << "\n  threshold   efficiency   rejection\n";
+        uint64_t kept = 0;
+        uint64_t keptExcess = 0;
+        for (uint32_t k = 0; k < gridPoints; k++) {
+            for (uint32_t t = 0; t < nThreads; t++) {
+                kept += firstPassed[(t * numPileupCuts + c) * gridPoints + k];
+                keptExcess += firstPassedExcess[(t * numPileupCuts + c) * gridPoints + k];
+            }
+            double keptFraction = numEvents > 0 ? double(kept) / numEvents : 0;
+            double rejectedFraction = totalExcess > 0 ? 1 - double(keptExcess) / totalExcess : 0;
+            efficiency->SetPoint(k, thresholds[c][k], keptFraction);
+            rejection->SetPoint(k, thresholds[c][k], rejectedFraction);
+            tradeoff->SetPoint(k, keptFraction, rejectedFraction);
+            printf("  %9.3g   %10.4f   %9.4f\n", thresholds[c][k], keptFraction, rejectedFraction);
+
+            TH2D *histogram = selected[c].toTH2D(k, Form("selected_%02d", k),
+                                                 Form("%s < %g;b TOF Tray Multiplicity;TPC RefMult", name, thresholds[c][k]),
+                                                 true);
+            sink.add(name, Form("selected_%02d", k), histogram);
+        }
+        sink.add(name, "efficiency", efficiency);
+        sink.add(name, "rejection", rejection);
+        sink.add(name, "tradeoff", tradeoff);
+    }
+    sink.commit();
+}
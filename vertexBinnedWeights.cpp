@@ -0,0 +1,124 @@
+/**
+ * \brief Linear weights fitted separately in bins of the primary vertex z, since
+ *        the EPD rings cover different pseudorapidities depending on where along
+ *        the beam the collision happened.  One multithreaded pass accumulates a
+ *        Gram matrix per vz bin (binnedGram in gram.h), then every bin is solved.
+ *        Bins with fewer than minEvents events, or whose matrix is singular, keep
+ *        the weights fitted to all events, whose Gram is the sum of the bins.
+ *
+ *        The vz -> weights table goes to methods/linear_vz_table (see
+ *        vertexWeights.h) and the prediction with each event's bin weights to
+ *        methods/linear_vz, next to the other methods.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#include <string.h>
+
+#include <iostream>
+#include <vector>
+
+// Root headers
+#include "TH2D.h"
+#include "TMatrixD.h"
+#include "TROOT.h"
+#include "TVectorD.h"
+
+#include "eventStore.h"
+#include "gram.h"
+#include "histogramEngine.h"
+#include "instrumentation.h"
+#include "parallel.h"
+#include "resultSink.h"
+#include "vertexWeights.h"
+
+// The ingest keeps |vz| < 70 cm
+const double vertexBinnedMin = -70;
+const double vertexBinnedMax = 70;
+
+void vertexBinnedWeights(const char *inFileName = "data/detector_data.root", uint32_t vzBins = 14,
+                         const char *outFileName = "data/epd_tpc_relations.root", uint32_t minEvents = 10000) {
+    StageMetrics metrics("vertexBinnedWeights");
+    if (vzBins == 0) {
+        std::cerr << "Need at least one vz bin" << std::endl;
+        return;
+    }
+    if (!eventStoreHasColumn(inFileName, "vz")) {
+        std::cerr << inFileName << " has no vz column, it was ingested before vertices were stored" << std::endl;
+        return;
+    }
+    TMatrixD *c = loadRingSums(inFileName);
+    TVectorD *g = loadColumn(inFileName, "tpc_multiplicity");
+    TVectorD *vz = loadColumn(inFileName, "vz");
+    if (c == nullptr || g == nullptr || vz == nullptr) {
+        return;
+    }
+    uint64_t numEvents = c->GetNcols();
+    metrics.addEvents(numEvents, numEvents * 18. * sizeof(double));
+
+    // The table's bin lookup gives the bin of every event
+    uint32_t nThreads = defaultThreads();
+    std::vector<double> binWeights(vzBins * gramDim);
+    VertexWeightTable binning(vzBins, vertexBinnedMin, vertexBinnedMax, binWeights);
+    std::vector<uint32_t> eventBins(numEvents);
+    const double *vertices = vz->GetMatrixArray();
+    for (uint64_t j = 0; j < numEvents; j++) {
+        eventBins[j] = binning.binOf(vertices[j]);
+    }
+
+    std::vector<WeightedGram> grams;
+    {
+        ScopedTimer timer("binned_gram", numEvents);
+        grams = binnedGram(c, g, eventBins.data(), vzBins, nullptr, nThreads);
+    }
+    // binOf clamps every event into a bin, so the bins add up to the Gram of all events, the
+    // fallback for bins with too few events
+    WeightedGram all;
+    for (uint32_t bin = 0; bin < vzBins; bin++) {
+        all.add(grams[bin]);
+    }
+    double global[gramDim];
+    if (!all.solve(global)) {
+        std::cerr << "Gram matrix of all events is singular" << std::endl;
+        return;
+    }
+    uint32_t fallbacks = 0;
+    std::cout << "  vz bin   events   weights" << std::endl;
+    for (uint32_t bin = 0; bin < vzBins; bin++) {
+        double *solution = &binWeights[bin * gramDim];
+        bool fitted = grams[bin].events >= minEvents && grams[bin].solve(solution);
+        if (!fitted) {
+            memcpy(solution, global, sizeof(global));
+            fallbacks++;
+        }
+        std::cout << "  " << bin << "   " << grams[bin].events << "   " << (fitted ? "fitted" : "global") << std::endl;
+    }
+    std::cout << fallbacks << " of " << vzBins << " bins use the global weights" << std::endl;
+
+    VertexWeightTable lookup(vzBins, vertexBinnedMin, vertexBinnedMax, binWeights);
+    TVectorD *predictions = lookup.predict(c, vertices, nThreads);
+
+    uint32_t predictBins = 200;
+    int32_t predictMin = -100;
+    int32_t predictMax = 300;
+
+    uint32_t realBins = 175;
+    int32_t realMin = 0;
+    int32_t realMax = 350;
+
+    Histogram2D counts(realBins, realMin, realMax, predictBins, predictMin, predictMax);
+    {
+        ScopedTimer timer("fill_histograms", numEvents);
+        counts.fill(g->GetMatrixArray(), predictions->GetMatrixArray(), numEvents);
+    }
+    TH2D *predictVsReal = counts.toTH2D("linear_vz", "X_{#zeta'} vs RefMult1, weights per v_{z} bin;RefMult1;X_{#zeta'}");
+
+    ResultSink sink(outFileName, "linear_vz");
+    sink.add("methods", "linear_vz", predictVsReal);
+    sink.add("methods", "linear_vz_table", lookup.toMatrix());
+    sink.commit();
+}
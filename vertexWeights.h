@@ -0,0 +1,132 @@
+/**
+ * \brief Linear weights per primary vertex z bin.  vertexBinnedWeights.cpp stores them
+ *        in the relations file as methods/<method>_table, a TMatrixD with one row per
+ *        bin: its low and high vz edge, then the 17 weights in the linear layout
+ *        (rings 0-15, bias 16).  Bins are uniform, so the lookup is arithmetic into a
+ *        flat array, and vertices outside the table use the nearest edge bin.
+ *
+ *            VertexWeightTable *table = VertexWeightTable::load("data/epd_tpc_relations.root");
+ *            const double *weights = table->weightsFor(event->primaryVertex().Z());
+ *
+ *        predict() is the per event prediction kernel for a whole store.
+ *
+ * \author Tristan Protzman
+ * \date October 18, 2026
+ * \email tlprotzman@gmail.com
+ * \affiliation Lehigh University
+ *
+ */
+
+#ifndef VERTEX_WEIGHTS
+#define VERTEX_WEIGHTS
+
+#include <TROOT.h>
+#include <TFile.h>
+#include <TMatrixD.h>
+#include <TVectorD.h>
+
+#include <stdint.h>
+
+#include <iostream>
+#include <vector>
+
+#include "gram.h"
+#include "parallel.h"
+
+class VertexWeightTable {
+public:
+    // binWeights holds gramDim weights per bin, bins split [vzMin, vzMax) evenly
+    VertexWeightTable(uint32_t bins, double low, double high, const std::vector<double> &binWeights)
+        : nBins(bins), vzMin(low), vzMax(high), binsPerCm(bins / (high - low)), weights(binWeights) {}
+
+    // methods/<method>_table of a relations file, nullptr if it is missing or malformed
+    static VertexWeightTable *load(const char *fileName, const char *method = "linear_vz") {
+        TFile file(fileName);
+        if (file.IsZombie()) {
+            std::cerr << "Could not open " << fileName << std::endl;
+            return nullptr;
+        }
+        TMatrixD *table = nullptr;
+        file.GetObject(Form("methods/%s_table", method), table);
+        if (table == nullptr || table->GetNcols() != (int32_t)gramDim + 2 || table->GetNrows() == 0) {
+            std::cerr << fileName << " has no vertex weight table for " << method << std::endl;
+            delete table;
+            return nullptr;
+        }
+        uint32_t bins = table->GetNrows();
+        std::vector<double> binWeights(bins * gramDim);
+        for (uint32_t bin = 0; bin < bins; bin++) {
+            for (uint32_t q = 0; q < gramDim; q++) {
+                binWeights[bin * gramDim + q] = (*table)[bin][q + 2];
+            }
+        }
+        VertexWeightTable *loaded = new VertexWeightTable(bins, (*table)[0][0], (*table)[bins - 1][1], binWeights);
+        delete table;
+        return loaded;
+    }
+
+    // The matrix stored as methods/<method>_table
+    TMatrixD *toMatrix() const {
+        TMatrixD *table = new TMatrixD(nBins, gramDim + 2);
+        for (uint32_t bin = 0; bin < nBins; bin++) {
+            (*table)[bin][0] = vzMin + bin / binsPerCm;
+            (*table)[bin][1] = vzMin + (bin + 1) / binsPerCm;
+            for (uint32_t q = 0; q < gramDim; q++) {
+                (*table)[bin][q + 2] = weights[bin * gramDim + q];
+            }
+        }
+        return table;
+    }
+
+    uint32_t numberOfBins() const {
+        return nBins;
+    }
+
+    // Bin of a vertex, clamped to the table.  NaN goes to the last bin.
+    uint32_t binOf(double vz) const {
+        double position = (vz - vzMin) * binsPerCm;
+        position = position < nBins - 1 ? position : nBins - 1;
+        return position > 0 ? (uint32_t)position : 0;
+    }
+
+    const double *weightsFor(double vz) const {
+        return &weights[binOf(vz) * gramDim];
+    }
+
+    // X_j = sum_r W_r(vz_j) C_{r, j} + W_16(vz_j) for every event of the ring sums c.  Vertices
+    // change from event to event, so a block first finds each event's row of the flat table and
+    // then gathers the weights ring by ring.
+    TVectorD *predict(const TMatrixD *c, const double *vz, uint32_t nThreads = 0) const {
+        uint64_t numEvents = c->GetNcols();
+        const double *rings = c->GetMatrixArray();
+        TVectorD *predictions = new TVectorD(numEvents);
+        double *output = predictions->GetMatrixArray();
+        parallelFor(numEvents, nThreads > 0 ? nThreads : defaultThreads(),
+                    [&](uint64_t begin, uint64_t end, uint32_t thread) {
+            const double *row[gramBlock];
+            for (uint64_t first = begin; first < end; first += gramBlock) {
+                uint32_t length = end - first < gramBlock ? end - first : gramBlock;
+                for (uint32_t i = 0; i < length; i++) {
+                    row[i] = &weights[binOf(vz[first + i]) * gramDim];
+                    output[first + i] = row[i][gramDim - 1];
+                }
+                for (uint32_t r = 0; r < gramDim - 1; r++) {
+                    const double *ring = rings + r * numEvents + first;
+                    for (uint32_t i = 0; i < length; i++) {
+                        output[first + i] += row[i][r] * ring[i];
+                    }
+                }
+            }
+        });
+        return predictions;
+    }
+
+private:
+    uint32_t nBins;
+    double vzMin;
+    double vzMax;
+    double binsPerCm;
+    std::vector<double> weights;        // gramDim per bin
+};
+
+#endif // VERTEX_WEIGHTS